@@ -0,0 +1,213 @@
+/*
+ Awaitable publish/subscribe operations on top of a Transport.
+
+ Operations complete from the transport callbacks, so a coroutine awaiting them resumes on the transport's network
+ thread: `co_await client.publish(..., 1)` resumes once the PUBACK arrives and `co_await client.nextMessage()` once a
+ message is received. Any number of coroutines can be suspended at the same time without a thread each.
+
+ The client takes over the transport callbacks, so a transport must not be shared with other callback users.
+ */
+
+#pragma once
+
+#include "message_pool.h"
+#include "transport.h"
+
+#include <atomic>
+#include <climits>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+class AsyncClient
+{
+public:
+    /* Result of the operations cancelAll() completes, distinct from any transport error */
+    static constexpr int CANCELLED = INT_MIN;
+
+    /* Completion shared by all awaiters. A completion may race with the awaiting coroutine suspending, whichever comes
+     * second resumes the coroutine (or keeps it running). */
+    class Operation
+    {
+    public:
+        void complete(int result);
+        bool suspend(std::coroutine_handle<> handle);
+        int result() const
+        {
+            return result_;
+        }
+
+    private:
+        enum State
+        {
+            PENDING,
+            SUSPENDED,
+            COMPLETED,
+        };
+        std::atomic<int> state_ = PENDING;
+        std::coroutine_handle<> handle_;
+        int result_ = 0;
+    };
+
+    /* Resumes with the CONNACK reason code, or with the transport error if the connection could not be started */
+    class ConnectAwaiter
+    {
+    public:
+        explicit ConnectAwaiter(AsyncClient & client)
+        : client_(client)
+        {
+        }
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle);
+        int await_resume() const
+        {
+            return op_.result();
+        }
+
+    private:
+        AsyncClient & client_;
+        Operation op_;
+    };
+
+    /* Resumes with 0 once a QoS 0 message was sent or a QoS 1/2 message acknowledged, or with the transport error */
+    class PublishAwaiter
+    {
+    public:
+        PublishAwaiter(AsyncClient & client, const char * topic, const void * payload, size_t payload_len, int qos)
+        : client_(client)
+        , topic_(topic)
+        , payload_(payload)
+        , payload_len_(payload_len)
+        , qos_(qos)
+        {
+        }
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle);
+        int await_resume() const
+        {
+            return op_.result();
+        }
+
+    private:
+        AsyncClient & client_;
+        const char * topic_;
+        const void * payload_;
+        size_t payload_len_;
+        int qos_;
+        Operation op_;
+    };
+
+    /* Resumes with the granted QoS, or with a negative transport error if the SUBSCRIBE could not be sent */
+    class SubscribeAwaiter
+    {
+    public:
+        SubscribeAwaiter(AsyncClient & client, const char * topic_filter, int qos)
+        : client_(client)
+        , topic_filter_(topic_filter)
+        , qos_(qos)
+        {
+        }
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle);
+        int await_resume() const
+        {
+            return op_.result();
+        }
+
+    private:
+        AsyncClient & client_;
+        const char * topic_filter_;
+        int qos_;
+        Operation op_;
+    };
+
+    /* Resumes with the next received message, or with nothing once the stream has been closed */
+    class MessageAwaiter
+    {
+    public:
+        explicit MessageAwaiter(AsyncClient & client)
+        : client_(client)
+        {
+        }
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle);
+        std::optional<ReceivedMessage> await_resume()
+        {
+            return std::move(msg_);
+        }
+
+    private:
+        friend class AsyncClient;
+        AsyncClient & client_;
+        std::optional<ReceivedMessage> msg_;
+        Operation op_;
+    };
+
+    explicit AsyncClient(Transport & transport);
+    ~AsyncClient();
+    AsyncClient(const AsyncClient &) = delete;
+    AsyncClient & operator=(const AsyncClient &) = delete;
+
+    Transport & transport()
+    {
+        return transport_;
+    }
+
+    /* Connects and starts the network loop */
+    ConnectAwaiter connect()
+    {
+        return ConnectAwaiter(*this);
+    }
+    /* `topic` and `payload` must stay valid until the awaiter resumes */
+    PublishAwaiter publish(const char * topic, const void * payload, size_t payload_len, int qos)
+    {
+        return { *this, topic, payload, payload_len, qos };
+    }
+    SubscribeAwaiter subscribe(const char * topic_filter, int qos)
+    {
+        return { *this, topic_filter, qos };
+    }
+    /* Single consumer stream of the messages received on all subscriptions */
+    MessageAwaiter nextMessage()
+    {
+        return MessageAwaiter(*this);
+    }
+    /* Ends the message stream, a pending nextMessage() resumes with nothing */
+    void closeMessages();
+    /* Completes every pending operation with CANCELLED and ends the message stream, so no coroutine stays suspended
+     * on the client. Call once the transport's network thread is stopped: the coroutines resume on the caller. */
+    void cancelAll();
+
+private:
+    void onConnect(int reason_code);
+    void onPublish(int mid);
+    void onSubscribe(int mid, int qos_count, const int * granted_qos);
+    void onMessage(const TransportMessage & msg);
+
+    Transport & transport_;
+    std::mutex mutex_;
+    Operation * connect_op_ = nullptr;
+    bool started_ = false;
+    /* Operations by message id. Acks for an id not registered yet arrived before the awaiter could register it. */
+    std::unordered_map<int, Operation *> pending_publishes_;
+    std::unordered_map<int, int> early_publish_acks_;
+    std::unordered_map<int, Operation *> pending_subscribes_;
+    std::unordered_map<int, int> early_subscribe_acks_;
+    std::deque<ReceivedMessage> messages_;
+    MessageAwaiter * message_waiter_ = nullptr;
+    bool messages_closed_ = false;
+};
@@ -0,0 +1,47 @@
+/*
+ Concurrent publish flows written as coroutines on top of AsyncClient.
+
+ Each flow publishes QoS 1 samples to its own sub-topic and awaits the PUBACK of every message before sending the
+ next one, so thousands of flows share the transport's network thread instead of needing a thread each. A flow whose
+ publish fails stops there rather than retrying into the same error. When verifying, the connection also subscribes
+ to the flows' topics and a receiving coroutine counts the messages that come back.
+ */
+
+#pragma once
+
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+struct AsyncFlowReport
+{
+    int connect_rc = 0;
+    /* Transport error of the first publish that failed */
+    int publish_rc = 0;
+    /* Result of the verifying subscription when it failed, as AsyncClient::subscribe() resumed with it */
+    int subscribe_rc = 0;
+    int num_flows = 0;
+    bool verify = false;
+    uint64_t acked = 0;
+    uint64_t failed = 0;
+    uint64_t received = 0;
+    std::chrono::microseconds total_latency{ 0 };
+    std::chrono::microseconds max_latency{ 0 };
+    std::chrono::duration<double> elapsed{ 0 };
+
+    void print(std::ostream & os) const;
+};
+
+/* Connects `transport`, runs `num_flows` flows publishing `num_messages` each (forever when <= 0) to
+ * `<topic>/<flow index>` and returns once all of them finished or `stop` was raised. With `verify`, messages received
+ * on `<topic>/#` are counted too. */
+AsyncFlowReport runAsyncFlows(Transport & transport,
+                              const char * topic,
+                              int num_flows,
+                              int num_messages,
+                              int (*read_sample)(),
+                              const std::atomic_bool & stop,
+                              bool verify = false);
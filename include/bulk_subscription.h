@@ -0,0 +1,98 @@
+/*
+ Subscribing to thousands of topic filters at startup.
+
+ One SUBSCRIBE per filter costs the broker a packet and a SUBACK each, so a gateway with thousands of device topics
+ spends minutes starting up. BulkSubscription packs the filters into as few SUBSCRIBE packets as the broker's limits
+ allow, each under `max_packet_size` bytes and `max_filters` filters, and sends them back to back without waiting for
+ the SUBACKs in between.
+
+ The filters may be spread over several connections, each filter going to exactly one of them, so their messages
+ arrive over several network threads. Otherwise every connection subscribes to all of them, as members of a shared
+ subscription group do. The time from the first SUBSCRIBE until every SUBACK arrived is recorded.
+ */
+
+#pragma once
+
+#include "transport.h"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SubscribeBatchLimits
+{
+    /* Of the whole SUBSCRIBE packet, header included */
+    size_t max_packet_size = 131072;
+    size_t max_filters = 512;
+};
+
+/* Reads one topic filter per line, blank lines skipped. Returns std::nullopt and sets `error` when the file can't be
+ * read or holds an invalid filter. */
+std::optional<std::vector<std::string>> loadTopicFilters(const std::string & path, std::string & error);
+
+/* Size of a SUBSCRIBE packet whose filters take `filter_bytes` together, each counting its length prefix and options */
+size_t subscribePacketSize(size_t filter_bytes);
+
+/* Splits `filters` into consecutive batches within `limits`, returns the end index of each. A filter too long for any
+ * packet still gets a batch of its own, for the broker to refuse. */
+std::vector<size_t> planSubscribeBatches(const std::vector<std::string> & filters, const SubscribeBatchLimits & limits);
+
+class BulkSubscription
+{
+public:
+    enum class Progress
+    {
+        PENDING,
+        /* Every batch of this connection was acknowledged */
+        CONNECTION_DONE,
+        /* Same, and it was the last connection to finish for the first time */
+        ALL_DONE,
+    };
+
+    /* With `spread`, filter i goes to connection i % num_connections */
+    BulkSubscription(const std::vector<std::string> & filters,
+                     size_t num_connections,
+                     bool spread,
+                     SubscribeBatchLimits limits);
+
+    /* Sends all batches of `connection`, starting over after a reconnect. Returns the error of the first batch that
+     * couldn't be sent. */
+    int subscribe(Transport & transport, size_t connection, int qos);
+    /* Takes in a SUBACK of `connection`, which must only carry our subscribes. SUBACKs are counted rather than matched
+     * by mid, since they may arrive before subscribeMultiple() returned it. Thread-safe. */
+    Progress onSubAck(size_t connection, int qos_count, const int * granted_qos);
+
+    /* Number of filters the broker granted on `connection` so far */
+    size_t grantedCount(size_t connection) const;
+
+    /* Prints filters, batches, refusals and time to the last SUBACK of `connection` */
+    void printConnectionReport(std::ostream & os, size_t connection) const;
+    /* Prints the totals and the time from the first SUBSCRIBE to the last SUBACK */
+    void printReport(std::ostream & os) const;
+
+private:
+    struct Connection
+    {
+        std::vector<std::string> filters;
+        std::vector<size_t> batch_ends;
+        size_t batches_acked = 0;
+        size_t granted = 0;
+        size_t refused = 0;
+        bool done_once = false;
+        std::chrono::steady_clock::time_point start_tp;
+        std::chrono::steady_clock::duration elapsed{ 0 };
+    };
+
+    std::vector<std::unique_ptr<Connection>> connections_;
+
+    mutable std::mutex mutex_;
+    std::optional<std::chrono::steady_clock::time_point> first_start_tp_;
+    std::chrono::steady_clock::duration all_elapsed_{ 0 };
+    size_t num_done_ = 0;
+    bool all_done_ = false;
+};
@@ -0,0 +1,76 @@
+/*
+ Wire format for streaming a file as a series of MQTT messages, shared by both tools (main.cpp receives and sends,
+ the Paho tool in main.c sends), hence the C API.
+
+ Every chunk is one message on the same topic: a fixed CHUNK_HEADER_SIZE header followed by `chunk_size` bytes of the
+ file, fewer for the last chunk. The header carries the transfer id, the chunk's sequence number and byte offset, the
+ chunk count and size, the file size, a CRC-32 of the chunk and a CRC-32 of the whole file, all little-endian, so a
+ receiver can place chunks arriving in any order, drop duplicates and corrupt chunks, and verify the reassembled file.
+ Only one chunk is ever read into memory, so sending uses constant memory whatever the file size.
+
+ Layout: magic "MQCK" | version u8 | 3 reserved bytes | transfer id u32 | seq u32 | chunk count u32 | chunk size u32 |
+ offset u64 | file size u64 | chunk crc u32 | file crc u32.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum
+{
+    CHUNK_HEADER_SIZE = 48,
+    CHUNK_PROTOCOL_VERSION = 2,
+};
+
+struct ChunkHeader
+{
+    uint32_t transfer_id;
+    uint32_t seq;
+    uint32_t chunk_count;
+    uint32_t chunk_size;
+    uint64_t offset;
+    uint64_t file_size;
+    uint32_t chunk_crc;
+    uint32_t file_crc;
+};
+
+/* Writes CHUNK_HEADER_SIZE bytes to `out` */
+void chunkHeaderEncode(const struct ChunkHeader * header, unsigned char * out);
+
+/* Parses the header of a chunk message. Returns 0, or -1 when `payload` isn't a chunk of this protocol version or its
+ * fields are inconsistent: the chunk count must be the file size divided by the chunk size rounded up (1 for an
+ * empty file), the offset must be `seq * chunk_size` and the payload must hold exactly that chunk's bytes, so chunks
+ * of a transfer never overlap. Doesn't check the CRC. */
+int chunkHeaderDecode(const void * payload, size_t payload_len, struct ChunkHeader * header);
+
+/* CRC-32 (IEEE) of `data` continuing from `crc`, start with 0 */
+uint32_t chunkCrc32(uint32_t crc, const void * data, size_t len);
+
+/* Reads a file chunk by chunk for sending */
+struct ChunkedFileReader;
+
+/* Opens `path` and computes its CRC-32 in one streaming pass. Returns NULL with errno set when the file can't be read
+ * or `chunk_size` is 0. */
+struct ChunkedFileReader * chunkedFileReaderOpen(const char * path, uint32_t chunk_size, uint32_t transfer_id);
+void chunkedFileReaderClose(struct ChunkedFileReader * reader);
+
+uint32_t chunkedFileReaderChunkCount(const struct ChunkedFileReader * reader);
+uint64_t chunkedFileReaderFileSize(const struct ChunkedFileReader * reader);
+
+/* Size of the buffer chunkedFileReaderRead() needs, CHUNK_HEADER_SIZE + chunk size */
+size_t chunkedFileReaderMessageSize(const struct ChunkedFileReader * reader);
+
+/* Writes the message for chunk `seq` to `buffer`, returns its length or -1 with errno set when the read failed */
+long chunkedFileReaderRead(struct ChunkedFileReader * reader, uint32_t seq, unsigned char * buffer);
+
+/* A transfer id unlikely to collide with other senders' */
+uint32_t chunkTransferIdNew(void);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,85 @@
+/*
+ Consumer connections of this process and their throughput.
+
+ Without a group there is usually a single member subscribed to the consume topic, several only make sense when they
+ split a list of filters between them (see bulk_subscription.h). With a group, every member subscribes to the MQTT v5
+ shared subscription `$share/<group>/<topic>` and the broker load-balances messages across the members.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ConsumerMember
+{
+    size_t index = 0;
+    std::string client_id;
+    std::string subscribe_topic;
+    std::atomic_bool subscribed = false;
+    /* Set by the first CONNACK, later ones are reconnects */
+    std::atomic_bool connected_once = false;
+    std::atomic<uint64_t> messages = 0;
+    std::atomic<uint64_t> bytes = 0;
+    /* Message callbacks under way, so shutdown can wait for them once it stopped consuming */
+    std::atomic<int> in_callback = 0;
+
+    void recordMessage(size_t payload_len)
+    {
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(payload_len, std::memory_order_relaxed);
+    }
+};
+
+class ConsumerGroup
+{
+public:
+    /* An empty `group` subscribes the members to `topic` directly */
+    ConsumerGroup(std::string group, const std::string & topic, const std::string & client_id, size_t num_members);
+    ~ConsumerGroup();
+    ConsumerGroup(const ConsumerGroup &) = delete;
+    ConsumerGroup & operator=(const ConsumerGroup &) = delete;
+
+    static std::string sharedSubscriptionTopic(const std::string & group, const std::string & topic);
+
+    bool isShared() const
+    {
+        return !group_.empty();
+    }
+    size_t size() const
+    {
+        return members_.size();
+    }
+    ConsumerMember & member(size_t index)
+    {
+        return *members_[index];
+    }
+    size_t subscribedCount() const;
+
+    /* Prints per-member throughput every `interval` until stopReporter() */
+    void startReporter(std::chrono::milliseconds interval);
+    void stopReporter();
+    /* Prints totals and average rates since the group was created */
+    void printSummary(std::ostream & os) const;
+
+private:
+    void report(std::ostream & os, std::vector<uint64_t> & last_messages, std::chrono::duration<double> elapsed) const;
+
+    std::string group_;
+    std::vector<std::unique_ptr<ConsumerMember>> members_;
+    std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+
+    std::mutex reporter_mutex_;
+    std::condition_variable reporter_cond_var_;
+    bool stop_reporter_ = false;
+    std::thread reporter_;
+};
@@ -0,0 +1,61 @@
+/*
+ DDSketch quantile sketch with relative error guarantees.
+
+ Values are counted in logarithmically sized buckets so any quantile is returned within `relative_accuracy` of the
+ true value, in memory that only grows with the log of the value range. Sketches with the same accuracy merge
+ exactly, which is what sliding windows rely on. The bucket index comes from the float's exponent and mantissa bits
+ with a linear approximation of log2 instead of calling std::log, so addBatch() can run its index loop vectorized.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class DDSketch
+{
+public:
+    explicit DDSketch(double relative_accuracy = 0.01);
+
+    void add(double value);
+    /* Same as calling add() for each value, but computes all bucket indices in one tight loop first */
+    void addBatch(const double * values, size_t count);
+    /* `other` must have been created with the same relative accuracy */
+    void merge(const DDSketch & other);
+    void clear();
+
+    /* Value at quantile `q` in [0, 1], 0 when empty */
+    double quantile(double q) const;
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+private:
+    /* Counts of consecutive bucket indices starting at `offset` */
+    struct Store
+    {
+        std::vector<uint64_t> counts;
+        int32_t offset = 0;
+        uint64_t total = 0;
+
+        void add(int32_t index, uint64_t count = 1);
+        void merge(const Store & other);
+        void clear();
+    };
+
+    int32_t index(double magnitude) const;
+    double value(int32_t index) const;
+    void addIndexed(double value, int32_t index);
+
+    double multiplier_;
+    /* Magnitudes below this go to the zero bucket rather than overflowing the index */
+    double min_indexable_;
+    Store positive_;
+    Store negative_;
+    uint64_t zero_count_ = 0;
+    uint64_t count_ = 0;
+    /* Reused by addBatch() */
+    std::vector<int32_t> batch_indices_;
+};
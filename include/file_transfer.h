@@ -0,0 +1,123 @@
+/*
+ Streaming files over MQTT in chunks (see chunked_transfer.h for the wire format).
+
+ sendFile() publishes a file chunk by chunk with at most `max_in_flight` chunks unacknowledged, reading each chunk
+ just before it goes out, so memory stays at one chunk and the broker never sees more than its share of in-flight
+ messages whatever the file size.
+
+ ChunkReassembler writes chunks straight to their offset in a memory-mapped output file preallocated to the full
+ size, so chunks may arrive in any order and across several connections. Duplicates are dropped, corrupt chunks are
+ dropped and counted, and transfers larger than `max_bytes` are refused before anything is allocated for them. Once
+ every chunk arrived, a thread of its own checks the file's CRC-32, syncs it to disk and renames it from `<id>.part`
+ to its final name, so the network thread that delivered the last chunk isn't held up reading the whole file.
+ Transfers still incomplete at exit keep their `.part` file.
+ */
+
+#pragma once
+
+#include "chunked_transfer.h"
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct FileSendOptions
+{
+    std::string path;
+    std::string topic;
+    uint32_t chunk_size = 32768;
+    int max_in_flight = 16;
+    int qos = 1;
+};
+
+struct FileSendReport
+{
+    /* Why the transfer stopped short, empty when every chunk was acknowledged */
+    std::string error;
+    uint32_t transfer_id = 0;
+    uint64_t file_size = 0;
+    uint32_t chunk_count = 0;
+    uint64_t chunks_acked = 0;
+    int max_in_flight = 0;
+    std::chrono::duration<double> elapsed{ 0 };
+
+    void print(std::ostream & os) const;
+};
+
+/* Takes over the callbacks of `transport`, connects it, sends the file and disconnects. Returns early when `stop` is
+ * raised. */
+FileSendReport sendFile(Transport & transport, const FileSendOptions & options, const std::atomic_bool & stop);
+
+class ChunkReassembler
+{
+public:
+    ChunkReassembler(std::string output_dir, uint64_t max_bytes);
+    ~ChunkReassembler();
+    ChunkReassembler(const ChunkReassembler &) = delete;
+    ChunkReassembler & operator=(const ChunkReassembler &) = delete;
+
+    /* Takes in a chunk, returns false when `msg` isn't one. Thread-safe. */
+    bool handle(const TransportMessage & msg);
+
+    /* Finishes the transfers whose chunks all arrived and stops the finishing thread */
+    void stop();
+
+    /* Prints completed, failed and incomplete transfers and dropped chunks */
+    void printStats(std::ostream & os) const;
+
+private:
+    struct Transfer
+    {
+        uint32_t id = 0;
+        uint64_t file_size = 0;
+        uint32_t chunk_count = 0;
+        uint32_t chunk_size = 0;
+        uint32_t file_crc = 0;
+        int fd = -1;
+        unsigned char * map = nullptr;
+        std::string part_path;
+        std::chrono::steady_clock::time_point start_tp;
+        /* Guarded by ChunkReassembler::mutex_ */
+        std::vector<bool> claimed;
+        uint32_t written = 0;
+        bool failed = false;
+
+        ~Transfer();
+    };
+
+    /* Returns transfer `id`, creating and preallocating its file on its first chunk. Called with mutex_ held. */
+    std::shared_ptr<Transfer> findOrCreate(const ChunkHeader & header);
+    void runFinisher();
+    /* Verifies and renames a transfer whose chunks all arrived */
+    void finish(Transfer & transfer);
+
+    std::string output_dir_;
+    uint64_t max_bytes_;
+    mutable std::mutex mutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<Transfer>> transfers_;
+    /* Late duplicates of these are dropped rather than starting the transfer over */
+    std::unordered_set<uint32_t> done_;
+    /* Chunks of these are dropped without a word, the refusal was reported on the first one */
+    std::unordered_set<uint32_t> refused_;
+    uint64_t completed_ = 0;
+    uint64_t failed_ = 0;
+    uint64_t duplicates_ = 0;
+    uint64_t corrupt_ = 0;
+
+    std::condition_variable finish_cond_var_;
+    /* Transfers whose chunks all arrived, waiting for the finishing thread. Guarded by mutex_. */
+    std::deque<std::shared_ptr<Transfer>> finishing_;
+    bool stopping_ = false;
+    std::thread finisher_;
+};
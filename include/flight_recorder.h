@@ -0,0 +1,69 @@
+/*
+ In-process flight recorder.
+
+ Every thread that records an event gets its own fixed-size ring of timestamped events, so recording is a couple of
+ relaxed stores with no locking. The rings can be written out at any time as Chrome trace JSON, which both
+ chrome://tracing and https://ui.perfetto.dev open. Recording is off until enable() is called and then costs a single
+ relaxed load per event site.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class TraceEvent : uint8_t
+{
+    PUBLISH_ENQUEUED, /* handed to the transport, arg = publishSpan() */
+    PUBLISH_DONE, /* QoS 0 written to the socket or QoS 1/2 acknowledged, arg = publishSpan() */
+    MESSAGE_RECEIVED, /* arg = payload length */
+    HANDLER_BEGIN, /* arg = payload length */
+    HANDLER_END,
+    CONNECTED, /* arg = CONNACK reason code */
+    RECONNECTED, /* CONNACK after the first one, arg = reason code */
+    DISCONNECTED, /* arg = reason code */
+};
+
+class FlightRecorder
+{
+public:
+    /* Starts recording with room for `events_per_thread` events (rounded up to a power of two) per thread. Dumps to
+     * `dump_path` on SIGUSR1 and when the process exits, however it exits through exit() or main(). */
+    static void enable(size_t events_per_thread, std::string dump_path);
+    static bool enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static void record(TraceEvent event, int64_t arg);
+    /* For events only known to have happened at `ts_ns` (from now()) after the fact */
+    static void record(TraceEvent event, int64_t arg, int64_t ts_ns);
+    static int64_t now();
+
+    /* Names the calling thread in the trace */
+    static void setThreadName(const char * name);
+
+    /* Writes all rings to `path` as Chrome trace JSON, through `<path>.tmp` renamed into place. Concurrent dumps take
+     * turns. */
+    static bool dump(const std::string & path);
+    /* Writes to the path given to enable() */
+    static bool dump();
+
+private:
+    static std::atomic_bool s_enabled;
+};
+
+/* Identifies a publish by the transport it went through and its mid there, as mids of different connections collide */
+inline int64_t publishSpan(uint32_t connection, int mid)
+{
+    return static_cast<int64_t>((static_cast<uint64_t>(connection) << 32) | static_cast<uint32_t>(mid));
+}
+
+inline void traceEvent(TraceEvent event, int64_t arg = 0)
+{
+    if (FlightRecorder::enabled()) {
+        FlightRecorder::record(event, arg);
+    }
+}
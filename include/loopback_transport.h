@@ -0,0 +1,156 @@
+/*
+ In-process transport that routes published messages straight to the message callbacks of matching subscribers.
+
+ There is no network, broker process or serialization involved, which makes it suitable for measuring and profiling
+ the application's own per-message overhead. Callbacks run synchronously on the thread calling connect/subscribe/
+ publish. Messages are delivered outside the broker's lock, so a message callback may subscribe, disconnect or publish,
+ but a transport must not be destroyed while a message may still be routed to it.
+
+ Publish completions can be held back by a fixed delay, to stand in for a broker's round trip. They are then reported
+ from a thread of the transport's own, and the ones still pending are dropped by stop().
+
+ To exercise recovery, a transport can also refuse its first connects, either failing connect() or with a refusing
+ CONNACK followed by a disconnect as libmosquitto reports one, and lose its connection once, as a network failure
+ would, with the disconnect reported from the publishing thread.
+ */
+
+#pragma once
+
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class LoopbackTransport;
+
+/* Routes messages between the loopback transports attached to it */
+class LoopbackBroker
+{
+public:
+    int subscribe(LoopbackTransport & client, std::string_view topic_filter, int qos);
+    void unsubscribeAll(LoopbackTransport & client);
+    /* Returns the number of deliveries */
+    size_t route(std::string_view topic, const void * payload, size_t payload_len, int qos, bool retain, int mid);
+
+private:
+    struct Subscription
+    {
+        std::string filter;
+        LoopbackTransport * client = nullptr;
+        int qos = 0;
+    };
+    /* Members of a `$share/<group>/<filter>` subscription take turns receiving messages */
+    struct SharedGroup
+    {
+        std::string group;
+        std::string filter;
+        std::vector<Subscription> members;
+        std::atomic<size_t> next = 0;
+    };
+
+    std::shared_mutex mutex_;
+    std::vector<Subscription> subscriptions_;
+    std::vector<std::unique_ptr<SharedGroup>> shared_groups_;
+};
+
+class LoopbackTransport : public Transport
+{
+public:
+    enum Error
+    {
+        LOOPBACK_SUCCESS = 0,
+        LOOPBACK_ERR_NO_CONN = 1,
+        LOOPBACK_ERR_INVAL = 2,
+        LOOPBACK_ERR_CONN_REFUSED = 3,
+    };
+    /* CONNACK return code of refused connects, as in MQTT 3.1.1 */
+    static constexpr int LOOPBACK_CONNACK_NOT_AUTHORIZED = 5;
+
+    LoopbackTransport(std::string client_id, LoopbackBroker & broker);
+    ~LoopbackTransport() override;
+    LoopbackTransport(const LoopbackTransport &) = delete;
+    LoopbackTransport & operator=(const LoopbackTransport &) = delete;
+
+    const char * name() const override
+    {
+        return "loopback";
+    }
+    const std::string & clientId() const override
+    {
+        return client_id_;
+    }
+
+    /* Reports publishes done `delay` after publish() instead of before it returns. Set before start(). */
+    void setAckDelay(std::chrono::milliseconds delay)
+    {
+        ack_delay_ = delay;
+    }
+    /* Fails the next `count` connects with LOOPBACK_ERR_CONN_REFUSED. Set before connect(). */
+    void setRefusedConnects(int count)
+    {
+        refused_connects_ = count;
+    }
+    /* Lets the next `count` connects succeed but refuses them in the CONNACK. Set before connect(). */
+    void setRefusedConnacks(int count)
+    {
+        refused_connacks_ = count;
+    }
+    /* Drops the connection when the `publishes`th message is published, which then fails; 0 never drops */
+    void setDropAfter(int publishes)
+    {
+        drop_after_ = publishes;
+    }
+
+    int connect() override;
+    int disconnect() override;
+    int start() override;
+    void stop() override;
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+private:
+    friend class LoopbackBroker;
+    void deliver(const TransportMessage & msg)
+    {
+        notifyMessage(msg);
+    }
+    /* Reports a refusing CONNACK and the disconnect that follows it */
+    void refuse();
+    void runAcks();
+    void stopAcks();
+
+    std::string client_id_;
+    LoopbackBroker & broker_;
+    std::atomic_bool connected_ = false;
+    bool started_ = false;
+    std::atomic<int> next_mid_ = 0;
+    int refused_connects_ = 0;
+    int refused_connacks_ = 0;
+    /* The last connect is to be refused in the CONNACK */
+    bool refusing_ = false;
+    int drop_after_ = 0;
+    std::atomic<int> published_ = 0;
+
+    std::chrono::milliseconds ack_delay_{ 0 };
+    std::mutex ack_mutex_;
+    std::condition_variable ack_cond_var_;
+    /* Mids to report done and when, in order */
+    std::deque<std::pair<std::chrono::steady_clock::time_point, int>> acks_;
+    bool acks_stopping_ = false;
+    std::thread ack_thread_;
+};
@@ -0,0 +1,30 @@
+/*
+ Settings and helpers for the opt-in low-latency profile: CPU pinning and SO_BUSY_POLL.
+
+ Sleeping in select() or on a timer costs tens of microseconds of scheduler wake-up latency with a long tail. Spinning
+ on a pinned core removes most of it at the price of burning that core, so waits park until shortly before they are
+ due and spin the rest of the way (see also periodic_scheduler.h).
+ */
+
+#pragma once
+
+#include <chrono>
+
+struct LowLatencyOptions
+{
+    bool enabled = false;
+    /* -1 leaves the thread unpinned */
+    int network_cpu = -1;
+    int publisher_cpu = -1;
+    /* How long before a deadline waits stop parking, and how long the network thread keeps polling without blocking
+     * after traffic */
+    std::chrono::microseconds spin{ 50 };
+    /* SO_BUSY_POLL on the client socket, 0 leaves it off */
+    int busy_poll_us = 0;
+};
+
+/* Pins the calling thread to `cpu`, returns false (and leaves it unpinned) when that fails */
+bool pinCurrentThread(int cpu);
+
+/* Sets SO_BUSY_POLL on `fd`, returns 0 or the errno. Raising it usually needs CAP_NET_ADMIN. */
+int setBusyPoll(int fd, int usec);
@@ -0,0 +1,182 @@
+/*
+ Subscriber-side message filters, so unwanted messages are dropped in onMessage before they are copied, queued to the
+ workers or handled.
+
+ A filter is an expression over the message, for example
+
+   .temp > 80 && topic ~ "sensors/+/temp"
+   topic[1] == "kitchen" || !(payload < 100)
+
+ Operands are
+
+   topic            the topic name
+   topic[<n>]       level n of the topic, counting from 0
+   payload          the whole payload
+   .<name>          top-level field <name> of a flat JSON object payload, see payload_parser.h
+   qos, retain      the message's QoS and retain flag
+   123, -4.5e3      numbers
+   "text"           strings, '\' escapes the next character
+
+ compared with ==, !=, <, <=, >, >=, or matched against an MQTT topic filter with ~. An operand on its own is true
+ when it exists and isn't empty, 0, false or null. Comparisons against a number compare numerically, those against a
+ string compare text, and two message operands compare numerically when both are numbers. A comparison involving a
+ missing operand (no such field or level) or a payload that isn't a number where one is needed is false, != included.
+ Comparisons combine with !, && and || (or not, and, or) and parentheses.
+
+ Expressions are compiled once into a short program of tests and jumps on a single boolean, && and || short-circuit,
+ and evaluating it allocates nothing: operands are views into the message.
+
+ MessageFilters holds one expression per subscription, as "[<topic filter>:]<expression>;...". A message is decided by
+ the first entry whose topic filter matches its topic, an entry without one matches every topic, and messages no entry
+ matches pass.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/* What a filter sees of a message */
+struct FilterInput
+{
+    std::string_view topic;
+    std::string_view payload;
+    int qos = 0;
+    bool retain = false;
+};
+
+class MessageFilter
+{
+public:
+    /* Returns std::nullopt and sets `error` when `expression` doesn't compile */
+    static std::optional<MessageFilter> compile(std::string_view expression, std::string & error);
+
+    bool matches(const FilterInput & msg) const;
+
+    /* The expression as given */
+    const std::string & text() const
+    {
+        return text_;
+    }
+    /* Length of the compiled program */
+    size_t size() const
+    {
+        return program_.size();
+    }
+
+private:
+    struct Operand
+    {
+        enum class Kind : uint8_t
+        {
+            NUMBER,
+            STRING,
+            TOPIC,
+            TOPIC_LEVEL,
+            PAYLOAD,
+            FIELD,
+            QOS,
+            RETAIN,
+        };
+        Kind kind = Kind::NUMBER;
+        /* Level of TOPIC_LEVEL */
+        uint32_t level = 0;
+        double number = 0;
+        /* Literal of STRING, name of FIELD */
+        std::string text;
+    };
+
+    struct Comparison
+    {
+        enum class Op : uint8_t
+        {
+            EQ,
+            NE,
+            LT,
+            LE,
+            GT,
+            GE,
+            /* Left operand matches the topic filter on the right */
+            MATCHES,
+            /* Left operand alone */
+            TRUTHY,
+        };
+        /* How EQ to GE compare, decided from the operands when compiling */
+        enum class Mode : uint8_t
+        {
+            NUMERIC,
+            TEXT,
+            /* Numeric when both sides are numbers, else text */
+            EITHER,
+        };
+        Operand lhs;
+        Op op = Op::TRUTHY;
+        Mode mode = Mode::EITHER;
+        Operand rhs;
+    };
+
+    struct Instruction
+    {
+        enum class Op : uint8_t
+        {
+            /* result = comparisons_[arg] */
+            TEST,
+            /* result = !result */
+            NOT,
+            /* Jump to instruction arg when result is false, or true */
+            JUMP_IF_FALSE,
+            JUMP_IF_TRUE,
+        };
+        Op op;
+        uint32_t arg = 0;
+    };
+
+    class Compiler;
+    struct Value;
+
+    Value load(const Operand & operand, const FilterInput & msg) const;
+    bool test(const Comparison & comparison, const FilterInput & msg) const;
+
+    std::string text_;
+    std::vector<Instruction> program_;
+    std::vector<Comparison> comparisons_;
+};
+
+class MessageFilters
+{
+public:
+    /* Returns nullptr and sets `error` when `spec` isn't a valid list of filters */
+    static std::unique_ptr<MessageFilters> parse(std::string_view spec, std::string & error);
+
+    /* Whether the message should be handled. Thread-safe. */
+    bool accept(const FilterInput & msg);
+
+    /* Prints "Message filter <n>: topics=<topic filter> expression='...' instructions= passed= dropped=" per entry */
+    void printStats(std::ostream & os) const;
+
+private:
+    struct Entry
+    {
+        Entry(std::string topic_filter, MessageFilter filter)
+        : topic_filter(std::move(topic_filter))
+        , filter(std::move(filter))
+        {
+        }
+
+        /* Empty when the entry applies to every topic */
+        std::string topic_filter;
+        MessageFilter filter;
+        std::atomic<uint64_t> passed = 0;
+        std::atomic<uint64_t> dropped = 0;
+    };
+
+    std::vector<std::unique_ptr<Entry>> entries_;
+};
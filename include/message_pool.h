@@ -0,0 +1,141 @@
+/*
+ Size-class buffer pool for received topics and payloads.
+
+ Buffers are handed out from small per-thread caches backed by a shared free list per size class, so a message copied
+ out of the mosquitto callback and released on a consumer thread is recycled without going back to malloc.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+class PooledBuffer;
+
+class MessagePool
+{
+public:
+    static constexpr std::array<size_t, 6> SIZE_CLASSES = { 64, 256, 1024, 4096, 16384, 65536 };
+    static constexpr size_t NUM_CLASSES = SIZE_CLASSES.size();
+    /* Class index used for requests larger than the biggest size class, those go straight to malloc */
+    static constexpr size_t OVERSIZE_CLASS = NUM_CLASSES;
+
+    struct ClassStats
+    {
+        size_t block_size = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        int64_t in_use = 0;
+        int64_t high_water = 0;
+    };
+
+    struct Stats
+    {
+        std::array<ClassStats, NUM_CLASSES + 1> classes;
+        uint64_t totalHits() const;
+        uint64_t totalMisses() const;
+    };
+
+    static MessagePool & instance();
+
+    /* Returns a buffer with room for at least `size` bytes */
+    PooledBuffer acquire(size_t size);
+
+    Stats stats() const;
+    void printStats(std::ostream & os) const;
+
+private:
+    friend class PooledBuffer;
+    friend struct ThreadCache;
+
+    struct alignas(64) Counters
+    {
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<int64_t> in_use = 0;
+        std::atomic<int64_t> high_water = 0;
+    };
+
+    struct alignas(64) SharedFreeList
+    {
+        std::mutex mutex;
+        std::vector<void *> blocks;
+    };
+
+    MessagePool() = default;
+
+    static size_t classFor(size_t size);
+    void release(void * block, size_t size_class);
+    void noteInUse(size_t size_class, int64_t delta);
+
+    /* Move up to `count` blocks between a thread cache and the shared list */
+    size_t takeShared(size_t size_class, std::vector<void *> & out, size_t count);
+    void giveShared(size_t size_class, std::vector<void *> & in, size_t count);
+
+    std::array<SharedFreeList, NUM_CLASSES> shared_;
+    std::array<Counters, NUM_CLASSES + 1> counters_;
+};
+
+/* Move-only handle to a pool block, the block goes back to the pool on destruction */
+class PooledBuffer
+{
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer && other) noexcept;
+    PooledBuffer & operator=(PooledBuffer && other) noexcept;
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer & operator=(const PooledBuffer &) = delete;
+    ~PooledBuffer();
+
+    char * data() const
+    {
+        return data_;
+    }
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+    friend class MessagePool;
+    PooledBuffer(char * data, size_t capacity, size_t size_class);
+    void reset();
+
+    char * data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_class_ = 0;
+};
+
+/* A received message whose topic and payload live in pool buffers. Both are NUL-terminated past their length. */
+struct ReceivedMessage
+{
+    PooledBuffer topic_buffer;
+    PooledBuffer payload_buffer;
+    size_t topic_len = 0;
+    size_t payload_len = 0;
+    int mid = 0;
+    int qos = 0;
+    bool retain = false;
+
+    std::string_view topic() const
+    {
+        return { topic_buffer.data(), topic_len };
+    }
+    const char * payload() const
+    {
+        return payload_buffer.data();
+    }
+};
+
+ReceivedMessage makeReceivedMessage(std::string_view topic,
+                                    const void * payload,
+                                    size_t payload_len,
+                                    int qos,
+                                    bool retain,
+                                    int mid);
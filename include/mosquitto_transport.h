@@ -0,0 +1,98 @@
+/*
+ Transport backed by a libmosquitto client running its own network thread.
+
+ By default the thread is libmosquitto's (mosquitto_loop_start), which reconnects a second after the connection
+ drops. With the low-latency profile the transport runs the loop on a thread of its own instead, so it can be pinned to
+ a core and poll the socket without blocking for a while after traffic before parking in select() again. That thread is
+ also used when auto-reconnect is off, since libmosquitto's can't be kept from reconnecting.
+ */
+
+#pragma once
+
+#include "low_latency.h"
+#include "transport.h"
+
+#include <atomic>
+#include <thread>
+
+struct mosquitto;
+struct mosquitto_message;
+
+class MosquittoTransport : public Transport
+{
+public:
+    /* Wrap mosquitto_lib_init() / mosquitto_lib_cleanup(), required once per process */
+    static int libInit();
+    static void libCleanup();
+
+    MosquittoTransport(std::string client_id, const ConnectionSettings & settings);
+    ~MosquittoTransport() override;
+    MosquittoTransport(const MosquittoTransport &) = delete;
+    MosquittoTransport & operator=(const MosquittoTransport &) = delete;
+
+    /* False when the underlying client could not be created */
+    bool valid() const
+    {
+        return mosq_ != nullptr;
+    }
+    struct mosquitto * handle() const
+    {
+        return mosq_;
+    }
+
+    /* Takes effect on the next start() */
+    void setLowLatency(const LowLatencyOptions & options)
+    {
+        low_latency_ = options;
+    }
+
+    const char * name() const override
+    {
+        return "mosquitto";
+    }
+    const std::string & clientId() const override
+    {
+        return client_id_;
+    }
+
+    int connect() override;
+    int disconnect() override;
+    int start() override;
+    void stop() override;
+    /* Takes effect on the next start() */
+    void setAutoReconnect(bool enabled) override
+    {
+        auto_reconnect_ = enabled;
+    }
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+private:
+    static void onConnect(struct mosquitto * mosq, void * user_data, int reason_code);
+    static void onDisconnect(struct mosquitto * mosq, void * user_data, int reason_code);
+    static void onSubscribe(struct mosquitto * mosq, void * user_data, int mid, int qos_count, const int * granted_qos);
+    static void onMessage(struct mosquitto * mosq, void * user_data, const struct mosquitto_message * msg);
+    static void onPublish(struct mosquitto * mosq, void * user_data, int mid);
+
+    void runNetworkLoop();
+
+    std::string client_id_;
+    ConnectionSettings settings_;
+    struct mosquitto * mosq_ = nullptr;
+    bool loop_started_ = false;
+
+    LowLatencyOptions low_latency_;
+    std::thread network_thread_;
+    std::atomic_bool stop_network_thread_ = false;
+    bool auto_reconnect_ = true;
+    /* Set by disconnect() so our own loop doesn't reconnect like mosquitto_loop_forever() wouldn't either */
+    std::atomic_bool disconnect_requested_ = false;
+    /* Bumped by message and publish callbacks, tells the network loop to keep spinning */
+    std::atomic<uint64_t> activity_ = 0;
+};
@@ -0,0 +1,77 @@
+/*
+ Transport backed by the Eclipse Paho asynchronous C client (MQTTAsync), built when WITH_PAHO is on.
+
+ Paho runs its own send, receive and callback threads from the moment the client connects, so start() and stop() have
+ nothing to run; callbacks arrive on Paho's callback thread. connect() only starts connecting, the outcome is reported
+ through the connect callback like the CONNACK is for the other transports, and Paho reconnects automatically once a
+ connection was established.
+ */
+
+#pragma once
+
+#include "transport.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+class PahoTransport : public Transport
+{
+public:
+    PahoTransport(std::string client_id, const ConnectionSettings & settings);
+    ~PahoTransport() override;
+    PahoTransport(const PahoTransport &) = delete;
+    PahoTransport & operator=(const PahoTransport &) = delete;
+
+    /* False when the underlying client could not be created */
+    bool valid() const
+    {
+        return client_ != nullptr;
+    }
+
+    const char * name() const override
+    {
+        return "paho";
+    }
+    const std::string & clientId() const override
+    {
+        return client_id_;
+    }
+
+    int connect() override;
+    int disconnect() override;
+    int start() override;
+    void stop() override;
+    void setAutoReconnect(bool enabled) override
+    {
+        auto_reconnect_ = enabled;
+    }
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+private:
+    /* Paho's callback argument types are typedefs of anonymous structs that can't be forward declared, so the
+     * trampolines live in paho_transport.cpp */
+    friend struct PahoCallbacks;
+
+    void disconnectDone();
+
+    std::string client_id_;
+    ConnectionSettings settings_;
+    /* An MQTTAsync handle */
+    void * client_ = nullptr;
+    std::atomic_bool connected_ = false;
+    bool auto_reconnect_ = true;
+
+    /* Lets the destructor wait for a clean disconnect before destroying the client */
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    bool disconnecting_ = false;
+};
@@ -0,0 +1,95 @@
+/*
+ Allocation-free parsing of message payloads.
+
+ Payloads are arbitrary bytes with a length, not C strings: nothing here reads past the given length or relies on a
+ terminating NUL. Numbers are decoded with std::from_chars, which is locale-independent and does not allocate.
+ findJsonField() scans a flat JSON object such as {"temp":21.5,"unit":"C"} for one field and returns a view of its raw
+ value, so a consumer that needs one or two fields never builds a document.
+ */
+
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+/* Strips leading and trailing JSON whitespace */
+constexpr std::string_view trimPayload(std::string_view s)
+{
+    constexpr std::string_view WHITESPACE = " \t\r\n";
+    const auto begin = s.find_first_not_of(WHITESPACE);
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    return s.substr(begin, s.find_last_not_of(WHITESPACE) - begin + 1);
+}
+
+/* Parses `text` as a single integer or floating point number, surrounding whitespace allowed */
+template<typename T>
+std::optional<T> parseNumber(std::string_view text)
+{
+    static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, "parseNumber() decodes numbers only");
+    text = trimPayload(text);
+    /* from_chars rejects the leading '+' JSON doesn't allow either, but accepts "inf" and "nan" for floats */
+    T value{};
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || ptr != text.data() + text.size() || text.empty()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+/* Returns the raw value of top-level field `key` in the JSON object `json`: the characters between the quotes for a
+ * string (escapes left as they are), the token for numbers, true, false and null, and the full text of a nested object
+ * or array. Keys are compared without unescaping. Returns nullopt when the field is missing or the text before it is
+ * not valid JSON. */
+std::optional<std::string_view> findJsonField(std::string_view json, std::string_view key);
+
+/* A length-bounded view of a payload */
+class PayloadView
+{
+public:
+    PayloadView(const void * data, size_t len)
+    : text_(static_cast<const char *>(data), len)
+    {
+    }
+    explicit PayloadView(std::string_view text)
+    : text_(text)
+    {
+    }
+
+    std::string_view text() const
+    {
+        return text_;
+    }
+    size_t size() const
+    {
+        return text_.size();
+    }
+
+    /* The whole payload as a number */
+    template<typename T>
+    std::optional<T> as() const
+    {
+        return parseNumber<T>(text_);
+    }
+
+    std::optional<std::string_view> field(std::string_view key) const
+    {
+        return findJsonField(text_, key);
+    }
+
+    /* A numeric JSON field */
+    template<typename T>
+    std::optional<T> field(std::string_view key) const
+    {
+        auto value = findJsonField(text_, key);
+        return value ? parseNumber<T>(*value) : std::nullopt;
+    }
+
+private:
+    std::string_view text_;
+};
@@ -0,0 +1,58 @@
+/*
+ Fixed-rate scheduler driving the publish loops of both tools (main.cpp and the Paho tool in main.c), hence the C API.
+
+ Ticks are absolute: tick n is due at start + n * period on CLOCK_MONOTONIC, so a late wake-up doesn't shift the ticks
+ after it and the schedule doesn't drift. Waits block on a timerfd armed with TFD_TIMER_ABSTIME (clock_nanosleep with
+ TIMER_ABSTIME where there is no timerfd) and can spin through the last stretch before the deadline for lower jitter.
+ How late each wait returned compared to its tick goes into a log-linear histogram (within 12.5%) for the report.
+
+ One thread waits; periodicSchedulerCancel() may be called from any thread or signal handler. Read the stats once the
+ waiting thread is done.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* What a wait does when its tick is already due, i.e. the previous iteration overran */
+enum PeriodicOverrunPolicy
+{
+    /* Return at once for every missed tick until caught up, so the number of ticks over time stays exact */
+    PERIODIC_CATCH_UP,
+    /* Drop the missed ticks and wait for the next one still ahead, so ticks stay on the evenly spaced grid */
+    PERIODIC_SKIP,
+};
+
+struct PeriodicScheduler;
+
+/* Starts a schedule whose first tick is one period from now. A period of 0 makes waits return immediately.
+ * Returns NULL for a negative period or when out of memory. */
+struct PeriodicScheduler * periodicSchedulerCreate(int64_t period_ns,
+                                                   enum PeriodicOverrunPolicy policy,
+                                                   int64_t spin_ns);
+void periodicSchedulerDestroy(struct PeriodicScheduler * scheduler);
+
+/* Waits for the next tick. Returns how many ticks were skipped to get there (0 unless PERIODIC_SKIP), or -1 once
+ * cancelled. Signals don't interrupt it. */
+int periodicSchedulerWait(struct PeriodicScheduler * scheduler);
+
+/* Makes the current and all later waits return -1. Async-signal-safe. */
+void periodicSchedulerCancel(struct PeriodicScheduler * scheduler);
+
+/* Parses "catch-up" or "skip", returns 0 or -1 when `text` is neither */
+int periodicOverrunPolicyParse(const char * text, enum PeriodicOverrunPolicy * policy);
+
+/* Lateness of the waits at quantile `q` in [0, 1], in nanoseconds */
+int64_t periodicSchedulerLatenessQuantile(const struct PeriodicScheduler * scheduler, double q);
+
+/* Prints "Schedule (<name>): ticks= overruns= skipped= lateness p50= p99= p99.9= max=" */
+void periodicSchedulerPrintStats(const struct PeriodicScheduler * scheduler, FILE * out, const char * name);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ In-process consume → transform → republish pipeline.
+
+ A pipeline is a list of stages separated by '|', for example
+
+   filter:sensors/+/temp|field:temp|range:-40:125|scale:1.8:32|publish:fahrenheit/{topic}
+
+   filter:<topic filter>    drop messages on topics not matching the filter
+   field:<name>             replace the payload by a field of a flat JSON object payload
+   range:<min>:<max>        drop numeric payloads outside [min, max] and anything that isn't a number
+   scale:<factor>:<offset>  replace a numeric payload by factor * value + offset
+   window:<seconds>[:<slide seconds>]
+                            replace the stream by per-topic window statistics, see window_aggregator.h
+   publish:<topic>          publish the result; "{topic}" is replaced by the source topic
+
+ Messages on topics the publish stage produces are skipped, so a consume filter that also matches them doesn't feed the
+ pipeline its own output, and "{topic}" alone, which would republish every message onto itself, is rejected. publish
+ must be the last stage and window can only be followed by it. Stages pass views of the received topic and
+ payload along, the only bytes written are a number reformatted by scale into a stack buffer and the copy made when
+ the result is handed to the output.
+ */
+
+#pragma once
+
+#include "window_aggregator.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Pipeline
+{
+public:
+    /* Receives the pipeline's output */
+    using Output = std::function<void(std::string_view topic, std::string_view payload)>;
+
+    /* Returns nullptr when `spec` isn't a valid pipeline */
+    static std::unique_ptr<Pipeline> create(std::string_view spec, Output output);
+    ~Pipeline();
+    Pipeline(const Pipeline &) = delete;
+    Pipeline & operator=(const Pipeline &) = delete;
+
+    /* Runs one message through the stages. Thread-safe. */
+    void process(std::string_view topic, std::string_view payload);
+
+    /* Starts the window stage's timer, if any */
+    void start();
+    /* Stops the window stage, publishing its last windows */
+    void stop();
+
+    /* Prints "Pipeline: in= out= dropped= own=", own counting skipped messages the pipeline published itself */
+    void printStats(std::ostream & os) const;
+
+private:
+    struct Stage
+    {
+        enum class Kind
+        {
+            FILTER,
+            FIELD,
+            RANGE,
+            SCALE,
+        };
+        Kind kind;
+        std::string text;
+        double a = 0;
+        double b = 0;
+    };
+
+    /* A message on its way through the stages */
+    struct Message
+    {
+        std::string_view topic;
+        std::string_view payload;
+        std::optional<double> value;
+        /* Holds the payload once a stage rewrote it */
+        std::array<char, 32> scratch;
+    };
+
+    explicit Pipeline(Output output);
+    bool runStage(const Stage & stage, Message & msg) const;
+    /* Whether the publish stage could have produced `topic` */
+    bool isOwnOutput(std::string_view topic) const;
+    void emit(std::string_view topic, std::string_view payload);
+
+    Output output_;
+    std::vector<Stage> stages_;
+    std::unique_ptr<WindowAggregator> window_;
+    /* Output topic around the source topic */
+    std::string topic_prefix_;
+    std::string topic_suffix_;
+    bool topic_has_source_ = false;
+
+    std::atomic<uint64_t> num_in_ = 0;
+    std::atomic<uint64_t> num_out_ = 0;
+    std::atomic<uint64_t> num_dropped_ = 0;
+    std::atomic<uint64_t> num_own_ = 0;
+};
@@ -0,0 +1,197 @@
+/*
+ Transport keeping urgent traffic ahead of bulk telemetry.
+
+ Topics are mapped to priority lanes by topic filter. Every lane has a bounded queue of its own, and the lanes
+ sharing a connection take turns handing messages to it in proportion to their weight (smooth weighted round robin),
+ with at most `max_in_flight` messages outstanding per connection. A burst on a bulk lane therefore only ever puts
+ `max_in_flight` messages in front of an alarm, instead of everything the MQTT library accepted before it, and a lane
+ with an empty queue sends straight through whatever the backlog of the others.
+
+ A lane may also get a connection of its own, so its messages don't even share a TCP stream with the bulk lanes.
+ Subscriptions, and so received messages, stay on the shared connection. The connect callback runs once every
+ connection is up, or with the first failure, and again whenever the shared connection comes back.
+
+ Every lane's queue applies the overflow policies of publish_queue.h to its own budget, so a telemetry lane can drop
+ or conflate while a control lane blocks. publish() returns what the connection's did for a message sent straight
+ through, and the queue's error for one it rejected. Queued messages wait out disconnections, and those dropped
+ after publish() accepted them are counted but never reported through the publish callback.
+ */
+
+#pragma once
+
+#include "ddsketch.h"
+#include "publish_queue.h"
+#include "transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+struct PriorityLane
+{
+    std::string name;
+    std::vector<std::string> filters;
+    int weight = 1;
+    bool own_connection = false;
+};
+
+struct PriorityLaneOptions
+{
+    /* In priority order. Topics matching no lane's filters go to the last one. */
+    std::vector<PriorityLane> lanes;
+    /* The budget and overflow policies of each lane's queue, and the messages outstanding per connection */
+    OutgoingQueueOptions queue;
+
+    /* Parses "<name>:<filter>[,<filter>...][:<weight>][:own];..." where `own` gives the lane a connection of its own,
+     * e.g. "control:commands/#,alarms/#:8:own;telemetry:#:1". Returns std::nullopt when malformed. */
+    static std::optional<PriorityLaneOptions> parse(std::string_view spec);
+
+    /* Index of the lane `topic` belongs to */
+    size_t laneFor(std::string_view topic) const;
+};
+
+class PriorityTransport : public Transport
+{
+public:
+    static constexpr int QUEUE_ERR_FULL = PublishQueue::QUEUE_ERR_FULL;
+    static constexpr int QUEUE_ERR_CLOSED = PublishQueue::QUEUE_ERR_CLOSED;
+
+    /* Takes over the callbacks of `shared`, which carries the lanes without a connection of their own */
+    PriorityTransport(std::unique_ptr<Transport> shared, PriorityLaneOptions options);
+    ~PriorityTransport() override;
+    PriorityTransport(const PriorityTransport &) = delete;
+    PriorityTransport & operator=(const PriorityTransport &) = delete;
+
+    const PriorityLaneOptions & options() const
+    {
+        return options_;
+    }
+    /* Takes over the callbacks of `transport`. Set the connection of every `own_connection` lane before connecting,
+     * lanes left without one use the shared connection. */
+    void setLaneConnection(size_t lane, std::unique_ptr<Transport> transport);
+
+    const char * name() const override
+    {
+        return connections_.front()->transport->name();
+    }
+    const std::string & clientId() const override
+    {
+        return connections_.front()->transport->clientId();
+    }
+
+    int connect() override;
+    int disconnect() override;
+    int start() override;
+    /* Also wakes publishers blocked on a full queue, which then fail with QUEUE_ERR_CLOSED */
+    void stop() override;
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+    /* Prints sent and dropped counts and how long messages waited in each lane */
+    void printStats(std::ostream & os) const;
+
+protected:
+    struct LaneStats
+    {
+        uint64_t sent = 0;
+        uint64_t failed = 0;
+        PublishQueue::Stats queue;
+    };
+
+    const Transport & sharedConnection() const
+    {
+        return *connections_.front()->transport;
+    }
+    LaneStats laneStats(size_t lane) const;
+
+private:
+    struct Connection;
+    struct Lane;
+
+    /* A message handed to a connection */
+    struct InFlight
+    {
+        int mid = 0;
+        int qos = 0;
+        Lane * lane = nullptr;
+    };
+
+    struct Lane
+    {
+        Lane(PriorityLane config, const OutgoingQueueOptions & queue_options)
+        : config(std::move(config))
+        , queue(queue_options)
+        {
+        }
+
+        PriorityLane config;
+        Connection * connection = nullptr;
+        PublishQueue queue;
+        /* Smooth weighted round robin credit */
+        int64_t credit = 0;
+        uint64_t sent = 0;
+        uint64_t failed = 0;
+        /* Microseconds from publish() to the connection, 0 for messages sent straight through */
+        DDSketch wait_us;
+    };
+
+    struct Connection
+    {
+        std::unique_ptr<Transport> transport;
+        std::vector<Lane *> lanes;
+        int in_flight_count = 0;
+        /* By the connection's mid */
+        std::unordered_map<int, InFlight> in_flight;
+        /* Completions that arrived before publish() returned their mid */
+        std::unordered_set<int> early;
+        bool connected = false;
+        bool connected_once = false;
+        bool draining = false;
+    };
+
+    /* 1 to INT_MAX, wrapping around */
+    int nextMid();
+    void attach(Connection & connection);
+    /* Next lane of `connection` to send from, nullptr when all are empty. Called with mutex_ held. */
+    Lane * pickLane(Connection & connection);
+    /* Hands a message to its connection, one in-flight slot must have been taken for it, and sets `rc` to what the
+     * connection's publish() returned. Returns false when it should be retried once reconnected. */
+    bool send(Lane & lane,
+              const char * topic,
+              const void * payload,
+              size_t payload_len,
+              int qos,
+              bool retain,
+              int mid,
+              int & rc);
+    /* Sends queued messages while fewer than max_in_flight are outstanding on `connection` */
+    void drain(Connection & connection);
+    void onConnectionPublish(Connection & connection, int mid);
+    void onConnectionConnect(Connection & connection, int reason_code);
+    void onConnectionDisconnect(Connection & connection, int reason_code);
+
+    PriorityLaneOptions options_;
+    /* The shared connection first */
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    std::atomic<uint32_t> next_mid_ = 0;
+
+    mutable std::mutex mutex_;
+    size_t num_connected_ = 0;
+    bool closed_ = false;
+};
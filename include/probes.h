@@ -0,0 +1,39 @@
+/*
+ USDT (user-level statically defined tracing) probes of the `mqtt_client` provider.
+
+ With sys/sdt.h available each probe compiles to a single nop plus a note in the ELF file, which perf, bpftrace and
+ SystemTap turn into a breakpoint only while someone is attached. Arguments are evaluated into registers at the probe
+ site, so keep them to values that are already at hand. Without sys/sdt.h the probes compile to nothing.
+
+ Topics are passed as pointer and length since they are not always NUL-terminated, use `str(arg0, arg1)` in bpftrace.
+
+   publish_begin()                                                about to hand a message to the transport
+   publish(topic, topic_len, payload_len, qos, mid, connection)   message handed to the transport, publish() returned
+   publish_done(mid, connection)                                  QoS 0 written or QoS 1/2 acknowledged
+   message(topic, topic_len, payload_len, qos, mid)               message received, before it is queued for handling
+   connect(reason_code)                                           CONNACK received
+   disconnect(reason_code)                                        connection lost or closed
+
+ Mids are only unique per connection and the app has several (lanes, async flows, file transfers, shards), so the
+ publish probes also carry the transport's id(): pair them up on (connection, mid).
+
+ List them with `bpftrace -l 'usdt:./mqtt-client-app:*'`, sample scripts are in bpftrace/.
+ */
+
+#pragma once
+
+#if defined(MQTT_HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+
+#define MQTT_PROBE0(name) DTRACE_PROBE(mqtt_client, name)
+#define MQTT_PROBE1(name, a1) DTRACE_PROBE1(mqtt_client, name, a1)
+#define MQTT_PROBE2(name, a1, a2) DTRACE_PROBE2(mqtt_client, name, a1, a2)
+#define MQTT_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(mqtt_client, name, a1, a2, a3, a4, a5)
+#define MQTT_PROBE6(name, a1, a2, a3, a4, a5, a6) DTRACE_PROBE6(mqtt_client, name, a1, a2, a3, a4, a5, a6)
+#else
+#define MQTT_PROBE0(name) static_cast<void>(0)
+#define MQTT_PROBE1(name, a1) static_cast<void>(0)
+#define MQTT_PROBE2(name, a1, a2) static_cast<void>(0)
+#define MQTT_PROBE5(name, a1, a2, a3, a4, a5) static_cast<void>(0)
+#define MQTT_PROBE6(name, a1, a2, a3, a4, a5, a6) static_cast<void>(0)
+#endif
@@ -0,0 +1,80 @@
+/*
+ Collects outbound messages and publishes them in batches from its own thread.
+
+ Producers copy topic and payload into a shared arena under a short lock. The flush thread swaps the arena for an empty
+ one once `batch_size` messages are waiting or the oldest has waited `linger`, then calls the publisher for each
+ message of the batch back to back. Producers only pay for the copy while the publishes, still one transport call per
+ message, all happen on the flush thread. Both arenas keep their capacity, so there are no allocations once traffic has
+ warmed them up. At most `max_pending` messages wait, more are dropped and counted rather than growing the arena
+ without bound when the transport falls behind.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class PublishBatcher
+{
+public:
+    /* Publishes one message, `topic` is NUL-terminated. Returns 0 on success. */
+    using Publisher = std::function<int(const char * topic, const void * payload, size_t payload_len)>;
+
+    PublishBatcher(size_t batch_size, std::chrono::microseconds linger, size_t max_pending, Publisher publisher);
+    ~PublishBatcher();
+    PublishBatcher(const PublishBatcher &) = delete;
+    PublishBatcher & operator=(const PublishBatcher &) = delete;
+
+    /* Queues a copy of the message. Thread-safe, may be called before start(). Drops the message when `max_pending`
+     * are waiting or once stopped. */
+    void add(std::string_view topic, std::string_view payload);
+
+    void start();
+    /* Publishes whatever is still queued, on the caller if the flush thread never started, and stops the thread */
+    void stop();
+
+    void printStats(std::ostream & os) const;
+
+private:
+    struct Entry
+    {
+        size_t topic_offset;
+        size_t payload_offset;
+        size_t payload_len;
+    };
+
+    struct Batch
+    {
+        std::vector<char> arena;
+        std::vector<Entry> entries;
+    };
+
+    void run();
+    void flush(Batch & batch);
+
+    size_t batch_size_;
+    std::chrono::microseconds linger_;
+    size_t max_pending_;
+    Publisher publisher_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_var_;
+    Batch pending_;
+    std::chrono::steady_clock::time_point oldest_tp_;
+    bool stopping_ = false;
+    std::thread thread_;
+
+    std::atomic<uint64_t> num_batches_ = 0;
+    std::atomic<uint64_t> num_published_ = 0;
+    std::atomic<uint64_t> num_failed_ = 0;
+    std::atomic<uint64_t> num_dropped_ = 0;
+};
@@ -0,0 +1,142 @@
+/*
+ Bounded queue of messages waiting for a connection, shared by the transports that hold back publishes
+ (queued_transport.h, priority_transport.h).
+
+ The queue holds at most `memory_budget` bytes of topic and payload. What happens when a message doesn't fit is chosen
+ per topic filter:
+
+ - DROP_OLDEST evicts the oldest queued messages, except those of BLOCK topics, to make room.
+ - DROP_NEWEST rejects the new message with QUEUE_ERR_FULL.
+ - BLOCK waits for room. Don't publish to BLOCK topics from a transport callback, which would wait for the very
+   callbacks that make room.
+ - CONFLATE keeps only the latest value per topic: a message replaces the queued one of its topic in place, keeping
+   its position, and otherwise evicts like DROP_OLDEST. Under overload readings stay fresh and the queue holds at most
+   one message per topic.
+
+ The queue has no lock of its own, its owner's mutex guards it and is the one BLOCK publishers wait on.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class OverflowPolicy
+{
+    DROP_OLDEST,
+    DROP_NEWEST,
+    BLOCK,
+    CONFLATE,
+};
+
+struct OutgoingQueueOptions
+{
+    size_t memory_budget = 1 << 20;
+    /* Per connection */
+    int max_in_flight = 64;
+    OverflowPolicy default_policy = OverflowPolicy::DROP_OLDEST;
+    /* First matching filter wins, topics matching none get `default_policy` */
+    std::vector<std::pair<std::string, OverflowPolicy>> topic_policies;
+
+    /* Parses "[<filter>=]<policy>,..." with policies drop-oldest, drop-newest, block or conflate; an entry without a
+     * filter sets the default. Returns std::nullopt when malformed. */
+    static std::optional<OutgoingQueueOptions> parsePolicies(std::string_view spec);
+};
+
+class PublishQueue
+{
+public:
+    /* Returned by push() when a message doesn't fit, or a BLOCK one once closed */
+    static constexpr int QUEUE_ERR_FULL = 1000;
+    static constexpr int QUEUE_ERR_CLOSED = 1001;
+
+    struct Entry
+    {
+        std::string topic;
+        std::string payload;
+        int qos = 0;
+        bool retain = false;
+        int mid = 0;
+        OverflowPolicy policy = OverflowPolicy::DROP_OLDEST;
+        std::chrono::steady_clock::time_point enqueue_tp;
+
+        size_t bytes() const
+        {
+            return topic.size() + payload.size();
+        }
+    };
+
+    struct Stats
+    {
+        uint64_t dropped_oldest = 0;
+        uint64_t dropped_newest = 0;
+        uint64_t conflated = 0;
+        uint64_t blocked = 0;
+        size_t queued = 0;
+        size_t max_queued = 0;
+        size_t max_queued_bytes = 0;
+        size_t budget = 0;
+    };
+
+    explicit PublishQueue(const OutgoingQueueOptions & options);
+
+    /* Queues a copy of the message, or replaces the queued value of its CONFLATE topic. Returns 0 or
+     * QUEUE_ERR_FULL, and QUEUE_ERR_CLOSED when `closed` was raised while a BLOCK message waited for room on `lk`. */
+    int push(std::unique_lock<std::mutex> & lk,
+             const bool & closed,
+             std::string_view topic,
+             const void * payload,
+             size_t payload_len,
+             int qos,
+             bool retain,
+             int mid);
+
+    bool empty() const
+    {
+        return queue_.empty();
+    }
+    /* Takes out the oldest message and wakes the publishers waiting for room */
+    Entry pop();
+    /* Puts back a message pop() returned that couldn't be sent yet, unless a newer value of its CONFLATE topic was
+     * queued meanwhile */
+    void pushFront(Entry entry);
+    /* Wakes the publishers waiting for room, to notice they were closed */
+    void wakeAll()
+    {
+        room_cond_var_.notify_all();
+    }
+
+    Stats stats() const;
+
+private:
+    OverflowPolicy policyFor(std::string_view topic) const;
+    /* Evicts the oldest droppable entries until `bytes` more fit, returns whether they do */
+    bool makeRoom(size_t bytes);
+    void erase(std::list<Entry>::iterator it);
+
+    size_t memory_budget_;
+    OverflowPolicy default_policy_;
+    std::vector<std::pair<std::string, OverflowPolicy>> topic_policies_;
+
+    std::condition_variable room_cond_var_;
+    std::list<Entry> queue_;
+    /* Queued CONFLATE entries by topic */
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> latest_;
+    size_t queued_bytes_ = 0;
+
+    uint64_t dropped_oldest_ = 0;
+    uint64_t dropped_newest_ = 0;
+    uint64_t conflated_ = 0;
+    uint64_t blocked_ = 0;
+    size_t max_queued_bytes_ = 0;
+    size_t max_queued_ = 0;
+};
@@ -20,6 +20,7 @@
 
 #include "MQTTAsync.h"
 #include "MQTTClientPersistence.h"
+#include "periodic_scheduler.h"
 
 struct PubSubOpts
 {
@@ -76,6 +77,10 @@ struct PubSubOpts
 
     float message_interval_sec;
     int message_count;
+    enum PeriodicOverrunPolicy overrun_policy;
+    /* Chunked file transfer, off when chunk_size is 0 */
+    int chunk_size;
+    int max_in_flight;
 };
 
 typedef struct
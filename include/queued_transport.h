@@ -0,0 +1,37 @@
+/*
+ Transport wrapper bounding what is waiting to be published.
+
+ libmosquitto accepts every publish into an internal queue of unlimited size, so a publisher faster than the link
+ grows memory without bound. QueuedTransport hands at most `max_in_flight` messages to the wrapped transport at a
+ time and keeps the rest in a queue of its own, limited to `memory_budget` bytes of topic and payload, with the
+ per-topic overflow policies of publish_queue.h (drop-oldest, drop-newest, block or conflate).
+
+ It is a PriorityTransport with a single lane taking every topic, so messages go straight through while nothing is
+ queued and fewer than `max_in_flight` are outstanding, and publish() then returns whatever the wrapped transport's
+ did. Messages dropped after publish() accepted them are counted but never reported through the publish callback.
+ Queued messages wait out disconnections and are sent once the connection is back.
+ */
+
+#pragma once
+
+#include "priority_transport.h"
+#include "publish_queue.h"
+#include "transport.h"
+
+#include <memory>
+#include <ostream>
+
+class QueuedTransport : public PriorityTransport
+{
+public:
+    /* Takes over the callbacks of `inner` */
+    QueuedTransport(std::unique_ptr<Transport> inner, OutgoingQueueOptions options);
+
+    const Transport & inner() const
+    {
+        return sharedConnection();
+    }
+
+    /* Prints sent, dropped and conflated counts and the queue's high-water mark */
+    void printStats(std::ostream & os) const;
+};
@@ -0,0 +1,175 @@
+/*
+ Connection recovery with exponential backoff and jitter.
+
+ libmosquitto retries a lost connection after a fixed delay and Paho after a backoff without jitter, so after a broker
+ failover every client of a fleet comes back at the same instants and the new broker takes the whole fleet's
+ handshakes at once. ReconnectManager wraps each broker connection in a ReconnectingTransport that takes recovery over
+ from the library: manage() turns the library's own reconnects off (Transport::setAutoReconnect) and once the
+ connection drops the wrapper reconnects itself, waiting
+
+   min(max_delay, initial_delay * multiplier^attempt) * (1 - jitter * random)
+
+ before each attempt, starting at attempt 0 right after the drop. The first connection is made the same way, so a
+ broker that is down at startup is retried rather than fatal.
+
+ connect() only schedules an attempt: name resolution and the TCP and TLS handshakes run on the connection's own
+ connector thread, so neither the caller nor the network thread wait on them and connections resolve in parallel. A
+ CONNACK that doesn't arrive within `connect_timeout` fails the attempt. The connect callback fires once the broker
+ accepted the connection, where the app subscribes again and the outgoing queues above drain, and refused CONNACKs are
+ passed on for logging while the next attempt is scheduled.
+
+ The manager records, for the first connection and for every recovery, the time until the broker accepted the
+ connection and until every SUBSCRIBE sent since was acknowledged.
+ */
+
+#pragma once
+
+#include "ddsketch.h"
+#include "transport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+
+struct ReconnectPolicy
+{
+    std::chrono::milliseconds initial_delay{ 200 };
+    std::chrono::milliseconds max_delay{ 30000 };
+    double multiplier = 2;
+    /* Random fraction of each delay taken off: 0 waits the full backoff, 1 anywhere up to it */
+    double jitter = 0.5;
+    std::chrono::milliseconds connect_timeout{ 10000 };
+
+    /* Delay before attempt `attempt`, counting from 0, for `random` in [0, 1) */
+    std::chrono::milliseconds delay(int attempt, double random) const;
+};
+
+class ReconnectingTransport;
+
+class ReconnectManager
+{
+public:
+    explicit ReconnectManager(ReconnectPolicy policy);
+
+    /* Wraps `inner`, taking over its callbacks and turning its auto-reconnect off. The manager must outlive the
+     * returned transport. */
+    std::unique_ptr<Transport> manage(std::unique_ptr<Transport> inner);
+
+    /* Whether the broker accepted any of the managed connections yet */
+    bool anyConnected() const;
+
+    /* Prints drops, failed attempts and time to connected and subscribed for startup and recoveries */
+    void printStats(std::ostream & os) const;
+
+private:
+    friend class ReconnectingTransport;
+
+    /* Time to connected and to subscribed of either the first connections or recoveries */
+    struct Readiness
+    {
+        DDSketch connected_ms;
+        DDSketch subscribed_ms;
+    };
+
+    std::chrono::milliseconds nextDelay(int attempt);
+    void recordConnected(bool recovery, std::chrono::steady_clock::duration elapsed);
+    void recordSubscribed(bool recovery, std::chrono::steady_clock::duration elapsed);
+    void recordDrop();
+    void recordFailedAttempt();
+
+    const ReconnectPolicy policy_;
+
+    mutable std::mutex mutex_;
+    std::mt19937_64 random_;
+    uint64_t connections_ = 0;
+    uint64_t drops_ = 0;
+    uint64_t failed_attempts_ = 0;
+    Readiness startup_;
+    Readiness recovery_;
+};
+
+class ReconnectingTransport : public Transport
+{
+public:
+    /* Takes over the callbacks of `inner` */
+    ReconnectingTransport(std::unique_ptr<Transport> inner, ReconnectManager & manager);
+    ~ReconnectingTransport() override;
+    ReconnectingTransport(const ReconnectingTransport &) = delete;
+    ReconnectingTransport & operator=(const ReconnectingTransport &) = delete;
+
+    const Transport & inner() const
+    {
+        return *inner_;
+    }
+
+    const char * name() const override
+    {
+        return inner_->name();
+    }
+    const std::string & clientId() const override
+    {
+        return inner_->clientId();
+    }
+
+    /* Schedules the first attempt, made once started. Always succeeds, failures are retried. */
+    int connect() override;
+    /* Stops recovering until connect() is called again */
+    int disconnect() override;
+    int start() override;
+    void stop() override;
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void runConnector();
+    /* Tears the previous connection down if needed and connects, on the connector thread with mutex_ unlocked */
+    void attempt(std::unique_lock<std::mutex> & lk);
+    /* Schedules the next attempt after a backoff. Called with mutex_ held. */
+    void retry();
+    void onInnerConnect(int reason_code);
+    void onInnerDisconnect(int reason_code);
+    void onInnerSubscribe(int mid, int qos_count, const int * granted_qos);
+
+    std::unique_ptr<Transport> inner_;
+    ReconnectManager & manager_;
+    std::thread connector_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    /* Between connect() and disconnect() */
+    bool wanted_ = false;
+    bool started_ = false;
+    bool stopping_ = false;
+    bool connected_ = false;
+    /* The inner connection must be disconnected and stopped before the next attempt */
+    bool needs_teardown_ = false;
+    /* Disconnects reported meanwhile are our own */
+    bool tearing_down_ = false;
+    std::optional<Clock::time_point> next_attempt_tp_;
+    std::optional<Clock::time_point> connack_deadline_;
+    /* Failed attempts since the connection was last up */
+    int attempt_ = 0;
+
+    /* Whether the connection is being recovered rather than made for the first time */
+    bool recovery_ = false;
+    /* When the first connection was asked for or the last one dropped */
+    Clock::time_point down_tp_;
+    /* SUBSCRIBEs sent since the CONNACK and not acknowledged yet */
+    int pending_subscribes_ = 0;
+    bool subscribed_ = false;
+};
@@ -0,0 +1,175 @@
+/*
+ Transport spread over several brokers, each reached through a connection of its own.
+
+ In SHARD mode every topic belongs to one broker, picked by rendezvous hashing of the topic against each broker's
+ address: the mapping doesn't depend on the order of the broker list, and adding or removing a broker only moves the
+ topics that hash to it. In FAN_OUT mode every message is published to all brokers, each connection sending its copy
+ on its own network thread, and the publish completes once every accepted copy has.
+
+ Subscriptions go to all brokers, since a filter may match topics on any of them. Subscribing completes once every
+ broker acknowledged, reporting for each filter the lowest QoS the brokers granted it, or a refusal when any broker
+ refused it. The subscriptions are renewed on a broker that reconnects, packed into as few SUBSCRIBE packets as the
+ batch limits allow.
+ The connect callback runs once all brokers are connected, or with the first failure.
+ */
+
+#pragma once
+
+#include "bulk_subscription.h"
+#include "transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct BrokerAddress
+{
+    std::string host;
+    int port = 0;
+
+    std::string label() const
+    {
+        return host + ":" + std::to_string(port);
+    }
+};
+
+/* Parses "host[:port],host[:port],...", returns std::nullopt when malformed */
+std::optional<std::vector<BrokerAddress>> parseBrokerList(std::string_view spec, int default_port);
+
+class ShardedTransport : public Transport
+{
+public:
+    enum class Mode
+    {
+        SHARD,
+        FAN_OUT,
+    };
+
+    ShardedTransport(std::string client_id, Mode mode);
+    ~ShardedTransport() override;
+    ShardedTransport(const ShardedTransport &) = delete;
+    ShardedTransport & operator=(const ShardedTransport &) = delete;
+
+    /* Takes over the callbacks of `transport`. Add all shards before connecting. */
+    void addShard(const BrokerAddress & broker, std::unique_ptr<Transport> transport);
+    size_t shardCount() const
+    {
+        return shards_.size();
+    }
+    /* Index of the shard owning `topic` */
+    size_t shardFor(std::string_view topic) const;
+    /* Limits of the SUBSCRIBE packets renewing the subscriptions on a reconnected broker */
+    void setSubscribeBatchLimits(SubscribeBatchLimits limits)
+    {
+        subscribe_limits_ = limits;
+    }
+
+    const char * name() const override
+    {
+        return mode_ == Mode::SHARD ? "sharded" : "fan-out";
+    }
+    const std::string & clientId() const override
+    {
+        return client_id_;
+    }
+
+    int connect() override;
+    int disconnect() override;
+    int start() override;
+    void stop() override;
+
+    int subscribe(const char * topic_filter, int qos, int * mid) override;
+    int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) override;
+    int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        override;
+
+    const char * errorString(int rc) const override;
+    const char * connackString(int reason_code) const override;
+
+    /* Prints published, acknowledged and in-flight counts per broker */
+    void printStats(std::ostream & os) const;
+
+private:
+    /* Matches a shard's completions to our ids, whichever of publish() returning and the callback comes first */
+    class MidMap
+    {
+    public:
+        /* Returns the granted QoS the completion of `inner_mid` carried when it already arrived */
+        std::optional<std::vector<int>> add(int inner_mid, int outer_mid);
+        /* Returns our id for `inner_mid`, or std::nullopt when add() hasn't been called for it yet, in which case
+         * `granted_qos` is kept for it. Publishes complete without any. */
+        std::optional<int> complete(int inner_mid, const std::vector<int> & granted_qos);
+
+    private:
+        std::mutex mutex_;
+        std::unordered_map<int, int> pending_;
+        std::unordered_map<int, std::vector<int>> early_;
+    };
+
+    struct Shard
+    {
+        std::string label;
+        std::unique_ptr<Transport> transport;
+        uint64_t seed = 0;
+        bool connected_once = false;
+        MidMap publishes;
+        MidMap subscribes;
+        std::atomic<uint64_t> published = 0;
+        std::atomic<uint64_t> acked = 0;
+        std::atomic<int64_t> in_flight = 0;
+        std::atomic<int64_t> max_in_flight = 0;
+    };
+
+    /* A fan-out publish or a subscribe waiting for the remaining shards */
+    struct Pending
+    {
+        size_t remaining = 0;
+        /* Per filter of a subscribe, merged over the shards that acknowledged so far */
+        std::vector<int> granted_qos;
+    };
+
+    /* Ids of subscribes and publishes made on our own, whose completion isn't reported */
+    static constexpr int INTERNAL_MID = -1;
+
+    /* 1 to INT_MAX, wrapping around */
+    int nextMid();
+    void onShardConnect(Shard & shard, int reason_code);
+    void onShardSubscribe(Shard & shard, int mid, int qos_count, const int * granted_qos);
+    void onShardPublish(Shard & shard, int mid);
+    int publishOn(Shard & shard,
+                  const char * topic,
+                  const void * payload,
+                  size_t payload_len,
+                  int qos,
+                  bool retain,
+                  int outer_mid);
+    /* Counts `copies` of a publish as done, reporting it once none are left */
+    void completePublish(int outer_mid, size_t copies);
+    /* Merges a shard's granted QoS into the subscribe, filter by filter; an empty `granted_qos` refuses them all */
+    void completeSubscribe(int outer_mid, const std::vector<int> & granted_qos);
+    int subscribeOn(Shard & shard, const char * const * topic_filters, int count, int qos, int outer_mid);
+    /* Subscribes a reconnected shard to `subscriptions` again, in batches of one QoS each */
+    void resubscribe(Shard & shard, const std::vector<std::pair<std::string, int>> & subscriptions);
+
+    std::string client_id_;
+    Mode mode_;
+    SubscribeBatchLimits subscribe_limits_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint32_t> next_mid_ = 0;
+
+    std::mutex mutex_;
+    size_t num_connected_ = 0;
+    /* Renewed on shards that reconnect */
+    std::vector<std::pair<std::string, int>> subscriptions_;
+    /* Position of each filter in subscriptions_, bulk subscriptions renew thousands */
+    std::unordered_map<std::string, size_t> subscription_index_;
+    std::unordered_map<int, Pending> pending_publishes_;
+    std::unordered_map<int, Pending> pending_subscribes_;
+};
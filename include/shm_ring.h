@@ -0,0 +1,77 @@
+/*
+ Shared-memory ring fanning received messages out to other processes on the same host, written by main.cpp and read
+ by any local consumer (see shm_ring_reader.c for one), hence the C API.
+
+ The ring lives in a POSIX shared memory object (/dev/shm/<name>) that readers find by name. Messages are stored
+ contiguously, topic and payload after a small record header, and readers get pointers straight into the mapping, so
+ however many readers there are, a message is copied once, by the writer. Each reader claims a slot in the ring's
+ header holding its cursor. The writer never overwrites a record a registered reader hasn't moved past: when the
+ slowest reader is a full ring behind, new messages are dropped and counted instead, so the MQTT network thread never
+ waits on a consumer. Slots of readers that died are reclaimed once the ring fills up.
+
+ Readers wait for new messages on a futex in the shared header, woken by the writer only while someone waits.
+ Writing is thread-safe within the writer process; a reader handle belongs to one thread.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum
+{
+    SHM_RING_VERSION = 1,
+    SHM_RING_MAX_READERS = 32,
+};
+
+struct ShmRingWriter;
+struct ShmRingReader;
+
+/* A message as stored in the ring. Valid until the next shmRingReaderNext() call on the same reader. */
+struct ShmRingMessage
+{
+    const char * topic;
+    size_t topic_len;
+    const void * payload;
+    size_t payload_len;
+    int qos;
+    int retain;
+};
+
+/* Creates /dev/shm/<name> holding a ring of `capacity` bytes, rounded up to a power of two, replacing any earlier
+ * ring of that name. `name` must not contain slashes. Returns NULL with errno set on failure. */
+struct ShmRingWriter * shmRingWriterCreate(const char * name, size_t capacity);
+/* Marks the ring closed, so readers stop once they drained it, and removes its name. Readers keep their mapping. */
+void shmRingWriterDestroy(struct ShmRingWriter * writer);
+/* Appends a message, returns 0, or -1 when it was dropped because a reader is a full ring behind or it is larger
+ * than a quarter of the ring. */
+int shmRingWrite(struct ShmRingWriter * writer,
+                 const char * topic,
+                 size_t topic_len,
+                 const void * payload,
+                 size_t payload_len,
+                 int qos,
+                 int retain);
+/* Prints "Shared-memory ring <name>: written= dropped= oversize= readers= capacity=" */
+void shmRingWriterPrintStats(struct ShmRingWriter * writer, FILE * out);
+
+/* Attaches to ring `name` as a new reader, starting with the next message written. Returns NULL with errno set when
+ * the ring doesn't exist (ENOENT), is of another version (EPROTO) or all reader slots are taken (EBUSY). */
+struct ShmRingReader * shmRingReaderOpen(const char * name);
+/* Gives up the reader's slot */
+void shmRingReaderClose(struct ShmRingReader * reader);
+/* Moves past the previous message and returns the next one in `message`. Returns 1 when there was one, 0 when the
+ * reader is caught up, -1 once the writer closed the ring and everything was read and -2 when the next record is
+ * malformed, which the reader can't get past. Never blocks. */
+int shmRingReaderNext(struct ShmRingReader * reader, struct ShmRingMessage * message);
+/* Like shmRingReaderNext() but waits up to `timeout_ms` for a message, forever when negative */
+int shmRingReaderWait(struct ShmRingReader * reader, struct ShmRingMessage * message, int timeout_ms);
+
+#if defined(__cplusplus)
+}
+#endif
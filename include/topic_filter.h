@@ -0,0 +1,94 @@
+/*
+ MQTT topic filter validation and matching, usable in constant expressions.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+/* A `$share/<group>/<filter>` subscription split in its parts */
+struct SharedSubscription
+{
+    std::string_view group;
+    std::string_view filter;
+};
+
+constexpr std::optional<SharedSubscription> parseSharedSubscription(std::string_view filter)
+{
+    constexpr std::string_view prefix = "$share/";
+    if (!filter.starts_with(prefix)) {
+        return std::nullopt;
+    }
+    filter.remove_prefix(prefix.size());
+    const auto slash = filter.find('/');
+    if (slash == 0 || slash == std::string_view::npos || slash + 1 == filter.size()) {
+        return std::nullopt;
+    }
+    return SharedSubscription{ filter.substr(0, slash), filter.substr(slash + 1) };
+}
+
+/* Wildcards must take a whole level and '#' must be last */
+constexpr bool isValidTopicFilter(std::string_view filter)
+{
+    if (filter.empty()) {
+        return false;
+    }
+    for (size_t i = 0; i < filter.size(); ++i) {
+        const char c = filter[i];
+        if (c != '+' && c != '#') {
+            continue;
+        }
+        const bool starts_level = i == 0 || filter[i - 1] == '/';
+        const bool ends_level = i + 1 == filter.size() || filter[i + 1] == '/';
+        if (!starts_level || !ends_level || (c == '#' && i + 1 != filter.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Topic names used for publishing cannot contain wildcards */
+constexpr bool isValidTopicName(std::string_view topic)
+{
+    return !topic.empty() && topic.find_first_of("+#") == std::string_view::npos;
+}
+
+constexpr bool topicMatchesFilter(std::string_view filter, std::string_view topic)
+{
+    /* Topics starting with '$' are not matched by filters starting with a wildcard */
+    if (!topic.empty() && topic.front() == '$' && !filter.empty() && (filter.front() == '+' || filter.front() == '#')) {
+        return false;
+    }
+    size_t f = 0;
+    size_t t = 0;
+    while (f < filter.size()) {
+        if (filter[f] == '#') {
+            return true;
+        }
+        if (filter[f] == '+') {
+            while (t < topic.size() && topic[t] != '/') {
+                ++t;
+            }
+            ++f;
+        } else {
+            if (t >= topic.size() || filter[f] != topic[t]) {
+                /* "a/#" also matches its parent "a" */
+                return t == topic.size() && filter.substr(f) == "/#";
+            }
+            ++f;
+            ++t;
+            continue;
+        }
+        /* Just consumed a '+' level, both sides must be at a separator or at the end */
+        if (f == filter.size() || t == topic.size()) {
+            break;
+        }
+        if (filter[f] != '/' || topic[t] != '/') {
+            return false;
+        }
+        ++f;
+        ++t;
+    }
+    return t == topic.size() && (f == filter.size() || filter.substr(f) == "/#");
+}
@@ -0,0 +1,149 @@
+/*
+ Client-side MQTT transport used by the application logic.
+
+ The interface mirrors the libmosquitto client API: calls return 0 on success or an implementation specific error
+ code that errorString() describes, and events are delivered through callbacks that may run on the transport's
+ network thread.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/* Broker address, credentials and TLS files shared by all connections of the app */
+struct ConnectionSettings
+{
+    const char * host = nullptr;
+    int port = 0;
+    const char * username = nullptr;
+    const char * password = nullptr;
+    const char * ca_file = nullptr;
+    const char * ca_path = nullptr;
+    const char * cert_file = nullptr;
+    const char * key_file = nullptr;
+    const char * pass_phrase = nullptr;
+    int keepalive_sec = 60;
+};
+
+/* A received message. Only valid for the duration of the message callback. */
+struct TransportMessage
+{
+    std::string_view topic;
+    const void * payload = nullptr;
+    size_t payload_len = 0;
+    int qos = 0;
+    bool retain = false;
+    int mid = 0;
+};
+
+class Transport
+{
+public:
+    using ConnectCallback = std::function<void(Transport &, int reason_code)>;
+    using DisconnectCallback = std::function<void(Transport &, int reason_code)>;
+    using SubscribeCallback = std::function<void(Transport &, int mid, int qos_count, const int * granted_qos)>;
+    using MessageCallback = std::function<void(Transport &, const TransportMessage &)>;
+    /* Called once a QoS 0 message has been sent, or once a QoS 1/2 message has been acknowledged */
+    using PublishCallback = std::function<void(Transport &, int mid)>;
+
+    virtual ~Transport() = default;
+
+    virtual const char * name() const = 0;
+    virtual const std::string & clientId() const = 0;
+    /* Unique per transport object in this process, mids are only unique within one */
+    uint32_t id() const
+    {
+        return id_;
+    }
+
+    /* Connects to the broker, blocking until the connection is established at the network level */
+    virtual int connect() = 0;
+    virtual int disconnect() = 0;
+    /* Starts and stops the thread that runs the network loop and invokes the callbacks */
+    virtual int start() = 0;
+    virtual void stop() = 0;
+    /* Whether the client library reconnects by itself once the connection drops, on by default. Set before connect();
+     * transports without retries of their own ignore it. */
+    virtual void setAutoReconnect(bool /*enabled*/)
+    {
+    }
+
+    virtual int subscribe(const char * topic_filter, int qos, int * mid) = 0;
+    /* Subscribes to `count` filters with a single SUBSCRIBE, whose callback reports a granted QoS per filter */
+    virtual int subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid) = 0;
+    virtual int publish(const char * topic, const void * payload, size_t payload_len, int qos, bool retain, int * mid)
+        = 0;
+
+    virtual const char * errorString(int rc) const = 0;
+    virtual const char * connackString(int reason_code) const = 0;
+
+    /* Callbacks should be set before connecting */
+    void setConnectCallback(ConnectCallback cb)
+    {
+        on_connect_ = std::move(cb);
+    }
+    void setDisconnectCallback(DisconnectCallback cb)
+    {
+        on_disconnect_ = std::move(cb);
+    }
+    void setSubscribeCallback(SubscribeCallback cb)
+    {
+        on_subscribe_ = std::move(cb);
+    }
+    void setMessageCallback(MessageCallback cb)
+    {
+        on_message_ = std::move(cb);
+    }
+    void setPublishCallback(PublishCallback cb)
+    {
+        on_publish_ = std::move(cb);
+    }
+
+protected:
+    void notifyConnect(int reason_code)
+    {
+        if (on_connect_) {
+            on_connect_(*this, reason_code);
+        }
+    }
+    void notifyDisconnect(int reason_code)
+    {
+        if (on_disconnect_) {
+            on_disconnect_(*this, reason_code);
+        }
+    }
+    void notifySubscribe(int mid, int qos_count, const int * granted_qos)
+    {
+        if (on_subscribe_) {
+            on_subscribe_(*this, mid, qos_count, granted_qos);
+        }
+    }
+    void notifyMessage(const TransportMessage & msg)
+    {
+        if (on_message_) {
+            on_message_(*this, msg);
+        }
+    }
+    void notifyPublish(int mid)
+    {
+        if (on_publish_) {
+            on_publish_(*this, mid);
+        }
+    }
+
+private:
+    inline static std::atomic<uint32_t> s_next_id = 0;
+
+    const uint32_t id_ = s_next_id.fetch_add(1, std::memory_order_relaxed);
+    ConnectCallback on_connect_;
+    DisconnectCallback on_disconnect_;
+    SubscribeCallback on_subscribe_;
+    MessageCallback on_message_;
+    PublishCallback on_publish_;
+};
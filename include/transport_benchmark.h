@@ -0,0 +1,53 @@
+/*
+ Runs the same publish/subscribe workload through a transport and measures it, so client libraries can be compared
+ side by side on identical rate, payload size, QoS and TLS settings.
+
+ The transport subscribes to the benchmark topic and publishes to it, every payload starting with its send time, so
+ the end-to-end latency of each message is measured by the same process that sent it. CPU time is the process' user
+ and system time over the run, which covers the client library's own threads.
+ */
+
+#pragma once
+
+#include "ddsketch.h"
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+struct TransportBenchmarkOptions
+{
+    std::string topic;
+    int num_messages = 10000;
+    /* Messages per second, 0 publishes as fast as the transport accepts them */
+    double rate = 0;
+    /* At least the 8 bytes of the send timestamp */
+    size_t payload_size = 64;
+    int qos = 0;
+};
+
+struct TransportBenchmarkReport
+{
+    std::string transport;
+    /* Why connecting or subscribing failed, nothing was measured then */
+    std::string error;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t received = 0;
+    std::chrono::duration<double> elapsed{ 0 };
+    std::chrono::duration<double> cpu_user{ 0 };
+    std::chrono::duration<double> cpu_system{ 0 };
+    /* End-to-end latency in microseconds */
+    DDSketch latency_us{ 0.01 };
+
+    void print(std::ostream & os) const;
+};
+
+/* Takes over the callbacks of `transport`, connects it, runs the workload and disconnects. Returns early when `stop`
+ * is raised. */
+TransportBenchmarkReport runTransportBenchmark(Transport & transport,
+                                               const TransportBenchmarkOptions & options,
+                                               const std::atomic_bool & stop);
@@ -0,0 +1,276 @@
+/*
+ Topics declared together with their payload type.
+
+   struct TempSample { int32_t device; double temp; };
+   template<> struct PayloadSchema<TempSample>
+   {
+       using Fields = std::tuple<Field<"device", &TempSample::device>, Field<"temp", &TempSample::temp>>;
+   };
+   using TempTopic = Topic<"sensors/+/temp", TempSample>;
+
+   TempTopic::Buffer buffer;
+   auto payload = TempTopic::encode({ 7, 21.5 }, buffer);   // {"device":7,"temp":21.5}
+   auto sample = TempTopic::decode(msg.topic(), payload);   // nullopt unless the topic matches and all fields parse
+
+ The filter is validated when the alias is declared, and a Topic without wildcards can be published to directly.
+ Encoders are generated per type from the schema with no format strings, and every payload type has a worst-case
+ encoded size known at compile time, so a stack buffer always fits and nothing touches the heap. Arithmetic types
+ encode as plain numbers, the way the sample publisher has always sent readings. Integer and bool encoding is
+ constexpr; floating point goes through std::to_chars, which isn't until C++23.
+ */
+
+#pragma once
+
+#include "payload_parser.h"
+#include "topic_filter.h"
+#include "transport.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+/* A string literal usable as a template argument */
+template<size_t N>
+struct FixedString
+{
+    /* NOLINTNEXTLINE(hicpp-avoid-c-arrays,modernize-avoid-c-arrays,cppcoreguidelines-avoid-c-arrays) */
+    char value[N]{};
+
+    /* Implicit so string literals convert in template arguments */
+    /* NOLINTNEXTLINE(*-avoid-c-arrays,google-explicit-constructor,hicpp-explicit-conversions) */
+    constexpr FixedString(const char (&str)[N])
+    {
+        std::copy_n(str, N, value);
+    }
+
+    constexpr std::string_view view() const
+    {
+        return { value, N - 1 };
+    }
+};
+
+/* One field of a payload struct, encoded as `"<Name>":<value>` */
+template<FixedString Name, auto Member>
+struct Field
+{
+    static constexpr std::string_view NAME = Name.view();
+    static constexpr auto MEMBER = Member;
+};
+
+/* Specialize with `using Fields = std::tuple<Field<...>, ...>` to send a struct as a flat JSON object */
+template<typename T>
+struct PayloadSchema;
+
+namespace detail {
+
+template<typename T>
+struct MemberPointer;
+
+template<typename C, typename M>
+struct MemberPointer<M C::*>
+{
+    using Type = M;
+};
+
+template<typename F>
+using FieldType = typename MemberPointer<std::remove_cv_t<decltype(F::MEMBER)>>::Type;
+
+template<typename T>
+constexpr size_t maxEncodedChars()
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        return 5;
+    } else if constexpr (std::is_integral_v<T>) {
+        /* digits10 undercounts by one, plus the sign */
+        return std::numeric_limits<T>::digits10 + 2;
+    } else {
+        static_assert(std::is_floating_point_v<T>, "payload fields must be arithmetic");
+        /* Shortest round-trip form: sign, max_digits10 digits, point and the longest exponent such as "e-308" */
+        return std::numeric_limits<T>::max_digits10 + 3 + 5;
+    }
+}
+
+template<typename T>
+constexpr char * encodeScalar(T value, char * out)
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        constexpr std::string_view TRUE = "true";
+        constexpr std::string_view FALSE = "false";
+        const auto text = value ? TRUE : FALSE;
+        return std::copy(text.begin(), text.end(), out);
+    } else if constexpr (std::is_integral_v<T>) {
+        using Unsigned = std::make_unsigned_t<T>;
+        auto magnitude = static_cast<Unsigned>(value);
+        if constexpr (std::is_signed_v<T>) {
+            if (value < 0) {
+                *out++ = '-';
+                magnitude = static_cast<Unsigned>(Unsigned(0) - magnitude);
+            }
+        }
+        std::array<char, maxEncodedChars<T>()> digits{};
+        size_t n = 0;
+        do {
+            digits[n++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        return std::reverse_copy(digits.begin(), digits.begin() + static_cast<ptrdiff_t>(n), out);
+    } else {
+        return std::to_chars(out, out + maxEncodedChars<T>(), value).ptr;
+    }
+}
+
+template<typename T>
+std::optional<T> decodeScalar(std::string_view text)
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        text = trimPayload(text);
+        if (text == "true" || text == "false") {
+            return text == "true";
+        }
+        return std::nullopt;
+    } else {
+        return parseNumber<T>(text);
+    }
+}
+
+template<typename T, typename = void>
+struct HasSchema : std::false_type
+{};
+
+template<typename T>
+struct HasSchema<T, std::void_t<typename PayloadSchema<T>::Fields>> : std::true_type
+{};
+
+} // namespace detail
+
+/* Encoding of one payload type, either an arithmetic value or a struct with a PayloadSchema */
+template<typename T>
+struct PayloadCodec
+{
+    static_assert(std::is_arithmetic_v<T> || detail::HasSchema<T>::value,
+                  "payload types must be arithmetic or have a PayloadSchema specialization");
+
+    static constexpr size_t maxSize()
+    {
+        if constexpr (std::is_arithmetic_v<T>) {
+            return detail::maxEncodedChars<T>();
+        } else {
+            return std::apply(
+                [](auto... fields) {
+                    /* Braces, commas, and `"name":` plus the longest value for each field */
+                    return 2 + (sizeof...(fields) - 1) +
+                           ((decltype(fields)::NAME.size() + 3 +
+                             detail::maxEncodedChars<detail::FieldType<decltype(fields)>>()) +
+                            ...);
+                },
+                typename PayloadSchema<T>::Fields{});
+        }
+    }
+
+    static constexpr size_t MAX_SIZE = maxSize();
+
+    /* Writes at most MAX_SIZE bytes to `out` and returns the number written */
+    static constexpr size_t encode(const T & value, char * out)
+    {
+        char * end = out;
+        if constexpr (std::is_arithmetic_v<T>) {
+            end = detail::encodeScalar(value, out);
+        } else {
+            *end++ = '{';
+            std::apply(
+                [&](auto... fields) {
+                    bool first = true;
+                    auto encode_field = [&](auto field) {
+                        if (!first) {
+                            *end++ = ',';
+                        }
+                        first = false;
+                        *end++ = '"';
+                        end = std::copy(field.NAME.begin(), field.NAME.end(), end);
+                        *end++ = '"';
+                        *end++ = ':';
+                        end = detail::encodeScalar(value.*(field.MEMBER), end);
+                    };
+                    (encode_field(fields), ...);
+                },
+                typename PayloadSchema<T>::Fields{});
+            *end++ = '}';
+        }
+        return static_cast<size_t>(end - out);
+    }
+
+    /* Every schema field must be present and parse, unknown fields are ignored */
+    static std::optional<T> decode(std::string_view payload)
+    {
+        if constexpr (std::is_arithmetic_v<T>) {
+            return detail::decodeScalar<T>(payload);
+        } else {
+            T value{};
+            const bool complete = std::apply(
+                [&](auto... fields) {
+                    auto decode_field = [&](auto field) {
+                        using FieldType = detail::FieldType<decltype(field)>;
+                        auto text = findJsonField(payload, field.NAME);
+                        auto decoded = text ? detail::decodeScalar<FieldType>(*text) : std::nullopt;
+                        if (decoded) {
+                            value.*(field.MEMBER) = *decoded;
+                        }
+                        return decoded.has_value();
+                    };
+                    return (decode_field(fields) && ...);
+                },
+                typename PayloadSchema<T>::Fields{});
+            return complete ? std::optional<T>(value) : std::nullopt;
+        }
+    }
+};
+
+template<FixedString Filter, typename Payload>
+struct Topic
+{
+    static_assert(isValidTopicFilter(Filter.view()), "invalid topic filter");
+
+    static constexpr std::string_view FILTER = Filter.view();
+    /* Filters without wildcards name a single topic that can be published to */
+    static constexpr bool IS_NAME = isValidTopicName(FILTER);
+
+    using PayloadType = Payload;
+    using Codec = PayloadCodec<Payload>;
+    /* Fits any encoded payload of this topic */
+    using Buffer = std::array<char, Codec::MAX_SIZE>;
+
+    static constexpr bool matches(std::string_view topic)
+    {
+        return topicMatchesFilter(FILTER, topic);
+    }
+
+    static constexpr std::string_view encode(const Payload & value, Buffer & buffer)
+    {
+        return { buffer.data(), Codec::encode(value, buffer.data()) };
+    }
+
+    static std::optional<Payload> decode(std::string_view payload)
+    {
+        return Codec::decode(payload);
+    }
+
+    /* Decodes only messages on a topic matching this one */
+    static std::optional<Payload> decode(std::string_view topic, std::string_view payload)
+    {
+        return matches(topic) ? Codec::decode(payload) : std::nullopt;
+    }
+
+    static int publish(Transport & transport, const Payload & value, int qos, bool retain = false, int * mid = nullptr)
+    {
+        static_assert(IS_NAME, "topic filters with wildcards can't be published to");
+        Buffer buffer;
+        const auto payload = encode(value, buffer);
+        return transport.publish(FILTER.data(), payload.data(), payload.size(), qos, retain, mid);
+    }
+};
@@ -0,0 +1,117 @@
+/*
+ Per-topic streaming statistics over numeric payloads.
+
+ Each topic's window is split into panes one slide long. Every slide the panes covering the last window are merged
+ into count/min/max/mean and DDSketch percentiles and published as JSON to `<prefix>/<topic>`, then the oldest pane
+ is dropped. A slide equal to the window gives tumbling windows.
+
+ Values are buffered per topic and folded into the current pane in batches, so the hot path is a short lock and a
+ push_back while min/max/sum and sketch bucket indices are computed in tight loops over the batch.
+ */
+
+#pragma once
+
+#include "ddsketch.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct WindowStats
+{
+    std::string topic;
+    std::chrono::milliseconds window{ 0 };
+    uint64_t count = 0;
+    double min = 0;
+    double max = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+
+    std::string toJson() const;
+};
+
+class WindowAggregator
+{
+public:
+    using Publisher = std::function<void(const std::string & topic, const std::string & payload)>;
+
+    WindowAggregator(std::chrono::milliseconds window,
+                     std::chrono::milliseconds slide,
+                     std::string topic_prefix,
+                     std::string value_field,
+                     Publisher publisher);
+    ~WindowAggregator();
+    WindowAggregator(const WindowAggregator &) = delete;
+    WindowAggregator & operator=(const WindowAggregator &) = delete;
+
+    /* Adds the payload's value to the topic's window, returns false when it isn't a number. The value is the whole
+     * payload, or the `value_field` of a JSON object payload when one was given. Thread-safe. */
+    bool add(std::string_view topic, std::string_view payload);
+
+    /* Starts publishing every slide */
+    void start();
+    /* Stops the timer and publishes the windows as they are */
+    void stop();
+
+    /* Closes the current pane now and returns the stats of every topic with samples in its window */
+    std::vector<WindowStats> advance();
+
+private:
+    struct Pane
+    {
+        uint64_t count = 0;
+        double min = 0;
+        double max = 0;
+        double sum = 0;
+        DDSketch sketch;
+    };
+
+    struct TopicWindow
+    {
+        std::mutex mutex;
+        std::vector<double> pending;
+        std::deque<Pane> panes;
+    };
+
+    struct TopicHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view topic) const
+        {
+            return std::hash<std::string_view>{}(topic);
+        }
+    };
+
+    std::optional<double> parseValue(std::string_view payload) const;
+    static void flushPending(TopicWindow & window);
+    void publish(const std::vector<WindowStats> & stats);
+    void run();
+
+    std::chrono::milliseconds window_;
+    std::chrono::milliseconds slide_;
+    size_t num_panes_;
+    std::string topic_prefix_;
+    std::string value_field_;
+    Publisher publisher_;
+
+    std::shared_mutex topics_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<TopicWindow>, TopicHash, std::equal_to<>> topics_;
+
+    std::mutex timer_mutex_;
+    std::condition_variable timer_cond_var_;
+    bool stopping_ = false;
+    std::thread timer_;
+};
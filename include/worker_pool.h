@@ -0,0 +1,98 @@
+/*
+ Worker pool that processes received messages off the mosquitto network thread.
+
+ Messages are routed to a worker by hashing an ordering key (by default the full topic), so messages sharing a key
+ are handled in arrival order while different keys run in parallel. Messages submitted without a key go to per-worker
+ unordered queues that idle workers steal from.
+ */
+
+#pragma once
+
+#include "message_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/* How a message is mapped to an ordering key */
+struct OrderingPolicy
+{
+    enum class Mode
+    {
+        TOPIC, /* full topic name */
+        /* first `levels` levels of the topic, e.g. "sensors/kitchen" for "sensors/kitchen/temp" with levels = 2 */
+        TOPIC_LEVELS,
+        NONE, /* no ordering, any worker may process the message */
+    };
+    Mode mode = Mode::TOPIC;
+    int levels = 0;
+
+    /* Parses "topic", "none" or "levels:<N>" */
+    static std::optional<OrderingPolicy> parse(std::string_view spec);
+
+    /* Returns the ordering key for `topic`, empty when the policy does not order messages */
+    std::optional<size_t> keyHash(std::string_view topic) const;
+};
+
+class WorkerPool
+{
+public:
+    using Handler = std::function<void(const ReceivedMessage &)>;
+
+    WorkerPool(size_t num_workers, OrderingPolicy policy, Handler handler);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool & operator=(const WorkerPool &) = delete;
+
+    /* Routes a message according to the ordering policy */
+    void submit(ReceivedMessage msg);
+    /* Messages with the same key hash are processed in submission order by the same worker */
+    void submitOrdered(ReceivedMessage msg, size_t key_hash);
+    /* Queues a message that may be processed by any worker */
+    void submitUnordered(ReceivedMessage msg);
+
+    /* Processes everything already queued, then joins the workers. Idempotent. */
+    void stop();
+
+    size_t size() const
+    {
+        return workers_.size();
+    }
+    void printStats(std::ostream & os) const;
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::condition_variable cond_var;
+        std::deque<ReceivedMessage> ordered;
+        std::deque<ReceivedMessage> unordered;
+        size_t max_depth = 0;
+        /* Set while the worker is blocked on cond_var, so producers only pay for a wake-up when needed */
+        bool idle = false;
+        std::atomic<uint64_t> processed = 0;
+        std::atomic<uint64_t> stolen = 0;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    std::optional<ReceivedMessage> steal(size_t thief);
+    void process(Worker & worker, const ReceivedMessage & msg);
+
+    OrderingPolicy policy_;
+    Handler handler_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_unordered_ = 0;
+    std::atomic<int64_t> pending_unordered_ = 0;
+    std::atomic_bool stopping_ = false;
+};
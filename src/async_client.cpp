@@ -0,0 +1,221 @@
+#include "async_client.h"
+
+#include <utility>
+
+void AsyncClient::Operation::complete(int result)
+{
+    result_ = result;
+    if (state_.exchange(COMPLETED, std::memory_order_acq_rel) == SUSPENDED) {
+        handle_.resume();
+    }
+}
+
+bool AsyncClient::Operation::suspend(std::coroutine_handle<> handle)
+{
+    handle_ = handle;
+    /* Already completed: don't suspend, the coroutine continues right away */
+    return state_.exchange(SUSPENDED, std::memory_order_acq_rel) != COMPLETED;
+}
+
+AsyncClient::AsyncClient(Transport & transport)
+: transport_(transport)
+{
+    transport_.setConnectCallback([this](Transport &, int reason_code) { onConnect(reason_code); });
+    transport_.setPublishCallback([this](Transport &, int mid) { onPublish(mid); });
+    transport_.setSubscribeCallback([this](Transport &, int mid, int qos_count, const int * granted_qos) {
+        onSubscribe(mid, qos_count, granted_qos);
+    });
+    transport_.setMessageCallback([this](Transport &, const TransportMessage & msg) { onMessage(msg); });
+}
+
+AsyncClient::~AsyncClient()
+{
+    transport_.setConnectCallback(nullptr);
+    transport_.setPublishCallback(nullptr);
+    transport_.setSubscribeCallback(nullptr);
+    transport_.setMessageCallback(nullptr);
+}
+
+bool AsyncClient::ConnectAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard lk(client_.mutex_);
+        client_.connect_op_ = &op_;
+    }
+    int rc = client_.transport_.connect();
+    if (rc == 0 && !client_.started_) {
+        rc = client_.transport_.start();
+        client_.started_ = rc == 0;
+    }
+    if (rc != 0) {
+        {
+            std::lock_guard lk(client_.mutex_);
+            client_.connect_op_ = nullptr;
+        }
+        op_.complete(rc);
+    }
+    return op_.suspend(handle);
+}
+
+bool AsyncClient::PublishAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    int mid = 0;
+    int rc = client_.transport_.publish(topic_, payload_, payload_len_, qos_, false, &mid);
+    if (rc != 0) {
+        op_.complete(rc);
+        return op_.suspend(handle);
+    }
+    {
+        std::lock_guard lk(client_.mutex_);
+        if (client_.early_publish_acks_.erase(mid) == 0) {
+            client_.pending_publishes_[mid] = &op_;
+            return op_.suspend(handle);
+        }
+    }
+    op_.complete(0);
+    return op_.suspend(handle);
+}
+
+bool AsyncClient::SubscribeAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    int mid = 0;
+    int rc = client_.transport_.subscribe(topic_filter_, qos_, &mid);
+    if (rc != 0) {
+        op_.complete(-rc);
+        return op_.suspend(handle);
+    }
+    std::optional<int> granted_qos;
+    {
+        std::lock_guard lk(client_.mutex_);
+        if (auto it = client_.early_subscribe_acks_.find(mid); it != client_.early_subscribe_acks_.end()) {
+            granted_qos = it->second;
+            client_.early_subscribe_acks_.erase(it);
+        } else {
+            client_.pending_subscribes_[mid] = &op_;
+        }
+    }
+    if (granted_qos) {
+        op_.complete(*granted_qos);
+    }
+    return op_.suspend(handle);
+}
+
+bool AsyncClient::MessageAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard lk(client_.mutex_);
+        if (client_.messages_.empty() && !client_.messages_closed_) {
+            client_.message_waiter_ = this;
+            return op_.suspend(handle);
+        }
+        if (!client_.messages_.empty()) {
+            msg_.emplace(std::move(client_.messages_.front()));
+            client_.messages_.pop_front();
+        }
+    }
+    return false;
+}
+
+void AsyncClient::closeMessages()
+{
+    MessageAwaiter * waiter = nullptr;
+    {
+        std::lock_guard lk(mutex_);
+        messages_closed_ = true;
+        waiter = std::exchange(message_waiter_, nullptr);
+    }
+    if (waiter != nullptr) {
+        waiter->op_.complete(0);
+    }
+}
+
+void AsyncClient::cancelAll()
+{
+    Operation * connect_op = nullptr;
+    std::unordered_map<int, Operation *> publishes;
+    std::unordered_map<int, Operation *> subscribes;
+    {
+        std::lock_guard lk(mutex_);
+        connect_op = std::exchange(connect_op_, nullptr);
+        publishes.swap(pending_publishes_);
+        subscribes.swap(pending_subscribes_);
+    }
+    if (connect_op != nullptr) {
+        connect_op->complete(CANCELLED);
+    }
+    for (const auto & [mid, op] : publishes) {
+        op->complete(CANCELLED);
+    }
+    for (const auto & [mid, op] : subscribes) {
+        op->complete(CANCELLED);
+    }
+    closeMessages();
+}
+
+void AsyncClient::onConnect(int reason_code)
+{
+    Operation * op = nullptr;
+    {
+        std::lock_guard lk(mutex_);
+        op = std::exchange(connect_op_, nullptr);
+    }
+    /* Automatic reconnects have no one waiting */
+    if (op != nullptr) {
+        op->complete(reason_code);
+    }
+}
+
+void AsyncClient::onPublish(int mid)
+{
+    Operation * op = nullptr;
+    {
+        std::lock_guard lk(mutex_);
+        if (auto it = pending_publishes_.find(mid); it != pending_publishes_.end()) {
+            op = it->second;
+            pending_publishes_.erase(it);
+        } else {
+            early_publish_acks_[mid] = 0;
+        }
+    }
+    if (op != nullptr) {
+        op->complete(0);
+    }
+}
+
+void AsyncClient::onSubscribe(int mid, int qos_count, const int * granted_qos)
+{
+    /* One filter per SUBSCRIBE, a rejected filter is reported as 0x80 */
+    const int granted = qos_count > 0 ? granted_qos[0] : 0x80;
+    Operation * op = nullptr;
+    {
+        std::lock_guard lk(mutex_);
+        if (auto it = pending_subscribes_.find(mid); it != pending_subscribes_.end()) {
+            op = it->second;
+            pending_subscribes_.erase(it);
+        } else {
+            early_subscribe_acks_[mid] = granted;
+        }
+    }
+    if (op != nullptr) {
+        op->complete(granted);
+    }
+}
+
+void AsyncClient::onMessage(const TransportMessage & msg)
+{
+    auto received = makeReceivedMessage(msg.topic, msg.payload, msg.payload_len, msg.qos, msg.retain, msg.mid);
+    MessageAwaiter * waiter = nullptr;
+    {
+        std::lock_guard lk(mutex_);
+        if (messages_closed_) {
+            return;
+        }
+        waiter = std::exchange(message_waiter_, nullptr);
+        if (waiter == nullptr) {
+            messages_.push_back(std::move(received));
+            return;
+        }
+    }
+    waiter->msg_.emplace(std::move(received));
+    waiter->op_.complete(0);
+}
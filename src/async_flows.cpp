@@ -0,0 +1,179 @@
+#include "async_flows.h"
+
+#include "async_client.h"
+#include "task.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+namespace {
+
+/* How long to wait for in-flight acks once asked to stop */
+constexpr auto STOP_GRACE_PERIOD = std::chrono::seconds(2);
+
+struct FlowState
+{
+    std::atomic<uint64_t> acked = 0;
+    std::atomic<uint64_t> failed = 0;
+    std::atomic<uint64_t> received = 0;
+    std::atomic<int64_t> total_latency_us = 0;
+    std::atomic<int64_t> max_latency_us = 0;
+
+    std::mutex mutex;
+    std::condition_variable cond_var;
+    int remaining = 0;
+    int connect_rc = 0;
+    int publish_rc = 0;
+    int subscribe_rc = 0;
+
+    void flowDone(int count = 1)
+    {
+        {
+            std::lock_guard lk(mutex);
+            remaining -= count;
+        }
+        cond_var.notify_all();
+    }
+};
+
+Task<void> runFlow(AsyncClient & client,
+                   std::string topic,
+                   int num_messages,
+                   int (*read_sample)(),
+                   const std::atomic_bool & stop,
+                   FlowState & state)
+{
+    /* NOLINTNEXTLINE(hicpp-avoid-c-arrays,modernize-avoid-c-arrays,cppcoreguidelines-avoid-c-arrays) */
+    char payload[20];
+    for (int i = 0; (num_messages <= 0 || i < num_messages) && !stop; ++i) {
+        const int len = snprintf(payload, sizeof(payload), "%d", read_sample()); // NOLINT(cert-err33-c)
+        const auto start_tp = std::chrono::steady_clock::now();
+        const int rc = co_await client.publish(topic.c_str(), payload, static_cast<size_t>(len), 1);
+        if (rc != 0) {
+            /* Most errors (no connection, payload too large) would fail the next publish too, so don't spin on them */
+            state.failed.fetch_add(1, std::memory_order_relaxed);
+            if (rc != AsyncClient::CANCELLED) {
+                std::lock_guard lk(state.mutex);
+                if (state.publish_rc == 0) {
+                    state.publish_rc = rc;
+                }
+            }
+            break;
+        }
+        const auto latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start_tp)
+                                    .count();
+        state.acked.fetch_add(1, std::memory_order_relaxed);
+        state.total_latency_us.fetch_add(latency_us, std::memory_order_relaxed);
+        auto max_latency = state.max_latency_us.load(std::memory_order_relaxed);
+        while (latency_us > max_latency && !state.max_latency_us.compare_exchange_weak(max_latency, latency_us)) {
+        }
+    }
+    state.flowDone();
+}
+
+/* Counts the messages received until the stream is closed */
+Task<void> receive(AsyncClient & client, FlowState & state)
+{
+    while (auto msg = co_await client.nextMessage()) {
+        state.received.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Task<void> runFlows(AsyncClient & client,
+                    const char * topic,
+                    int num_flows,
+                    int num_messages,
+                    int (*read_sample)(),
+                    const std::atomic_bool & stop,
+                    bool verify,
+                    FlowState & state)
+{
+    const int rc = co_await client.connect();
+    if (rc != 0) {
+        {
+            std::lock_guard lk(state.mutex);
+            state.connect_rc = rc;
+        }
+        state.flowDone(num_flows);
+        co_return;
+    }
+    if (verify) {
+        const auto topic_filter = std::string(topic) + "/#";
+        const int granted_qos = co_await client.subscribe(topic_filter.c_str(), 1);
+        if (granted_qos < 0 || granted_qos >= 0x80) {
+            if (granted_qos != AsyncClient::CANCELLED) {
+                std::lock_guard lk(state.mutex);
+                state.subscribe_rc = granted_qos;
+            }
+            state.flowDone(num_flows);
+            co_return;
+        }
+        spawn(receive(client, state));
+    }
+    for (int i = 0; i < num_flows; ++i) {
+        spawn(runFlow(client, std::string(topic) + "/" + std::to_string(i), num_messages, read_sample, stop, state));
+    }
+}
+
+} // namespace
+
+AsyncFlowReport runAsyncFlows(Transport & transport,
+                              const char * topic,
+                              int num_flows,
+                              int num_messages,
+                              int (*read_sample)(),
+                              const std::atomic_bool & stop,
+                              bool verify)
+{
+    FlowState state;
+    state.remaining = num_flows;
+    const auto start_tp = std::chrono::steady_clock::now();
+    {
+        AsyncClient client(transport);
+        spawn(runFlows(client, topic, num_flows, num_messages, read_sample, stop, verify, state));
+
+        std::unique_lock lk(state.mutex);
+        auto all_done = [&state] { return state.remaining <= 0; };
+        while (!state.cond_var.wait_for(lk, std::chrono::milliseconds(100), all_done)) {
+            if (stop) {
+                /* Flows stop after their in-flight publish completes, don't wait forever for lost acks */
+                state.cond_var.wait_for(lk, STOP_GRACE_PERIOD, all_done);
+                break;
+            }
+        }
+        /* Stop the network thread, then resume what is still suspended so every coroutine frame is freed */
+        lk.unlock();
+        transport.stop();
+        client.cancelAll();
+    }
+
+    AsyncFlowReport report;
+    report.connect_rc = state.connect_rc;
+    report.publish_rc = state.publish_rc;
+    report.subscribe_rc = state.subscribe_rc;
+    report.num_flows = num_flows;
+    report.verify = verify;
+    report.acked = state.acked;
+    report.failed = state.failed;
+    report.received = state.received;
+    report.total_latency = std::chrono::microseconds(state.total_latency_us.load());
+    report.max_latency = std::chrono::microseconds(state.max_latency_us.load());
+    report.elapsed = std::chrono::steady_clock::now() - start_tp;
+    return report;
+}
+
+void AsyncFlowReport::print(std::ostream & os) const
+{
+    const auto mean_latency_us = acked > 0 ? static_cast<double>(total_latency.count()) / acked : 0.0;
+    os << "Async flows: flows=" << num_flows << " acked=" << acked << " failed=" << failed
+       << " rate=" << acked / elapsed.count() << " msg/s mean_ack_latency=" << mean_latency_us
+       << "us max_ack_latency=" << max_latency.count() << "us";
+    if (verify) {
+        os << " received=" << received;
+    }
+    os << std::endl;
+}
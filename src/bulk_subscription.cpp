@@ -0,0 +1,211 @@
+#include "bulk_subscription.h"
+
+#include "topic_filter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+namespace {
+
+/* SUBACK return codes from this one on refuse the filter */
+constexpr int SUBSCRIPTION_REFUSED = 0x80;
+
+/* Bytes of the variable length encoding of a packet's remaining length */
+size_t remainingLengthSize(size_t remaining_length)
+{
+    size_t size = 1;
+    for (; remaining_length >= 128; remaining_length /= 128) {
+        ++size;
+    }
+    return size;
+}
+
+double toMilliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // namespace
+
+std::optional<std::vector<std::string>> loadTopicFilters(const std::string & path, std::string & error)
+{
+    std::ifstream file(path);
+    if (!file) {
+        error = "Unable to open " + path + ": " + std::strerror(errno);
+        return std::nullopt;
+    }
+    std::vector<std::string> filters;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+        const auto begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        const auto end = line.find_last_not_of(" \t\r");
+        auto filter = line.substr(begin, end - begin + 1);
+        const auto shared = parseSharedSubscription(filter);
+        if (!isValidTopicFilter(shared ? shared->filter : std::string_view(filter))) {
+            error = path + ":" + std::to_string(line_number) + ": invalid topic filter '" + filter + "'";
+            return std::nullopt;
+        }
+        filters.push_back(std::move(filter));
+    }
+    if (file.bad()) {
+        error = "Unable to read " + path;
+        return std::nullopt;
+    }
+    return filters;
+}
+
+size_t subscribePacketSize(size_t filter_bytes)
+{
+    /* Packet identifier, plus the property length of MQTT 5 so the estimate holds whichever version is spoken */
+    const size_t remaining_length = 2 + 1 + filter_bytes;
+    return 1 + remainingLengthSize(remaining_length) + remaining_length;
+}
+
+std::vector<size_t> planSubscribeBatches(const std::vector<std::string> & filters, const SubscribeBatchLimits & limits)
+{
+    std::vector<size_t> batch_ends;
+    size_t batch_bytes = 0;
+    size_t batch_filters = 0;
+    for (size_t i = 0; i < filters.size(); ++i) {
+        /* Length prefix and subscription options byte */
+        const size_t filter_bytes = 2 + filters[i].size() + 1;
+        const bool fits = batch_filters < limits.max_filters
+                          && subscribePacketSize(batch_bytes + filter_bytes) <= limits.max_packet_size;
+        if (batch_filters > 0 && !fits) {
+            batch_ends.push_back(i);
+            batch_bytes = 0;
+            batch_filters = 0;
+        }
+        batch_bytes += filter_bytes;
+        ++batch_filters;
+    }
+    if (batch_filters > 0) {
+        batch_ends.push_back(filters.size());
+    }
+    return batch_ends;
+}
+
+BulkSubscription::BulkSubscription(const std::vector<std::string> & filters,
+                                   size_t num_connections,
+                                   bool spread,
+                                   SubscribeBatchLimits limits)
+{
+    for (size_t i = 0; i < num_connections; ++i) {
+        connections_.push_back(std::make_unique<Connection>());
+    }
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (spread) {
+            connections_[i % num_connections]->filters.push_back(filters[i]);
+            continue;
+        }
+        for (auto & connection : connections_) {
+            connection->filters.push_back(filters[i]);
+        }
+    }
+    for (auto & connection : connections_) {
+        connection->batch_ends = planSubscribeBatches(connection->filters, limits);
+    }
+}
+
+int BulkSubscription::subscribe(Transport & transport, size_t index, int qos)
+{
+    Connection & connection = *connections_.at(index);
+    {
+        std::lock_guard lk(mutex_);
+        connection.batches_acked = 0;
+        connection.granted = 0;
+        connection.refused = 0;
+        connection.start_tp = std::chrono::steady_clock::now();
+        if (!first_start_tp_) {
+            first_start_tp_ = connection.start_tp;
+        }
+    }
+    std::vector<const char *> filters;
+    filters.reserve(connection.filters.size());
+    for (const auto & filter : connection.filters) {
+        filters.push_back(filter.c_str());
+    }
+    /* Back to back, SUBACKs are counted as they come */
+    size_t begin = 0;
+    for (size_t end : connection.batch_ends) {
+        const int count = static_cast<int>(end - begin);
+        if (int rc = transport.subscribeMultiple(filters.data() + begin, count, qos, nullptr); rc != 0) {
+            return rc;
+        }
+        begin = end;
+    }
+    return 0;
+}
+
+BulkSubscription::Progress BulkSubscription::onSubAck(size_t index, int qos_count, const int * granted_qos)
+{
+    Connection & connection = *connections_.at(index);
+    std::lock_guard lk(mutex_);
+    for (int i = 0; i < qos_count; ++i) {
+        if (granted_qos[i] < SUBSCRIPTION_REFUSED) {
+            ++connection.granted;
+        } else {
+            ++connection.refused;
+        }
+    }
+    if (++connection.batches_acked != connection.batch_ends.size()) {
+        return Progress::PENDING;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    connection.elapsed = now - connection.start_tp;
+    if (connection.done_once) {
+        return Progress::CONNECTION_DONE;
+    }
+    connection.done_once = true;
+    if (++num_done_ != connections_.size()) {
+        return Progress::CONNECTION_DONE;
+    }
+    all_done_ = true;
+    all_elapsed_ = now - *first_start_tp_;
+    return Progress::ALL_DONE;
+}
+
+size_t BulkSubscription::grantedCount(size_t index) const
+{
+    std::lock_guard lk(mutex_);
+    return connections_.at(index)->granted;
+}
+
+void BulkSubscription::printConnectionReport(std::ostream & os, size_t index) const
+{
+    std::lock_guard lk(mutex_);
+    const Connection & connection = *connections_.at(index);
+    os << "Bulk subscription " << index << ": filters=" << connection.filters.size()
+       << " batches=" << connection.batch_ends.size() << " granted=" << connection.granted
+       << " refused=" << connection.refused << " elapsed=" << std::fixed << std::setprecision(1)
+       << toMilliseconds(connection.elapsed) << "ms" << std::defaultfloat << std::endl;
+}
+
+void BulkSubscription::printReport(std::ostream & os) const
+{
+    std::lock_guard lk(mutex_);
+    size_t filters = 0;
+    size_t batches = 0;
+    size_t granted = 0;
+    size_t refused = 0;
+    for (const auto & connection : connections_) {
+        filters += connection->filters.size();
+        batches += connection->batch_ends.size();
+        granted += connection->granted;
+        refused += connection->refused;
+    }
+    os << "Bulk subscription: connections=" << connections_.size() << " filters=" << filters << " batches=" << batches
+       << " granted=" << granted << " refused=" << refused;
+    if (all_done_) {
+        os << " all SUBACKs after " << std::fixed << std::setprecision(1) << toMilliseconds(all_elapsed_) << "ms"
+           << std::defaultfloat;
+    } else {
+        os << " incomplete";
+    }
+    os << std::endl;
+}
@@ -0,0 +1,253 @@
+/* pread() and clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "chunked_transfer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const unsigned char CHUNK_MAGIC[4] = { 'M', 'Q', 'C', 'K' };
+
+struct ChunkedFileReader
+{
+    int fd;
+    uint32_t chunk_size;
+    uint32_t transfer_id;
+    uint32_t chunk_count;
+    uint64_t file_size;
+    uint32_t file_crc;
+};
+
+static void putU32(unsigned char * out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void putU64(unsigned char * out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint32_t getU32(const unsigned char * in)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static uint64_t getU64(const unsigned char * in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+/* An empty file still goes out as one empty chunk, so the receiver learns about it */
+static uint64_t chunkCount(uint64_t file_size, uint32_t chunk_size)
+{
+    return file_size == 0 ? 1 : file_size / chunk_size + (file_size % chunk_size != 0);
+}
+
+void chunkHeaderEncode(const struct ChunkHeader * header, unsigned char * out)
+{
+    memcpy(out, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+    out[4] = CHUNK_PROTOCOL_VERSION;
+    memset(out + 5, 0, 3);
+    putU32(out + 8, header->transfer_id);
+    putU32(out + 12, header->seq);
+    putU32(out + 16, header->chunk_count);
+    putU32(out + 20, header->chunk_size);
+    putU64(out + 24, header->offset);
+    putU64(out + 32, header->file_size);
+    putU32(out + 40, header->chunk_crc);
+    putU32(out + 44, header->file_crc);
+}
+
+int chunkHeaderDecode(const void * payload, size_t payload_len, struct ChunkHeader * header)
+{
+    const unsigned char * in = payload;
+    if (payload_len < CHUNK_HEADER_SIZE || memcmp(in, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0
+        || in[4] != CHUNK_PROTOCOL_VERSION) {
+        return -1;
+    }
+    header->transfer_id = getU32(in + 8);
+    header->seq = getU32(in + 12);
+    header->chunk_count = getU32(in + 16);
+    header->chunk_size = getU32(in + 20);
+    header->offset = getU64(in + 24);
+    header->file_size = getU64(in + 32);
+    header->chunk_crc = getU32(in + 40);
+    header->file_crc = getU32(in + 44);
+    if (header->chunk_size == 0 || header->chunk_count != chunkCount(header->file_size, header->chunk_size)
+        || header->seq >= header->chunk_count || header->offset != (uint64_t)header->seq * header->chunk_size) {
+        return -1;
+    }
+    /* Every chunk but the last is full, the last holds the rest of the file. The checks above keep the offset within
+     * the file. */
+    const uint64_t left = header->file_size - header->offset;
+    const uint64_t expected_len = left < header->chunk_size ? left : header->chunk_size;
+    return payload_len - CHUNK_HEADER_SIZE == expected_len ? 0 : -1;
+}
+
+static uint32_t CrcTable[256];
+static pthread_once_t CrcTableOnce = PTHREAD_ONCE_INIT;
+
+static void initCrcTable(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        }
+        CrcTable[i] = c;
+    }
+}
+
+uint32_t chunkCrc32(uint32_t crc, const void * data, size_t len)
+{
+    pthread_once(&CrcTableOnce, initCrcTable);
+    const unsigned char * p = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = CrcTable[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+struct ChunkedFileReader * chunkedFileReaderOpen(const char * path, uint32_t chunk_size, uint32_t transfer_id)
+{
+    if (chunk_size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct ChunkedFileReader * reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+    reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (reader->fd < 0 || fstat(reader->fd, &st) != 0) {
+        chunkedFileReaderClose(reader);
+        return NULL;
+    }
+    reader->chunk_size = chunk_size;
+    reader->transfer_id = transfer_id;
+    reader->file_size = (uint64_t)st.st_size;
+    const uint64_t chunk_count = chunkCount(reader->file_size, chunk_size);
+    if (chunk_count > UINT32_MAX) {
+        chunkedFileReaderClose(reader);
+        errno = EFBIG;
+        return NULL;
+    }
+    reader->chunk_count = (uint32_t)chunk_count;
+
+    unsigned char buffer[65536];
+    uint64_t offset = 0;
+    while (offset < reader->file_size) {
+        const ssize_t n = pread(reader->fd, buffer, sizeof(buffer), (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            chunkedFileReaderClose(reader);
+            return NULL;
+        }
+        reader->file_crc = chunkCrc32(reader->file_crc, buffer, (size_t)n);
+        offset += (uint64_t)n;
+    }
+    return reader;
+}
+
+void chunkedFileReaderClose(struct ChunkedFileReader * reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    if (reader->fd >= 0) {
+        const int saved_errno = errno;
+        close(reader->fd);
+        errno = saved_errno;
+    }
+    free(reader);
+}
+
+uint32_t chunkedFileReaderChunkCount(const struct ChunkedFileReader * reader)
+{
+    return reader->chunk_count;
+}
+
+uint64_t chunkedFileReaderFileSize(const struct ChunkedFileReader * reader)
+{
+    return reader->file_size;
+}
+
+size_t chunkedFileReaderMessageSize(const struct ChunkedFileReader * reader)
+{
+    return CHUNK_HEADER_SIZE + (size_t)reader->chunk_size;
+}
+
+long chunkedFileReaderRead(struct ChunkedFileReader * reader, uint32_t seq, unsigned char * buffer)
+{
+    struct ChunkHeader header;
+    header.transfer_id = reader->transfer_id;
+    header.seq = seq;
+    header.chunk_count = reader->chunk_count;
+    header.chunk_size = reader->chunk_size;
+    header.offset = (uint64_t)seq * reader->chunk_size;
+    header.file_size = reader->file_size;
+    header.file_crc = reader->file_crc;
+
+    size_t len = 0;
+    if (header.offset < reader->file_size) {
+        const uint64_t left = reader->file_size - header.offset;
+        len = left < reader->chunk_size ? (size_t)left : reader->chunk_size;
+    }
+    unsigned char * data = buffer + CHUNK_HEADER_SIZE;
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t n = pread(reader->fd, data + done, len - done, (off_t)(header.offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            /* The file shrank since it was opened */
+            if (n == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    header.chunk_crc = chunkCrc32(0, data, len);
+    chunkHeaderEncode(&header, buffer);
+    return (long)(CHUNK_HEADER_SIZE + len);
+}
+
+uint32_t chunkTransferIdNew(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    /* Mixes the time with the pid, so senders starting in the same nanosecond still differ */
+    uint64_t x = ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec) ^ ((uint64_t)getpid() << 32);
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
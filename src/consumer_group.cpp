@@ -0,0 +1,98 @@
+#include "consumer_group.h"
+
+#include <iomanip>
+#include <iostream>
+
+ConsumerGroup::ConsumerGroup(std::string group,
+                             const std::string & topic,
+                             const std::string & client_id,
+                             size_t num_members)
+: group_(std::move(group))
+{
+    const auto subscribe_topic = group_.empty() ? topic : sharedSubscriptionTopic(group_, topic);
+    for (size_t i = 0; i < num_members; ++i) {
+        auto member = std::make_unique<ConsumerMember>();
+        member->index = i;
+        /* Client ids must be unique per broker, the first member keeps the configured one */
+        member->client_id = i == 0 ? client_id : client_id + "-" + std::to_string(i);
+        member->subscribe_topic = subscribe_topic;
+        members_.push_back(std::move(member));
+    }
+}
+
+ConsumerGroup::~ConsumerGroup()
+{
+    stopReporter();
+}
+
+std::string ConsumerGroup::sharedSubscriptionTopic(const std::string & group, const std::string & topic)
+{
+    return "$share/" + group + "/" + topic;
+}
+
+size_t ConsumerGroup::subscribedCount() const
+{
+    size_t count = 0;
+    for (const auto & member : members_) {
+        count += member->subscribed ? 1 : 0;
+    }
+    return count;
+}
+
+void ConsumerGroup::startReporter(std::chrono::milliseconds interval)
+{
+    reporter_ = std::thread([this, interval] {
+        std::vector<uint64_t> last_messages(members_.size(), 0);
+        auto last_tp = std::chrono::steady_clock::now();
+        std::unique_lock lk(reporter_mutex_);
+        while (!reporter_cond_var_.wait_for(lk, interval, [this] { return stop_reporter_; })) {
+            const auto now = std::chrono::steady_clock::now();
+            report(std::cout, last_messages, now - last_tp);
+            last_tp = now;
+        }
+    });
+}
+
+void ConsumerGroup::stopReporter()
+{
+    {
+        std::lock_guard lk(reporter_mutex_);
+        stop_reporter_ = true;
+    }
+    reporter_cond_var_.notify_all();
+    if (reporter_.joinable()) {
+        reporter_.join();
+    }
+}
+
+void ConsumerGroup::report(std::ostream & os,
+                           std::vector<uint64_t> & last_messages,
+                           std::chrono::duration<double> elapsed) const
+{
+    os << "Consumer group " << group_ << ":";
+    for (const auto & member : members_) {
+        const auto messages = member->messages.load(std::memory_order_relaxed);
+        const auto delta = messages - last_messages[member->index];
+        last_messages[member->index] = messages;
+        os << " [" << member->index << "] " << std::fixed << std::setprecision(1) << delta / elapsed.count()
+           << " msg/s";
+    }
+    os << std::endl;
+}
+
+void ConsumerGroup::printSummary(std::ostream & os) const
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - created_;
+    uint64_t total_messages = 0;
+    os << "Consumer group " << group_ << " summary over " << std::fixed << std::setprecision(1) << elapsed.count()
+       << " s:" << std::endl;
+    for (const auto & member : members_) {
+        const auto messages = member->messages.load(std::memory_order_relaxed);
+        const auto bytes = member->bytes.load(std::memory_order_relaxed);
+        total_messages += messages;
+        os << "  member " << member->index << " (" << member->client_id << "): messages=" << messages
+           << " bytes=" << bytes << " rate=" << messages / elapsed.count() << " msg/s" << std::endl;
+    }
+    os << "  total: messages=" << total_messages << " rate=" << total_messages / elapsed.count() << " msg/s"
+       << std::endl;
+}
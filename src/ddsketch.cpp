@@ -0,0 +1,164 @@
+#include "ddsketch.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace {
+constexpr uint64_t EXPONENT_MASK = 0x7ff0000000000000ULL;
+constexpr uint64_t MANTISSA_MASK = 0x000fffffffffffffULL;
+constexpr uint64_t ONE_BITS = 0x3ff0000000000000ULL;
+constexpr int EXPONENT_SHIFT = 52;
+constexpr int EXPONENT_BIAS = 1023;
+
+/* log2(x) approximated as exponent + (mantissa - 1), exact at powers of two and within 0.09 in between */
+inline double approxLog2(double x)
+{
+    const auto bits = std::bit_cast<uint64_t>(x);
+    const auto exponent = static_cast<int64_t>((bits & EXPONENT_MASK) >> EXPONENT_SHIFT) - EXPONENT_BIAS;
+    const auto mantissa = std::bit_cast<double>((bits & MANTISSA_MASK) | ONE_BITS);
+    return static_cast<double>(exponent) + mantissa - 1.0;
+}
+
+/* Inverse of approxLog2() */
+inline double approxExp2(double l)
+{
+    const double exponent = std::floor(l);
+    return std::ldexp(1.0 + (l - exponent), static_cast<int>(exponent));
+}
+} // namespace
+
+DDSketch::DDSketch(double relative_accuracy)
+/* d(approxLog2)/d(ln x) is the mantissa, at least 1, so buckets of width 1/multiplier in approxLog2 space are at most
+ * ln(gamma) wide in ln space and bound the relative error by (gamma - 1) / (gamma + 1) = relative_accuracy. */
+: multiplier_(1.0 / std::log((1.0 + relative_accuracy) / (1.0 - relative_accuracy)))
+, min_indexable_(std::numeric_limits<double>::min())
+{
+}
+
+int32_t DDSketch::index(double magnitude) const
+{
+    return static_cast<int32_t>(std::floor(approxLog2(magnitude) * multiplier_));
+}
+
+double DDSketch::value(int32_t index) const
+{
+    const double lower = approxExp2(index / multiplier_);
+    const double upper = approxExp2((index + 1) / multiplier_);
+    /* Equidistant in relative terms from both bucket bounds */
+    return 2.0 * lower * upper / (lower + upper);
+}
+
+void DDSketch::addIndexed(double value, int32_t index)
+{
+    if (!std::isfinite(value)) {
+        return;
+    }
+    if (std::abs(value) < min_indexable_) {
+        ++zero_count_;
+    } else if (value > 0) {
+        positive_.add(index);
+    } else {
+        negative_.add(index);
+    }
+    ++count_;
+}
+
+void DDSketch::add(double value)
+{
+    addIndexed(value, std::abs(value) < min_indexable_ ? 0 : index(std::abs(value)));
+}
+
+void DDSketch::addBatch(const double * values, size_t count)
+{
+    batch_indices_.resize(count);
+    /* Branch-free so it vectorizes. Zero, tiny and non-finite values get meaningless (but in range) indices that
+     * addIndexed() ignores. */
+    for (size_t i = 0; i < count; ++i) {
+        batch_indices_[i] = index(std::abs(values[i]));
+    }
+    for (size_t i = 0; i < count; ++i) {
+        addIndexed(values[i], batch_indices_[i]);
+    }
+}
+
+void DDSketch::merge(const DDSketch & other)
+{
+    positive_.merge(other.positive_);
+    negative_.merge(other.negative_);
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+}
+
+void DDSketch::clear()
+{
+    positive_.clear();
+    negative_.clear();
+    zero_count_ = 0;
+    count_ = 0;
+}
+
+double DDSketch::quantile(double q) const
+{
+    if (count_ == 0) {
+        return 0;
+    }
+    const auto rank = static_cast<uint64_t>(std::clamp(q, 0.0, 1.0) * static_cast<double>(count_ - 1));
+    uint64_t seen = 0;
+    /* Ascending values: negatives by descending magnitude, zeros, then positives */
+    for (size_t i = negative_.counts.size(); i-- > 0;) {
+        seen += negative_.counts[i];
+        if (seen > rank) {
+            return -value(negative_.offset + static_cast<int32_t>(i));
+        }
+    }
+    seen += zero_count_;
+    if (seen > rank) {
+        return 0;
+    }
+    for (size_t i = 0; i < positive_.counts.size(); ++i) {
+        seen += positive_.counts[i];
+        if (seen > rank) {
+            return value(positive_.offset + static_cast<int32_t>(i));
+        }
+    }
+    return positive_.counts.empty() ? 0 : value(positive_.offset + static_cast<int32_t>(positive_.counts.size()) - 1);
+}
+
+void DDSketch::Store::add(int32_t index, uint64_t count)
+{
+    if (counts.empty()) {
+        offset = index;
+        counts.resize(1);
+    } else if (index < offset) {
+        counts.insert(counts.begin(), static_cast<size_t>(offset - index), 0);
+        offset = index;
+    } else if (static_cast<size_t>(index - offset) >= counts.size()) {
+        counts.resize(static_cast<size_t>(index - offset) + 1);
+    }
+    counts[static_cast<size_t>(index - offset)] += count;
+    total += count;
+}
+
+void DDSketch::Store::merge(const Store & other)
+{
+    if (other.total == 0) {
+        return;
+    }
+    /* Grow to cover both ranges up front, then it's a plain element-wise sum */
+    add(other.offset, 0);
+    add(other.offset + static_cast<int32_t>(other.counts.size()) - 1, 0);
+    const auto shift = static_cast<size_t>(other.offset - offset);
+    for (size_t i = 0; i < other.counts.size(); ++i) {
+        counts[shift + i] += other.counts[i];
+    }
+    total += other.total;
+}
+
+void DDSketch::Store::clear()
+{
+    counts.clear();
+    offset = 0;
+    total = 0;
+}
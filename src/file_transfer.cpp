@@ -0,0 +1,377 @@
+#include "file_transfer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+namespace {
+
+/* How long connecting may take */
+constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(5);
+/* The transfer is given up when no chunk was acknowledged for this long */
+constexpr auto ACK_TIMEOUT = std::chrono::seconds(30);
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+
+struct SendState
+{
+    std::mutex mutex;
+    std::condition_variable cond_var;
+    std::optional<int> connect_rc;
+    int in_flight = 0;
+    uint64_t acked = 0;
+};
+
+/* Waits until `pred` holds, nothing was acknowledged for `timeout` or `stop` is raised, returns `pred()` */
+template<typename Pred>
+bool waitFor(SendState & state,
+             std::unique_lock<std::mutex> & lk,
+             std::chrono::steady_clock::duration timeout,
+             const std::atomic_bool & stop,
+             Pred pred)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    uint64_t acked = state.acked;
+    while (!pred() && !stop && std::chrono::steady_clock::now() < deadline) {
+        state.cond_var.wait_for(lk, POLL_INTERVAL);
+        if (state.acked != acked) {
+            acked = state.acked;
+            deadline = std::chrono::steady_clock::now() + timeout;
+        }
+    }
+    return pred();
+}
+
+std::string transferName(uint32_t id)
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(8) << std::setfill('0') << id;
+    return name.str();
+}
+
+} // namespace
+
+FileSendReport sendFile(Transport & transport, const FileSendOptions & options, const std::atomic_bool & stop)
+{
+    FileSendReport report;
+    report.transfer_id = chunkTransferIdNew();
+    std::unique_ptr<ChunkedFileReader, decltype(&chunkedFileReaderClose)> reader(
+        chunkedFileReaderOpen(options.path.c_str(), options.chunk_size, report.transfer_id), chunkedFileReaderClose);
+    if (!reader) {
+        report.error = "Unable to read " + options.path + ": " + std::strerror(errno);
+        return report;
+    }
+    report.file_size = chunkedFileReaderFileSize(reader.get());
+    report.chunk_count = chunkedFileReaderChunkCount(reader.get());
+    const int max_in_flight = std::max(options.max_in_flight, 1);
+
+    SendState state;
+    transport.setConnectCallback([&state](Transport &, int reason_code) {
+        {
+            std::lock_guard lk(state.mutex);
+            state.connect_rc = reason_code;
+        }
+        state.cond_var.notify_all();
+    });
+    /* The connection is ours alone, so every completed publish is one of the chunks */
+    transport.setPublishCallback([&state](Transport &, int /*mid*/) {
+        {
+            std::lock_guard lk(state.mutex);
+            --state.in_flight;
+            ++state.acked;
+        }
+        state.cond_var.notify_all();
+    });
+    transport.setSubscribeCallback(nullptr);
+    transport.setMessageCallback(nullptr);
+    transport.setDisconnectCallback(nullptr);
+
+    std::cout << "Sending " << options.path << " (" << report.file_size << " bytes) as transfer "
+              << transferName(report.transfer_id) << " in " << report.chunk_count << " chunks to " << options.topic
+              << std::endl;
+    int rc = transport.connect();
+    if (rc != 0) {
+        report.error = std::string("Failed to connect: ") + transport.errorString(rc);
+        return report;
+    }
+    rc = transport.start();
+    if (rc != 0) {
+        report.error = std::string("Failed to start loop: ") + transport.errorString(rc);
+        return report;
+    }
+
+    std::unique_lock lk(state.mutex);
+    if (!waitFor(state, lk, CONNECT_TIMEOUT, stop, [&state] { return state.connect_rc.has_value(); })) {
+        report.error = "Timed out connecting";
+    } else if (*state.connect_rc != 0) {
+        report.error = std::string("Connection refused: ") + transport.connackString(*state.connect_rc);
+    }
+    lk.unlock();
+
+    std::vector<unsigned char> message(chunkedFileReaderMessageSize(reader.get()));
+    const auto start_tp = std::chrono::steady_clock::now();
+    for (uint32_t seq = 0; report.error.empty() && seq < report.chunk_count && !stop; ++seq) {
+        const long len = chunkedFileReaderRead(reader.get(), seq, message.data());
+        if (len < 0) {
+            report.error = "Unable to read " + options.path + ": " + std::strerror(errno);
+            break;
+        }
+        lk.lock();
+        if (!waitFor(state, lk, ACK_TIMEOUT, stop, [&] { return state.in_flight < max_in_flight; })) {
+            report.error = stop ? "Stopped" : "Timed out waiting for acknowledgements";
+            lk.unlock();
+            break;
+        }
+        /* Counted before publishing, the transport may report the publish done before publish() returns */
+        report.max_in_flight = std::max(report.max_in_flight, ++state.in_flight);
+        lk.unlock();
+        rc = transport.publish(
+            options.topic.c_str(), message.data(), static_cast<size_t>(len), options.qos, false, nullptr);
+        if (rc != 0) {
+            report.error = std::string("Failed to publish chunk: ") + transport.errorString(rc);
+            lk.lock();
+            --state.in_flight;
+            lk.unlock();
+        }
+    }
+
+    lk.lock();
+    if (!waitFor(state, lk, ACK_TIMEOUT, stop, [&state] { return state.in_flight <= 0; }) && report.error.empty()) {
+        report.error = stop ? "Stopped" : "Timed out waiting for acknowledgements";
+    }
+    report.chunks_acked = state.acked;
+    report.elapsed = std::chrono::steady_clock::now() - start_tp;
+    lk.unlock();
+
+    transport.disconnect();
+    transport.stop();
+    return report;
+}
+
+void FileSendReport::print(std::ostream & os) const
+{
+    const double seconds = std::max(elapsed.count(), 1e-9);
+    /* Approximate when stopped short, the last chunk may be smaller */
+    const double bytes_acked = chunk_count > 0 ? static_cast<double>(file_size) * chunks_acked / chunk_count : 0;
+    os << "File transfer " << transferName(transfer_id) << ": acked=" << chunks_acked << "/" << chunk_count
+       << " chunks bytes=" << file_size << " elapsed=" << elapsed.count()
+       << "s throughput=" << bytes_acked / seconds / 1e6 << " MB/s max_in_flight=" << max_in_flight;
+    if (!error.empty()) {
+        os << " error=" << error;
+    }
+    os << std::endl;
+}
+
+ChunkReassembler::Transfer::~Transfer()
+{
+    if (map != nullptr) {
+        munmap(map, file_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+ChunkReassembler::ChunkReassembler(std::string output_dir, uint64_t max_bytes)
+: output_dir_(std::move(output_dir))
+, max_bytes_(max_bytes)
+{
+    finisher_ = std::thread([this] { runFinisher(); });
+}
+
+ChunkReassembler::~ChunkReassembler()
+{
+    stop();
+}
+
+void ChunkReassembler::stop()
+{
+    {
+        std::lock_guard lk(mutex_);
+        stopping_ = true;
+    }
+    finish_cond_var_.notify_one();
+    if (finisher_.joinable()) {
+        finisher_.join();
+    }
+}
+
+std::shared_ptr<ChunkReassembler::Transfer> ChunkReassembler::findOrCreate(const ChunkHeader & header)
+{
+    if (auto it = transfers_.find(header.transfer_id); it != transfers_.end()) {
+        return it->second;
+    }
+    const auto id = header.transfer_id;
+    if (header.file_size > max_bytes_) {
+        if (refused_.insert(id).second) {
+            std::cerr << "Transfer " << transferName(id) << ": refused, " << header.file_size
+                      << " bytes is more than the " << max_bytes_ << " allowed" << std::endl;
+            ++failed_;
+        }
+        return nullptr;
+    }
+    auto transfer = std::make_shared<Transfer>();
+    transfer->id = id;
+    transfer->file_size = header.file_size;
+    transfer->chunk_count = header.chunk_count;
+    transfer->chunk_size = header.chunk_size;
+    transfer->file_crc = header.file_crc;
+    transfer->part_path = output_dir_ + "/" + transferName(id) + ".part";
+    transfer->start_tp = std::chrono::steady_clock::now();
+    transfer->claimed.resize(header.chunk_count);
+    transfers_.emplace(id, transfer);
+
+    /* Preallocated up front, so the disk can't fill up halfway through and the blocks are laid out together */
+    const uint64_t file_size = header.file_size;
+    transfer->fd = open(transfer->part_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int err = transfer->fd < 0 ? errno : 0;
+    if (err == 0 && file_size > 0) {
+        err = posix_fallocate(transfer->fd, 0, static_cast<off_t>(file_size));
+        if (err == EOPNOTSUPP || err == EINVAL) {
+            /* Filesystems without fallocate still get the right size, sparse */
+            err = ftruncate(transfer->fd, static_cast<off_t>(file_size)) == 0 ? 0 : errno;
+        }
+        if (err == 0) {
+            void * map = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, transfer->fd, 0);
+            if (map == MAP_FAILED) {
+                err = errno;
+            } else {
+                transfer->map = static_cast<unsigned char *>(map);
+            }
+        }
+    }
+    if (err != 0) {
+        std::cerr << "Transfer " << transferName(id) << ": unable to create " << transfer->part_path << ": "
+                  << std::strerror(err) << std::endl;
+        transfer->failed = true;
+        ++failed_;
+    }
+    return transfer;
+}
+
+bool ChunkReassembler::handle(const TransportMessage & msg)
+{
+    /* Also checks that the chunk lies where its sequence number says and has exactly that chunk's length */
+    ChunkHeader header;
+    if (chunkHeaderDecode(msg.payload, msg.payload_len, &header) != 0) {
+        return false;
+    }
+    const auto * data = static_cast<const unsigned char *>(msg.payload) + CHUNK_HEADER_SIZE;
+    const size_t data_len = msg.payload_len - CHUNK_HEADER_SIZE;
+    if (chunkCrc32(0, data, data_len) != header.chunk_crc) {
+        std::lock_guard lk(mutex_);
+        ++corrupt_;
+        return true;
+    }
+
+    std::shared_ptr<Transfer> transfer;
+    {
+        std::lock_guard lk(mutex_);
+        if (done_.count(header.transfer_id) != 0) {
+            ++duplicates_;
+            return true;
+        }
+        if (refused_.count(header.transfer_id) != 0) {
+            return true;
+        }
+        transfer = findOrCreate(header);
+        if (!transfer || transfer->failed) {
+            return true;
+        }
+        if (header.file_size != transfer->file_size || header.chunk_count != transfer->chunk_count
+            || header.chunk_size != transfer->chunk_size || header.file_crc != transfer->file_crc) {
+            ++corrupt_;
+            return true;
+        }
+        if (transfer->claimed[header.seq]) {
+            ++duplicates_;
+            return true;
+        }
+        transfer->claimed[header.seq] = true;
+    }
+
+    /* Every chunk of the transfer has the same size and lies at `seq * chunk_size`, and each seq is claimed once, so
+     * copies never overlap and run without the lock */
+    if (data_len > 0) {
+        std::memcpy(transfer->map + header.offset, data, data_len);
+    }
+
+    bool complete = false;
+    {
+        std::lock_guard lk(mutex_);
+        complete = ++transfer->written == transfer->chunk_count;
+        if (complete) {
+            transfers_.erase(transfer->id);
+            done_.insert(transfer->id);
+            finishing_.push_back(std::move(transfer));
+        }
+    }
+    if (complete) {
+        finish_cond_var_.notify_one();
+    }
+    return true;
+}
+
+void ChunkReassembler::runFinisher()
+{
+    std::unique_lock lk(mutex_);
+    while (true) {
+        finish_cond_var_.wait(lk, [this] { return stopping_ || !finishing_.empty(); });
+        if (finishing_.empty()) {
+            return;
+        }
+        auto transfer = std::move(finishing_.front());
+        finishing_.pop_front();
+        lk.unlock();
+        finish(*transfer);
+        lk.lock();
+    }
+}
+
+void ChunkReassembler::finish(Transfer & transfer)
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - transfer.start_tp;
+    const uint32_t crc = transfer.file_size > 0 ? chunkCrc32(0, transfer.map, transfer.file_size) : 0;
+    const auto name = transferName(transfer.id);
+    if (crc != transfer.file_crc) {
+        std::cerr << "Transfer " << name << ": CRC mismatch, kept " << transfer.part_path << std::endl;
+        std::lock_guard lk(mutex_);
+        ++failed_;
+        return;
+    }
+    /* On disk before it shows up under its final name */
+    if (transfer.map != nullptr) {
+        msync(transfer.map, transfer.file_size, MS_SYNC);
+    }
+    fsync(transfer.fd);
+    const auto path = output_dir_ + "/" + name;
+    if (std::rename(transfer.part_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Transfer " << name << ": unable to rename " << transfer.part_path << ": " << std::strerror(errno)
+                  << std::endl;
+        std::lock_guard lk(mutex_);
+        ++failed_;
+        return;
+    }
+    std::cout << "Transfer " << name << ": received " << transfer.file_size << " bytes in " << transfer.chunk_count
+              << " chunks, " << elapsed.count() << "s, CRC ok, saved to " << path << std::endl;
+    std::lock_guard lk(mutex_);
+    ++completed_;
+}
+
+void ChunkReassembler::printStats(std::ostream & os) const
+{
+    std::lock_guard lk(mutex_);
+    const auto incomplete = std::count_if(
+        transfers_.begin(), transfers_.end(), [](const auto & entry) { return !entry.second->failed; });
+    os << "Chunked transfers: completed=" << completed_ << " failed=" << failed_ << " incomplete=" << incomplete
+       << " duplicate_chunks=" << duplicates_ << " corrupt_chunks=" << corrupt_ << std::endl;
+}
@@ -0,0 +1,283 @@
+#include "flight_recorder.h"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic_bool FlightRecorder::s_enabled = false;
+
+namespace {
+
+/* How often the dump watcher checks for SIGUSR1 */
+constexpr auto DUMP_POLL_INTERVAL = std::chrono::milliseconds(200);
+
+struct Entry
+{
+    std::atomic<int64_t> ts_ns;
+    std::atomic<int64_t> arg;
+    std::atomic<TraceEvent> event;
+};
+
+struct ThreadRing
+{
+    pid_t tid = 0;
+    std::string name;
+    size_t mask = 0;
+    std::unique_ptr<Entry[]> entries;
+    std::atomic<uint64_t> head = 0;
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    /* Rings outlive their threads so events of finished threads still show up in the dump */
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    size_t capacity = 0;
+    std::string dump_path;
+    std::atomic_bool dump_requested = false;
+
+    /* Serializes dumps, the watcher and the exit handler may want one at the same time */
+    std::mutex dump_mutex;
+    std::thread watcher;
+    std::mutex watcher_mutex;
+    std::condition_variable watcher_cond_var;
+    bool watcher_stopping = false;
+};
+
+Registry & registry()
+{
+    static auto * instance = new Registry();
+    return *instance;
+}
+
+ThreadRing * registerThread()
+{
+    auto ring = std::make_shared<ThreadRing>();
+    ring->tid = static_cast<pid_t>(syscall(SYS_gettid));
+    /* NOLINTNEXTLINE(hicpp-avoid-c-arrays,modernize-avoid-c-arrays,cppcoreguidelines-avoid-c-arrays) */
+    char name[16] = {};
+    if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+        ring->name = name;
+    }
+    auto & reg = registry();
+    std::lock_guard lk(reg.mutex);
+    ring->mask = reg.capacity - 1;
+    ring->entries = std::make_unique<Entry[]>(reg.capacity);
+    reg.rings.push_back(ring);
+    return ring.get();
+}
+
+ThreadRing & threadRing()
+{
+    thread_local ThreadRing * ring = registerThread();
+    return *ring;
+}
+
+void writeEvent(std::ostream & os, pid_t pid, pid_t tid, TraceEvent event, int64_t ts_ns, int64_t arg)
+{
+    const auto ts_us = static_cast<double>(ts_ns) / 1000.0;
+    os << "{\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << ts_us << ",";
+    switch (event) {
+        case TraceEvent::PUBLISH_ENQUEUED:
+            /* Async span from enqueue to send/ack, possibly completed on another thread */
+            os << R"("ph":"b","cat":"publish","name":"publish","id":)" << arg << R"(,"args":{"connection":)"
+               << (static_cast<uint64_t>(arg) >> 32) << R"(,"mid":)" << static_cast<uint32_t>(arg) << "}";
+            break;
+        case TraceEvent::PUBLISH_DONE:
+            os << R"("ph":"e","cat":"publish","name":"publish","id":)" << arg;
+            break;
+        case TraceEvent::HANDLER_BEGIN:
+            os << R"("ph":"B","name":"handle_message","args":{"payload_len":)" << arg << "}";
+            break;
+        case TraceEvent::HANDLER_END:
+            os << R"("ph":"E","name":"handle_message")";
+            break;
+        case TraceEvent::MESSAGE_RECEIVED:
+            os << R"("ph":"i","s":"t","name":"message_received","args":{"payload_len":)" << arg << "}";
+            break;
+        case TraceEvent::CONNECTED:
+            os << R"("ph":"i","s":"p","name":"connected","args":{"reason_code":)" << arg << "}";
+            break;
+        case TraceEvent::RECONNECTED:
+            os << R"("ph":"i","s":"p","name":"reconnected","args":{"reason_code":)" << arg << "}";
+            break;
+        case TraceEvent::DISCONNECTED:
+            os << R"("ph":"i","s":"p","name":"disconnected","args":{"reason_code":)" << arg << "}";
+            break;
+    }
+    os << "}";
+}
+
+} // namespace
+
+void FlightRecorder::enable(size_t events_per_thread, std::string dump_path)
+{
+    auto & reg = registry();
+    {
+        std::lock_guard lk(reg.mutex);
+        if (s_enabled) {
+            return;
+        }
+        reg.capacity = std::bit_ceil(std::max<size_t>(events_per_thread, 2));
+        reg.dump_path = std::move(dump_path);
+    }
+
+    struct sigaction sa = {};
+    /* NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access) */
+    sa.sa_handler = [](int /*sig*/) { registry().dump_requested = true; };
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    /* Signal handlers can't write files, a watcher thread does it for them */
+    reg.watcher = std::thread([] {
+        auto & reg = registry();
+        std::unique_lock lk(reg.watcher_mutex);
+        while (!reg.watcher_cond_var.wait_for(lk, DUMP_POLL_INTERVAL, [&reg] { return reg.watcher_stopping; })) {
+            if (reg.dump_requested.exchange(false)) {
+                lk.unlock();
+                dump();
+                lk.lock();
+            }
+        }
+    });
+
+    /* Early error exits are where a trace is wanted most. The watcher goes first, it must not be dumping or touching
+     * the registry while static destructors run. */
+    std::atexit([] {
+        auto & reg = registry();
+        {
+            std::lock_guard lk(reg.watcher_mutex);
+            reg.watcher_stopping = true;
+        }
+        reg.watcher_cond_var.notify_all();
+        if (reg.watcher.joinable() && reg.watcher.get_id() != std::this_thread::get_id()) {
+            reg.watcher.join();
+        }
+        dump();
+    });
+
+    s_enabled = true;
+}
+
+int64_t FlightRecorder::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void FlightRecorder::record(TraceEvent event, int64_t arg)
+{
+    record(event, arg, now());
+}
+
+void FlightRecorder::record(TraceEvent event, int64_t arg, int64_t ts_ns)
+{
+    auto & ring = threadRing();
+    const auto head = ring.head.load(std::memory_order_relaxed);
+    auto & entry = ring.entries[head & ring.mask];
+    entry.ts_ns.store(ts_ns, std::memory_order_relaxed);
+    entry.arg.store(arg, std::memory_order_relaxed);
+    entry.event.store(event, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void FlightRecorder::setThreadName(const char * name)
+{
+    pthread_setname_np(pthread_self(), name);
+    if (!enabled()) {
+        return;
+    }
+    auto & ring = threadRing();
+    std::lock_guard lk(registry().mutex);
+    ring.name = name;
+}
+
+bool FlightRecorder::dump()
+{
+    std::string path;
+    {
+        std::lock_guard lk(registry().mutex);
+        path = registry().dump_path;
+    }
+    return dump(path);
+}
+
+bool FlightRecorder::dump(const std::string & path)
+{
+    /* Written aside and renamed into place, so the trace file is always a complete dump */
+    std::lock_guard dump_lk(registry().dump_mutex);
+    const std::string tmp_path = path + ".tmp";
+    std::ofstream os(tmp_path, std::ios::trunc);
+    if (!os) {
+        std::cerr << "Unable to write trace file " << tmp_path << std::endl;
+        return false;
+    }
+    const pid_t pid = getpid();
+    /* Microsecond timestamps with nanosecond resolution */
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&first, &os] {
+        if (!first) {
+            os << ",\n";
+        }
+        first = false;
+    };
+
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    {
+        std::lock_guard lk(registry().mutex);
+        rings = registry().rings;
+        for (const auto & ring : rings) {
+            separator();
+            os << R"({"ph":"M","name":"thread_name","pid":)" << pid << ",\"tid\":" << ring->tid
+               << R"(,"args":{"name":")" << (ring->name.empty() ? "thread" : ring->name) << "\"}}";
+        }
+    }
+
+    size_t num_events = 0;
+    for (const auto & ring : rings) {
+        const auto head = ring->head.load(std::memory_order_acquire);
+        const auto count = std::min<uint64_t>(head, ring->mask + 1);
+        /* The owner keeps writing while we read, entries it overwrote meanwhile may show a newer event. Events are not
+         * in timestamp order across threads, trace viewers sort them. */
+        for (auto i = head - count; i < head; ++i) {
+            const auto & entry = ring->entries[i & ring->mask];
+            const auto ts_ns = entry.ts_ns.load(std::memory_order_relaxed);
+            if (ts_ns == 0) {
+                continue;
+            }
+            separator();
+            writeEvent(os,
+                       pid,
+                       ring->tid,
+                       entry.event.load(std::memory_order_relaxed),
+                       ts_ns,
+                       entry.arg.load(std::memory_order_relaxed));
+            ++num_events;
+        }
+    }
+    os << "\n]}\n";
+    os.close();
+    if (!os || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Unable to write trace file " << path << std::endl;
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    std::cout << "Flight recorder: wrote " << num_events << " events to " << path << std::endl;
+    return true;
+}
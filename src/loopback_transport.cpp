@@ -0,0 +1,291 @@
+#include "loopback_transport.h"
+
+#include "topic_filter.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+int LoopbackBroker::subscribe(LoopbackTransport & client, std::string_view topic_filter, int qos)
+{
+    const auto shared = parseSharedSubscription(topic_filter);
+    if (!isValidTopicFilter(shared ? shared->filter : topic_filter)) {
+        return LoopbackTransport::LOOPBACK_ERR_INVAL;
+    }
+
+    std::unique_lock lk(mutex_);
+    if (!shared) {
+        subscriptions_.push_back({ std::string(topic_filter), &client, qos });
+        return LoopbackTransport::LOOPBACK_SUCCESS;
+    }
+    auto it = std::find_if(shared_groups_.begin(), shared_groups_.end(), [&](const auto & group) {
+        return group->group == shared->group && group->filter == shared->filter;
+    });
+    if (it == shared_groups_.end()) {
+        auto group = std::make_unique<SharedGroup>();
+        group->group = shared->group;
+        group->filter = shared->filter;
+        it = shared_groups_.insert(shared_groups_.end(), std::move(group));
+    }
+    (*it)->members.push_back({ std::string(shared->filter), &client, qos });
+    return LoopbackTransport::LOOPBACK_SUCCESS;
+}
+
+void LoopbackBroker::unsubscribeAll(LoopbackTransport & client)
+{
+    std::unique_lock lk(mutex_);
+    auto is_client = [&client](const Subscription & sub) { return sub.client == &client; };
+    std::erase_if(subscriptions_, is_client);
+    for (auto & group : shared_groups_) {
+        std::erase_if(group->members, is_client);
+    }
+    std::erase_if(shared_groups_, [](const auto & group) { return group->members.empty(); });
+}
+
+size_t LoopbackBroker::route(std::string_view topic,
+                             const void * payload,
+                             size_t payload_len,
+                             int qos,
+                             bool retain,
+                             int mid)
+{
+    TransportMessage msg;
+    msg.topic = topic;
+    msg.payload = payload;
+    msg.payload_len = payload_len;
+    msg.retain = retain;
+
+    /* Delivered once unlocked: callbacks may subscribe, disconnect or publish, which take the lock again */
+    std::vector<std::pair<LoopbackTransport *, int>> targets;
+    {
+        std::shared_lock lk(mutex_);
+        for (const auto & sub : subscriptions_) {
+            if (topicMatchesFilter(sub.filter, topic)) {
+                targets.emplace_back(sub.client, sub.qos);
+            }
+        }
+        for (auto & group : shared_groups_) {
+            if (!topicMatchesFilter(group->filter, topic)) {
+                continue;
+            }
+            const auto index = group->next.fetch_add(1, std::memory_order_relaxed) % group->members.size();
+            targets.emplace_back(group->members[index].client, group->members[index].qos);
+        }
+    }
+    for (const auto & [client, sub_qos] : targets) {
+        msg.qos = std::min(qos, sub_qos);
+        msg.mid = msg.qos > 0 ? mid : 0;
+        client->deliver(msg);
+    }
+    return targets.size();
+}
+
+LoopbackTransport::LoopbackTransport(std::string client_id, LoopbackBroker & broker)
+: client_id_(std::move(client_id))
+, broker_(broker)
+{
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    stopAcks();
+    broker_.unsubscribeAll(*this);
+}
+
+int LoopbackTransport::connect()
+{
+    if (refused_connects_ > 0) {
+        --refused_connects_;
+        return LOOPBACK_ERR_CONN_REFUSED;
+    }
+    if (refused_connacks_ > 0) {
+        --refused_connacks_;
+        refusing_ = true;
+        if (started_) {
+            refuse();
+        }
+        return LOOPBACK_SUCCESS;
+    }
+    connected_ = true;
+    /* Like a network client, the CONNACK is only reported once the loop runs */
+    if (started_) {
+        notifyConnect(0);
+    }
+    return LOOPBACK_SUCCESS;
+}
+
+int LoopbackTransport::disconnect()
+{
+    if (!connected_.exchange(false)) {
+        return LOOPBACK_ERR_NO_CONN;
+    }
+    broker_.unsubscribeAll(*this);
+    notifyDisconnect(0);
+    return LOOPBACK_SUCCESS;
+}
+
+int LoopbackTransport::start()
+{
+    started_ = true;
+    if (ack_delay_.count() > 0 && !ack_thread_.joinable()) {
+        acks_stopping_ = false;
+        ack_thread_ = std::thread([this] { runAcks(); });
+    }
+    if (refusing_) {
+        refuse();
+    } else if (connected_) {
+        notifyConnect(0);
+    }
+    return LOOPBACK_SUCCESS;
+}
+
+void LoopbackTransport::refuse()
+{
+    refusing_ = false;
+    notifyConnect(LOOPBACK_CONNACK_NOT_AUTHORIZED);
+    notifyDisconnect(LOOPBACK_CONNACK_NOT_AUTHORIZED);
+}
+
+void LoopbackTransport::stop()
+{
+    started_ = false;
+    stopAcks();
+}
+
+void LoopbackTransport::runAcks()
+{
+    std::unique_lock lk(ack_mutex_);
+    while (!acks_stopping_) {
+        if (acks_.empty()) {
+            ack_cond_var_.wait(lk);
+            continue;
+        }
+        const auto [due_tp, mid] = acks_.front();
+        if (std::chrono::steady_clock::now() < due_tp) {
+            ack_cond_var_.wait_until(lk, due_tp);
+            continue;
+        }
+        acks_.pop_front();
+        lk.unlock();
+        notifyPublish(mid);
+        lk.lock();
+    }
+}
+
+void LoopbackTransport::stopAcks()
+{
+    {
+        std::lock_guard lk(ack_mutex_);
+        acks_stopping_ = true;
+        acks_.clear();
+    }
+    ack_cond_var_.notify_one();
+    if (ack_thread_.joinable()) {
+        ack_thread_.join();
+    }
+}
+
+int LoopbackTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    if (!connected_) {
+        return LOOPBACK_ERR_NO_CONN;
+    }
+    if (int rc = broker_.subscribe(*this, topic_filter, qos); rc != LOOPBACK_SUCCESS) {
+        return rc;
+    }
+    const int sub_mid = ++next_mid_;
+    if (mid != nullptr) {
+        *mid = sub_mid;
+    }
+    notifySubscribe(sub_mid, 1, &qos);
+    return LOOPBACK_SUCCESS;
+}
+
+int LoopbackTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    if (!connected_) {
+        return LOOPBACK_ERR_NO_CONN;
+    }
+    /* Like a broker, the packet is rejected as a whole when a filter is malformed */
+    for (int i = 0; i < count; ++i) {
+        const auto shared = parseSharedSubscription(topic_filters[i]);
+        if (!isValidTopicFilter(shared ? shared->filter : topic_filters[i])) {
+            return LOOPBACK_ERR_INVAL;
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        broker_.subscribe(*this, topic_filters[i], qos);
+    }
+    const int sub_mid = ++next_mid_;
+    if (mid != nullptr) {
+        *mid = sub_mid;
+    }
+    const std::vector<int> granted_qos(static_cast<size_t>(count), qos);
+    notifySubscribe(sub_mid, count, granted_qos.data());
+    return LOOPBACK_SUCCESS;
+}
+
+int LoopbackTransport::publish(const char * topic,
+                               const void * payload,
+                               size_t payload_len,
+                               int qos,
+                               bool retain,
+                               int * mid)
+{
+    if (!connected_) {
+        return LOOPBACK_ERR_NO_CONN;
+    }
+    if (!isValidTopicName(topic)) {
+        return LOOPBACK_ERR_INVAL;
+    }
+    if (drop_after_ > 0 && ++published_ == drop_after_ && connected_.exchange(false)) {
+        /* Lost rather than disconnected: the subscriptions go with the connection and the reason is an error */
+        broker_.unsubscribeAll(*this);
+        notifyDisconnect(LOOPBACK_ERR_NO_CONN);
+        return LOOPBACK_ERR_NO_CONN;
+    }
+    const int pub_mid = ++next_mid_;
+    if (mid != nullptr) {
+        *mid = pub_mid;
+    }
+    broker_.route(topic, payload, payload_len, qos, retain, pub_mid);
+    if (ack_delay_.count() > 0) {
+        {
+            std::lock_guard lk(ack_mutex_);
+            acks_.emplace_back(std::chrono::steady_clock::now() + ack_delay_, pub_mid);
+        }
+        ack_cond_var_.notify_one();
+        return LOOPBACK_SUCCESS;
+    }
+    notifyPublish(pub_mid);
+    return LOOPBACK_SUCCESS;
+}
+
+const char * LoopbackTransport::errorString(int rc) const
+{
+    switch (rc) {
+        case LOOPBACK_SUCCESS:
+            return "No error.";
+        case LOOPBACK_ERR_NO_CONN:
+            return "The client is not currently connected.";
+        case LOOPBACK_ERR_INVAL:
+            return "Invalid function arguments provided.";
+        case LOOPBACK_ERR_CONN_REFUSED:
+            return "Connection refused.";
+        default:
+            return "Unknown error.";
+    }
+}
+
+const char * LoopbackTransport::connackString(int reason_code) const
+{
+    switch (reason_code) {
+        case 0:
+            return "Connection Accepted.";
+        case LOOPBACK_CONNACK_NOT_AUTHORIZED:
+            return "Connection Refused: not authorised.";
+        default:
+            return "Connection Refused: unknown reason.";
+    }
+}
@@ -0,0 +1,32 @@
+#include "low_latency.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+
+bool pinCurrentThread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+int setBusyPoll(int fd, int usec)
+{
+#if defined(SO_BUSY_POLL)
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+        return errno;
+    }
+    return 0;
+#else
+    (void)fd;
+    (void)usec;
+    return ENOPROTOOPT;
+#endif
+}
@@ -17,16 +17,16 @@
 
 #include "MQTTClient.h"
 #include "MQTTClientPersistence.h"
+#include "chunked_transfer.h"
+#include "periodic_scheduler.h"
 #include "pubsub_opts.h"
 
-#include <inttypes.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <tgmath.h>
-#include <time.h>
 
 #include <unistd.h>
 
@@ -37,20 +37,16 @@
 #endif
 
 volatile int ToStop = 0;
+/* Paces the publish loop, cancelled by cfinish() */
+struct PeriodicScheduler * Schedule = NULL;
 
 void cfinish(int sig)
 {
     signal(SIGINT, NULL);
     ToStop = 1;
-}
-
-int64_t getMicroseconds()
-{
-    struct timespec tms;
-    if (!timespec_get(&tms, TIME_UTC)) {
-        return -1;
+    if (Schedule) {
+        periodicSchedulerCancel(Schedule);
     }
-    return tms.tv_sec * 1000000 + llround(tms.tv_nsec / 1000.0);
 }
 
 char * getEnvVar(char * var_name, char * default_value)
@@ -99,7 +95,10 @@ struct PubSubOpts opts = { 1,
                            NULL,
                            NULL, /* HTTP and HTTPS proxies */
                            3.f, /* send a message every 3 seconds */
-                           0 /* send messages until stopped */ };
+                           0, /* send messages until stopped */
+                           PERIODIC_CATCH_UP,
+                           0,
+                           16 /* chunked file transfer */ };
 
 int mqttConnect(MQTTClient client)
 {
@@ -201,6 +200,86 @@ void traceCallback(enum MQTTCLIENT_TRACE_LEVELS level, char * message)
     (void)fprintf(stderr, "Trace : %d, %s\n", level, message);
 }
 
+/* How long to wait for a chunk to be acknowledged */
+#define CHUNK_ACK_TIMEOUT_MS 30000
+
+/* Streams opts.filename in chunks of opts.chunk_size, waiting for the oldest chunk to be acknowledged once
+ * opts.max_in_flight are outstanding, so only one chunk is in memory whatever the file size. */
+int publishFileChunked(MQTTClient client, MQTTProperties * pub_props)
+{
+    const uint32_t transfer_id = chunkTransferIdNew();
+    struct ChunkedFileReader * reader = chunkedFileReaderOpen(opts.filename, (uint32_t)opts.chunk_size, transfer_id);
+    if (reader == NULL) {
+        if (!opts.quiet) {
+            (void)fprintf(stderr, "Can't read file %s: %s\n", opts.filename, strerror(errno));
+        }
+        return MQTTCLIENT_FAILURE;
+    }
+    const uint32_t chunk_count = chunkedFileReaderChunkCount(reader);
+    const uint32_t max_in_flight = (uint32_t)(opts.max_in_flight > 0 ? opts.max_in_flight : 1);
+    unsigned char * buffer = malloc(chunkedFileReaderMessageSize(reader));
+    /* Tokens of the chunks in flight, chunk `seq` uses slot seq % max_in_flight */
+    MQTTClient_deliveryToken * tokens = calloc(max_in_flight, sizeof(*tokens));
+    int rc = buffer != NULL && tokens != NULL ? MQTTCLIENT_SUCCESS : MQTTCLIENT_FAILURE;
+
+    if (opts.verbose) {
+        printf("Sending %s (%llu bytes) as transfer %08x in %u chunks\n",
+               opts.filename,
+               (unsigned long long)chunkedFileReaderFileSize(reader),
+               transfer_id,
+               chunk_count);
+    }
+    uint32_t seq = 0;
+    for (; rc == MQTTCLIENT_SUCCESS && seq < chunk_count && !ToStop; ++seq) {
+        MQTTClient_deliveryToken * token = &tokens[seq % max_in_flight];
+        if (seq >= max_in_flight) {
+            rc = MQTTClient_waitForCompletion(client, *token, CHUNK_ACK_TIMEOUT_MS);
+            if (rc != MQTTCLIENT_SUCCESS) {
+                break;
+            }
+        }
+        const long len = chunkedFileReaderRead(reader, seq, buffer);
+        if (len < 0) {
+            if (!opts.quiet) {
+                (void)fprintf(stderr, "Can't read file %s: %s\n", opts.filename, strerror(errno));
+            }
+            rc = MQTTCLIENT_FAILURE;
+            break;
+        }
+        /* Chunks are never retained, a retained message would only keep the last one */
+        if (opts.mqtt_version == MQTTVERSION_5) {
+            MQTTResponse response = MQTTResponse_initializer;
+            response = MQTTClient_publish5(client, opts.topic, (int)len, buffer, opts.qos, 0, pub_props, token);
+            rc = response.reasonCode;
+        } else {
+            rc = MQTTClient_publish(client, opts.topic, (int)len, buffer, opts.qos, 0, token);
+        }
+    }
+    /* Waits for the tail still in flight */
+    for (uint32_t i = 0; rc == MQTTCLIENT_SUCCESS && i < max_in_flight && i < seq; ++i) {
+        rc = MQTTClient_waitForCompletion(client, tokens[i], CHUNK_ACK_TIMEOUT_MS);
+    }
+    if (rc == MQTTCLIENT_SUCCESS && seq < chunk_count) {
+        /* Interrupted, the file didn't make it either */
+        rc = MQTTCLIENT_FAILURE;
+    }
+    if (rc != MQTTCLIENT_SUCCESS && !opts.quiet) {
+        (void)fprintf(stderr,
+                      "Transfer %08x stopped after %u of %u chunks: %s\n",
+                      transfer_id,
+                      seq,
+                      chunk_count,
+                      MQTTClient_strerror(rc));
+    } else if (!opts.quiet) {
+        printf("Transfer %08x: sent %u chunks\n", transfer_id, seq);
+    }
+
+    free(tokens);
+    free(buffer);
+    chunkedFileReaderClose(reader);
+    return rc;
+}
+
 void initializeOptionsFromEnvironmentVars()
 {
     opts.username = getEnvVar("IO_USER", NULL);
@@ -239,6 +318,7 @@ int main(int argc, char ** argv)
     char * url;
     const char * version = NULL;
     int num_messages_sent = 0;
+    int exit_code = EXIT_SUCCESS;
 #if !defined(_WIN32)
     struct sigaction sa;
 #endif
@@ -309,7 +389,21 @@ int main(int argc, char ** argv)
         addUserProperties(&pub_props);
     }
 
-    double start_us = getMicroseconds();
+    if (opts.filename && opts.chunk_size > 0) {
+        /* Scripts must be able to tell an incomplete transfer */
+        if (publishFileChunked(client, &pub_props) != MQTTCLIENT_SUCCESS) {
+            exit_code = EXIT_FAILURE;
+        }
+        goto exit;
+    }
+
+    Schedule = periodicSchedulerCreate((int64_t)(opts.message_interval_sec * 1e9), opts.overrun_policy, 0);
+    if (Schedule == NULL) {
+        if (!opts.quiet) {
+            (void)fprintf(stderr, "Invalid message interval %f\n", opts.message_interval_sec);
+        }
+        goto exit;
+    }
 
     while (!ToStop) {
         int data_len = 0;
@@ -366,11 +460,12 @@ int main(int argc, char ** argv)
             break;
         }
 
-        int64_t elapsed_us = getMicroseconds() - start_us;
-        int64_t to_sleep_us = opts.message_interval_sec * 1000000.0 * num_messages_sent - elapsed_us;
-        if (to_sleep_us >= 0) {
-            (void)fprintf(stdout, "Sleeping for %" PRId64 " us ...\n", to_sleep_us);
-            usleep(to_sleep_us);
+        int skipped = periodicSchedulerWait(Schedule);
+        if (skipped < 0) {
+            break;
+        }
+        if (skipped > 0 && opts.verbose) {
+            (void)fprintf(stderr, "Overran the message interval, skipped %d messages\n", skipped);
         }
 
         if (rc != 0) {
@@ -400,8 +495,16 @@ int main(int argc, char ** argv)
 
 exit:
     free(buffer);
+    if (Schedule) {
+        struct PeriodicScheduler * schedule = Schedule;
+        Schedule = NULL;
+        if (!opts.quiet) {
+            periodicSchedulerPrintStats(schedule, stdout, program_name);
+        }
+        periodicSchedulerDestroy(schedule);
+    }
 
     mqttDisconnect(&client);
 
-    return EXIT_SUCCESS;
+    return exit_code;
 }
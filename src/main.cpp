@@ -2,10 +2,40 @@
  Sample application that publish MQTT messages on a timer loop and subscribes for messages on a separate topic
  */
 
-#include <mosquitto.h>
+#include "async_flows.h"
+#include "bulk_subscription.h"
+#include "consumer_group.h"
+#include "file_transfer.h"
+#include "flight_recorder.h"
+#include "loopback_transport.h"
+#include "low_latency.h"
+#include "message_filter.h"
+#include "message_pool.h"
+#include "mosquitto_transport.h"
+#if defined(MQTT_HAVE_PAHO)
+#include "paho_transport.h"
+#endif
+#include "periodic_scheduler.h"
+#include "pipeline.h"
+#include "priority_transport.h"
+#include "probes.h"
+#include "publish_batcher.h"
+#include "queued_transport.h"
+#include "reconnect_manager.h"
+#include "sharded_transport.h"
+#include "shm_ring.h"
+#include "transport.h"
+#include "transport_benchmark.h"
+#include "typed_topic.h"
+#include "window_aggregator.h"
+#include "worker_pool.h"
+
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <condition_variable>
 #include <csignal>
@@ -15,53 +45,118 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 std::atomic_bool StopPublisherLoop = false;
-std::atomic_bool IsSubscribed = false;
-std::condition_variable OnStoppingCondVar;
+/* Set at shutdown, received messages are ignored from then on */
+std::atomic_bool StopConsuming = false;
+/* Paces the publisher, cancelled on SIGINT/SIGTERM */
+std::atomic<PeriodicScheduler *> PublisherSchedule = nullptr;
 std::condition_variable OnSubscribedCondVar;
+/* When set, received messages are processed on these workers instead of the network thread */
+std::unique_ptr<WorkerPool> MessageWorkers;
+/* When set, numeric payloads feed per-topic window statistics */
+std::unique_ptr<WindowAggregator> Analytics;
+/* When set, received messages also run through the pipeline, whose results are published in batches */
+std::unique_ptr<PublishBatcher> PipelineOutput;
+std::unique_ptr<Pipeline> MessagePipeline;
+/* When set, the members subscribe to the filters of IO_SUBSCRIBE_FILE in batches instead of to the consume topic */
+std::unique_ptr<BulkSubscription> BulkSubscriber;
+/* When set, chunked file transfers received on the consume topic are reassembled to files instead of handled */
+std::unique_ptr<ChunkReassembler> FileReceiver;
+/* When set, received messages these filters reject are dropped before anything else is done with them */
+std::unique_ptr<MessageFilters> InboundFilters;
+/* When set, every received message is also written to this shared-memory ring for local readers, see shm_ring.h */
+std::unique_ptr<ShmRingWriter, decltype(&shmRingWriterDestroy)> SharedRing(nullptr, shmRingWriterDestroy);
+/* Benchmark mode skips per-message console output and reports throughput at exit */
+bool BenchmarkMode = false;
+/* Brokers to connect to, from IO_BROKERS or else IO_HOST:IO_PORT. With several, topics are sharded or fanned out. */
+std::vector<BrokerAddress> Brokers;
+ShardedTransport::Mode BrokerMode = ShardedTransport::Mode::SHARD;
+/* SUBSCRIBE packet limits, for bulk subscriptions and for renewing subscriptions on a reconnected broker */
+SubscribeBatchLimits SubscribeLimits;
+/* When set, publishes on the app's connections go through a bounded queue, see queued_transport.h */
+std::optional<OutgoingQueueOptions> OutgoingQueue;
+/* When set, the publishing connection sends through priority lanes, see priority_transport.h. Received messages of the
+ * first lane are handled right away instead of queueing behind the workers' backlog. */
+std::optional<PriorityLaneOptions> PriorityLanes;
+/* When set, broker connections are made and recovered with backoff and jitter, see reconnect_manager.h */
+std::unique_ptr<ReconnectManager> Reconnects;
+/* Opt-in pinning, spinning and busy polling, see low_latency.h */
+LowLatencyOptions LowLatency;
+/* How long loopback connections hold back publish completions, standing in for a broker's round trip */
+std::chrono::milliseconds LoopbackAckDelay{ 0 };
+/* Connects each loopback connection fails or refuses in the CONNACK, and after how many publishes it loses its
+ * connection (0 never), to exercise recovery */
+int LoopbackRefusedConnects = 0;
+int LoopbackRefusedConnacks = 0;
+int LoopbackDropAfter = 0;
 
-void printMosquittoError(int rc, const char * error_prefix = nullptr)
+void printTransportError(const Transport & transport, int rc, const char * error_prefix = nullptr)
 {
     if (!error_prefix) {
         error_prefix = "Error";
     }
-    std::cerr << error_prefix << ": " << (rc != 0 ? mosquitto_strerror(rc) : "") << std::endl;
+    std::cerr << error_prefix << ": " << (rc != 0 ? transport.errorString(rc) : "") << std::endl;
 }
 
 /* Callback called when the client receives a CONNACK message from the broker. */
-void onConnect(struct mosquitto * mosq, void * user_data, int reason_code)
+void onConnect(Transport & transport, ConsumerMember & member, int reason_code)
 {
-    /* Print out the connection result. mosquitto_connack_string() produces an
-     * appropriate string for MQTT v3.x clients, the equivalent for MQTT v5.0
-     * clients is mosquitto_reason_string(). */
-    printf("on_connect: %s\n", mosquitto_connack_string(reason_code));
+    /* Print out the connection result. */
+    printf("on_connect: %s\n", transport.connackString(reason_code));
+    MQTT_PROBE1(connect, reason_code);
+    traceEvent(member.connected_once.exchange(true) ? TraceEvent::RECONNECTED : TraceEvent::CONNECTED, reason_code);
     if (reason_code != 0) {
-        /* If the connection fails for any reason, we don't want to keep on
-         * retrying in this example, so disconnect. Without this, the client
-         * will attempt to reconnect. */
+        /* Refused: there is nothing to subscribe on. The reconnect manager, or else the client library, tries again. */
         std::cerr << "Unable to connect: reason_code=" << reason_code << std::endl;
-        mosquitto_disconnect(mosq);
+        return;
     }
 
     /* Making subscriptions in the on_connect() callback means that if the
      * connection drops and is automatically resumed by the client, then the
      * subscriptions will be recreated when the client reconnects. */
-    const char * consume_topic = static_cast<const char *>(user_data);
-
-    int rc = mosquitto_subscribe(mosq, nullptr, consume_topic, 1);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        printMosquittoError(rc, "Error subscribing");
+    int rc = BulkSubscriber ? BulkSubscriber->subscribe(transport, member.index, 1)
+                            : transport.subscribe(member.subscribe_topic.c_str(), 1, nullptr);
+    if (rc != 0) {
+        printTransportError(transport, rc, "Error subscribing");
         /* We might as well disconnect if we were unable to subscribe */
-        mosquitto_disconnect(mosq);
+        transport.disconnect();
+    }
+}
+
+/* Counts a SUBACK of the bulk subscription, the member is subscribed once all its batches are acknowledged. */
+void onBulkSubscribe(Transport & transport, ConsumerMember & member, int qos_count, const int * granted_qos)
+{
+    const auto progress = BulkSubscriber->onSubAck(member.index, qos_count, granted_qos);
+    if (progress == BulkSubscription::Progress::PENDING) {
+        return;
     }
+    BulkSubscriber->printConnectionReport(std::cout, member.index);
+    if (progress == BulkSubscription::Progress::ALL_DONE) {
+        BulkSubscriber->printReport(std::cout);
+    }
+    const bool have_subscription = BulkSubscriber->grantedCount(member.index) > 0;
+    if (!have_subscription) {
+        printTransportError(transport, 0, "Error: All subscriptions rejected.");
+        transport.disconnect();
+    }
+    member.subscribed = have_subscription;
+    OnSubscribedCondVar.notify_all();
 }
 
 /* Callback called when the broker sends a SUBACK in response to a SUBSCRIBE. */
-void onSubscribe(struct mosquitto * mosq, void * user_data, int /*mid*/, int qos_count, const int * granted_qos)
+void onSubscribe(Transport & transport, ConsumerMember & member, int qos_count, const int * granted_qos)
 {
+    if (BulkSubscriber) {
+        onBulkSubscribe(transport, member, qos_count, granted_qos);
+        return;
+    }
     /* In this example we only subscribe to a single topic at once, but a
      * SUBSCRIBE can contain many topics at once, so this is one way to check
      * them all. */
@@ -75,25 +170,99 @@ void onSubscribe(struct mosquitto * mosq, void * user_data, int /*mid*/, int qos
     if (!have_subscription) {
         /* The broker rejected all of our subscriptions, we know we only sent
          * the one SUBSCRIBE, so there is no point remaining connected. */
-        printMosquittoError(0, "Error: All subscriptions rejected.");
-        mosquitto_disconnect(mosq);
+        printTransportError(transport, 0, "Error: All subscriptions rejected.");
+        transport.disconnect();
     } else {
-        const char * consume_topic = static_cast<const char *>(user_data);
-        std::cout << "Subscribed successfully to topic " << consume_topic << std::endl;
+        std::cout << "Subscribed successfully to topic " << member.subscribe_topic << std::endl;
     }
-    IsSubscribed = have_subscription;
+    member.subscribed = have_subscription;
     OnSubscribedCondVar.notify_all();
 }
 
+/* Processes a message once it has been copied out of the transport callback. */
+void handleMessage(const ReceivedMessage & msg)
+{
+    traceEvent(TraceEvent::HANDLER_BEGIN, static_cast<int64_t>(msg.payload_len));
+    if (!BenchmarkMode) {
+        /* This blindly prints the payload, but the payload can be anything so take care. Written by length, so
+         * neither needs to be NUL-terminated and embedded NULs don't cut it short. The lock keeps the line whole when
+         * workers print concurrently. */
+        flockfile(stdout);
+        (void)fwrite(msg.topic_buffer.data(), 1, msg.topic_len, stdout);
+        (void)fprintf(stdout, " %d ", msg.qos);
+        (void)fwrite(msg.payload(), 1, msg.payload_len, stdout);
+        (void)fputc('\n', stdout);
+        funlockfile(stdout);
+    }
+    if (Analytics) {
+        Analytics->add(msg.topic(), std::string_view(msg.payload(), msg.payload_len));
+    }
+    if (MessagePipeline) {
+        MessagePipeline->process(msg.topic(), std::string_view(msg.payload(), msg.payload_len));
+    }
+    traceEvent(TraceEvent::HANDLER_END);
+}
+
+/* Handles a message received by `member`, unless shutdown stopped consuming */
+void consumeMessage(ConsumerMember & member, const TransportMessage & msg)
+{
+    member.recordMessage(msg.payload_len);
+    traceEvent(TraceEvent::MESSAGE_RECEIVED, static_cast<int64_t>(msg.payload_len));
+    MQTT_PROBE5(message, msg.topic.data(), msg.topic.size(), msg.payload_len, msg.qos, msg.mid);
+    if (InboundFilters) {
+        const std::string_view payload(static_cast<const char *>(msg.payload), msg.payload_len);
+        if (!InboundFilters->accept({ msg.topic, payload, msg.qos, msg.retain })) {
+            return;
+        }
+    }
+    if (SharedRing) {
+        /* Straight from the transport's buffer, whichever way the message is handled below. Readers too far behind
+         * miss it, which the ring counts. */
+        shmRingWrite(
+            SharedRing.get(), msg.topic.data(), msg.topic.size(), msg.payload, msg.payload_len, msg.qos, msg.retain);
+    }
+    if (FileReceiver && FileReceiver->handle(msg)) {
+        return;
+    }
+
+    /* The transport owns `msg` only for the duration of this callback, so copy it into pooled buffers rather than
+     * mallocing topic and payload for every message. */
+    auto received = makeReceivedMessage(msg.topic, msg.payload, msg.payload_len, msg.qos, msg.retain, msg.mid);
+    if (MessageWorkers && PriorityLanes && PriorityLanes->lanes.size() > 1 && PriorityLanes->laneFor(msg.topic) == 0) {
+        /* A topic always maps to the same lane, so this doesn't reorder any topic's messages */
+        handleMessage(received);
+    } else if (MessageWorkers) {
+        MessageWorkers->submit(std::move(received));
+    } else {
+        handleMessage(received);
+    }
+}
+
 /* Callback called when the client receives a message. */
-void onMessage(struct mosquitto * /*mosq*/, void * /*user_data*/, const struct mosquitto_message * msg)
+void onMessage(ConsumerMember & member, const TransportMessage & msg)
+{
+    member.in_callback.fetch_add(1);
+    if (!StopConsuming.load()) {
+        consumeMessage(member, msg);
+    }
+    member.in_callback.fetch_sub(1);
+}
+
+/* Stops handling received messages and waits for the callbacks under way, the connections stay up */
+void stopConsuming(ConsumerGroup & consumers)
 {
-    /* This blindly prints the payload, but the payload can be anything so take care. */
-    printf("%s %d %s\n", msg->topic, msg->qos, static_cast<char *>(msg->payload));
+    StopConsuming = true;
+    for (size_t i = 0; i < consumers.size(); ++i) {
+        while (consumers.member(i).in_callback.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
 }
 
-void onDisconnect(struct mosquitto * /*mosq*/, void * /*user_data*/, int reason_code)
+void onDisconnect(int reason_code)
 {
+    traceEvent(TraceEvent::DISCONNECTED, reason_code);
+    MQTT_PROBE1(disconnect, reason_code);
     std::cout << "Disconnected: reason_code=" << reason_code << std::endl;
 }
 
@@ -110,29 +279,236 @@ int getTemperature()
     return random() % 100;
 }
 
-/* This function pretends to read some data from a sensor and publish it.*/
-void publishSensorData(struct mosquitto * mosq, const char * topic_name)
+/* Readings are plain integers, sent to IO_PUBLISH_TOPIC which is only known at runtime */
+using TemperatureCodec = PayloadCodec<int>;
+
+/* This function pretends to read some data from a sensor and publish it. `topic_len` is strlen(topic_name), worked out
+ * once by the caller for the probe. */
+void publishSensorData(Transport & transport, const char * topic_name, [[maybe_unused]] size_t topic_len)
 {
-    /* NOLINTNEXTLINE(hicpp-avoid-c-arrays,modernize-avoid-c-arrays,cppcoreguidelines-avoid-c-arrays) */
-    char payload[20];
+    std::array<char, TemperatureCodec::MAX_SIZE> buffer;
 
     /* Get our pretend data */
-    int temp = getTemperature();
-    snprintf(payload, sizeof(payload), "%d", temp); // NOLINT(cert-err33-c)
+    const std::string_view payload(buffer.data(), TemperatureCodec::encode(getTemperature(), buffer.data()));
 
-    std::cout << "Publishing message: " << payload << std::endl;
-    int rc = mosquitto_publish(mosq, nullptr, topic_name, strlen(payload), payload, 0, false);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        printMosquittoError(rc, "Error publishing");
+    if (!BenchmarkMode) {
+        std::cout << "Publishing message: " << payload << std::endl;
+    }
+    /* The mid is only known once publish() returns, by which time the network thread may already have reported the
+     * message as sent, so take the timestamp up front */
+    const int64_t enqueue_ts = FlightRecorder::enabled() ? FlightRecorder::now() : 0;
+    MQTT_PROBE0(publish_begin);
+    int mid = 0;
+    int rc = transport.publish(topic_name, payload.data(), payload.size(), 0, false, &mid);
+    if (rc != 0) {
+        printTransportError(transport, rc, "Error publishing");
+        return;
+    }
+    MQTT_PROBE6(publish, topic_name, topic_len, payload.size(), 0, mid, transport.id());
+    if (enqueue_ts != 0) {
+        FlightRecorder::record(TraceEvent::PUBLISH_ENQUEUED, publishSpan(transport.id(), mid), enqueue_ts);
     }
 }
 
+#if defined(MQTT_HAVE_PAHO)
+constexpr const char * TRANSPORT_KINDS = "mosquitto, paho or loopback";
+#else
+constexpr const char * TRANSPORT_KINDS = "mosquitto or loopback";
+#endif
+
+bool isTransportKind(std::string_view kind)
+{
+#if defined(MQTT_HAVE_PAHO)
+    if (kind == "paho") {
+        return true;
+    }
+#endif
+    return kind == "mosquitto" || kind == "loopback";
+}
+
+/* Creates a transport of the given kind to a single broker without any callbacks. */
+std::unique_ptr<Transport> makeBrokerTransport(std::string_view kind,
+                                               const std::string & client_id,
+                                               const ConnectionSettings & settings,
+                                               LoopbackBroker & loopback_broker)
+{
+    std::unique_ptr<Transport> transport;
+    if (kind == "loopback") {
+        auto loopback = std::make_unique<LoopbackTransport>(client_id, loopback_broker);
+        loopback->setAckDelay(LoopbackAckDelay);
+        loopback->setRefusedConnects(LoopbackRefusedConnects);
+        loopback->setRefusedConnacks(LoopbackRefusedConnacks);
+        loopback->setDropAfter(LoopbackDropAfter);
+        transport = std::move(loopback);
+    }
+#if defined(MQTT_HAVE_PAHO)
+    if (kind == "paho") {
+        auto paho = std::make_unique<PahoTransport>(client_id, settings);
+        if (!paho->valid()) {
+            (void)fprintf(stderr, "Error: Unable to create the Paho client.\n");
+            return nullptr;
+        }
+        transport = std::move(paho);
+    }
+#endif
+    if (!transport) {
+        auto mosquitto = std::make_unique<MosquittoTransport>(client_id, settings);
+        if (!mosquitto->valid()) {
+            (void)fprintf(stderr, "Error: Out of memory.\n");
+            return nullptr;
+        }
+        mosquitto->setLowLatency(LowLatency);
+        transport = std::move(mosquitto);
+    }
+    /* Each broker connection recovers on its own */
+    return Reconnects ? Reconnects->manage(std::move(transport)) : std::move(transport);
+}
+
+/* Creates a transport without any callbacks, spread over all Brokers when there are several. `loopback_brokers` has
+ * one in-process broker per entry of Brokers. */
+std::unique_ptr<Transport> makeTransport(std::string_view kind,
+                                         const std::string & client_id,
+                                         const ConnectionSettings & settings,
+                                         std::vector<std::unique_ptr<LoopbackBroker>> & loopback_brokers)
+{
+    if (Brokers.size() == 1) {
+        return makeBrokerTransport(kind, client_id, settings, *loopback_brokers.front());
+    }
+    auto transport = std::make_unique<ShardedTransport>(client_id, BrokerMode);
+    transport->setSubscribeBatchLimits(SubscribeLimits);
+    for (size_t i = 0; i < Brokers.size(); ++i) {
+        ConnectionSettings broker_settings = settings;
+        broker_settings.host = Brokers[i].host.c_str();
+        broker_settings.port = Brokers[i].port;
+        auto shard = makeBrokerTransport(
+            kind, client_id + "-" + std::to_string(i), broker_settings, *loopback_brokers[i]);
+        if (!shard) {
+            return nullptr;
+        }
+        transport->addShard(Brokers[i], std::move(shard));
+    }
+    return transport;
+}
+
+/* Creates the transport for `member` with the app callbacks bound to it. Only the `publisher` one sends through the
+ * priority lanes. */
+std::unique_ptr<Transport> createTransport(std::string_view kind,
+                                           ConsumerMember & member,
+                                           const ConnectionSettings & settings,
+                                           std::vector<std::unique_ptr<LoopbackBroker>> & loopback_brokers,
+                                           bool publisher)
+{
+    auto transport = makeTransport(kind, member.client_id, settings, loopback_brokers);
+    if (!transport) {
+        return nullptr;
+    }
+    if (publisher && PriorityLanes) {
+        auto priority = std::make_unique<PriorityTransport>(std::move(transport), *PriorityLanes);
+        for (size_t i = 0; i < PriorityLanes->lanes.size(); ++i) {
+            const auto & lane = PriorityLanes->lanes[i];
+            if (!lane.own_connection) {
+                continue;
+            }
+            auto lane_transport = makeTransport(kind, member.client_id + "-" + lane.name, settings, loopback_brokers);
+            if (!lane_transport) {
+                return nullptr;
+            }
+            priority->setLaneConnection(i, std::move(lane_transport));
+        }
+        transport = std::move(priority);
+    } else if (OutgoingQueue) {
+        transport = std::make_unique<QueuedTransport>(std::move(transport), *OutgoingQueue);
+    }
+
+    /* Configure callbacks. This should be done before connecting ideally. */
+    transport->setConnectCallback([&member](Transport & t, int reason_code) { onConnect(t, member, reason_code); });
+    transport->setSubscribeCallback([&member](Transport & t, int /*mid*/, int qos_count, const int * granted_qos) {
+        onSubscribe(t, member, qos_count, granted_qos);
+    });
+    transport->setMessageCallback([&member](Transport &, const TransportMessage & msg) { onMessage(member, msg); });
+    transport->setDisconnectCallback([](Transport &, int reason_code) { onDisconnect(reason_code); });
+    transport->setPublishCallback([](Transport & t, int mid) {
+        traceEvent(TraceEvent::PUBLISH_DONE, publishSpan(t.id(), mid));
+        MQTT_PROBE2(publish_done, mid, t.id());
+    });
+    return transport;
+}
+
+/* Connects to the brokers and starts the network loop. */
+bool startTransport(Transport & transport)
+{
+    std::cout << "Connecting " << transport.clientId() << " to ";
+    for (size_t i = 0; i < Brokers.size(); ++i) {
+        std::cout << (i > 0 ? "," : "") << Brokers[i].label();
+    }
+    std::cout << " (" << transport.name() << ") ..." << std::endl;
+    int rc = transport.connect();
+    if (rc != 0) {
+        printTransportError(transport, rc, "Failed to connect");
+        return false;
+    }
+
+    rc = transport.start();
+    if (rc != 0) {
+        printTransportError(transport, rc, "Failed to start loop");
+        return false;
+    }
+    return true;
+}
+
+/* Publishes `num_messages_to_send` readings (forever when <= 0), one per tick of `schedule`, returns the count sent. */
+int runPublisherLoop(Transport & transport, const char * topic, int num_messages_to_send, PeriodicScheduler & schedule)
+{
+    int num_messages = 0;
+    const size_t topic_len = strlen(topic);
+    while ((num_messages_to_send <= 0 || num_messages < num_messages_to_send) && !StopPublisherLoop) {
+        if (periodicSchedulerWait(&schedule) < 0) {
+            break;
+        }
+        publishSensorData(transport, topic, topic_len);
+        ++num_messages;
+    }
+    return num_messages;
+}
+
+/* Runs the same benchmark workload through a fresh transport of each kind in turn, returns the exit code. */
+int runTransportBenchmarks(const std::vector<std::string_view> & kinds,
+                           const std::string & client_id,
+                           const ConnectionSettings & settings,
+                           const TransportBenchmarkOptions & options)
+{
+    std::vector<TransportBenchmarkReport> reports;
+    for (auto kind : kinds) {
+        if (StopPublisherLoop) {
+            break;
+        }
+        std::vector<std::unique_ptr<LoopbackBroker>> loopback_brokers;
+        for (size_t i = 0; i < Brokers.size(); ++i) {
+            loopback_brokers.push_back(std::make_unique<LoopbackBroker>());
+        }
+        auto transport = makeTransport(kind, client_id + "-bench-" + std::string(kind), settings, loopback_brokers);
+        if (!transport) {
+            return 1;
+        }
+        reports.push_back(runTransportBenchmark(*transport, options, StopPublisherLoop));
+    }
+    /* Side by side once all have run */
+    for (const auto & report : reports) {
+        report.print(std::cout);
+    }
+    const bool all_ran = std::all_of(
+        reports.begin(), reports.end(), [](const TransportBenchmarkReport & report) { return report.error.empty(); });
+    return all_ran ? 0 : 1;
+}
+
 void setupSigintHandler(struct sigaction * sa)
 {
     /* NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access) */
     sa->sa_handler = [](int /*sig*/) {
         StopPublisherLoop = true;
-        OnStoppingCondVar.notify_all();
+        if (auto * schedule = PublisherSchedule.load()) {
+            periodicSchedulerCancel(schedule);
+        }
     };
     sa->sa_flags = 0;
     sigaction(SIGINT, sa, nullptr);
@@ -151,103 +527,510 @@ int main(int argc, char * argv[])
     const auto * consume_topic = getEnvVarOrDefault("IO_CONSUME_TOPIC", "consume_feed");
     const int num_messages_to_send = std::stoi(getEnvVarOrDefault("IO_MESSAGE_COUNT", "1"));
     const float message_period_sec = std::stof(getEnvVarOrDefault("IO_MESSAGE_PERIOD_SECONDS", "3.0"));
+    const int num_worker_threads = std::stoi(getEnvVarOrDefault("IO_WORKER_THREADS", "0"));
+    const auto * ordering_key = getEnvVarOrDefault("IO_ORDERING_KEY", "topic");
+    const auto * consumer_group = getEnvVarOrDefault("IO_CONSUMER_GROUP", "");
+    const int num_consumers = std::stoi(getEnvVarOrDefault("IO_CONSUMER_COUNT", "1"));
+    const float stats_interval_sec = std::stof(getEnvVarOrDefault("IO_STATS_INTERVAL_SECONDS", "5.0"));
+    const std::string_view transport_kind = getEnvVarOrDefault("IO_TRANSPORT", "mosquitto");
+    LoopbackAckDelay = std::chrono::milliseconds(std::stoi(getEnvVarOrDefault("IO_LOOPBACK_ACK_DELAY_MS", "0")));
+    LoopbackRefusedConnects = std::stoi(getEnvVarOrDefault("IO_LOOPBACK_REFUSED_CONNECTS", "0"));
+    LoopbackRefusedConnacks = std::stoi(getEnvVarOrDefault("IO_LOOPBACK_REFUSED_CONNACKS", "0"));
+    LoopbackDropAfter = std::stoi(getEnvVarOrDefault("IO_LOOPBACK_DROP_AFTER", "0"));
+    const auto * brokers_spec = getEnvVarOrDefault("IO_BROKERS", "");
+    const std::string_view broker_mode = getEnvVarOrDefault("IO_BROKER_MODE", "shard");
+    BenchmarkMode = std::stoi(getEnvVarOrDefault("IO_BENCHMARK", "0")) != 0;
+    const int num_async_flows = std::stoi(getEnvVarOrDefault("IO_ASYNC_FLOWS", "0"));
+    const bool verify_async_flows = std::stoi(getEnvVarOrDefault("IO_ASYNC_FLOWS_VERIFY", "0")) != 0;
+    const float analytics_window_sec = std::stof(getEnvVarOrDefault("IO_ANALYTICS_WINDOW_SECONDS", "0"));
+    const float analytics_slide_sec =
+        std::stof(getEnvVarOrDefault("IO_ANALYTICS_SLIDE_SECONDS", std::to_string(analytics_window_sec).c_str()));
+    const auto * analytics_prefix = getEnvVarOrDefault("IO_ANALYTICS_TOPIC_PREFIX", "analytics");
+    const auto * analytics_field = getEnvVarOrDefault("IO_ANALYTICS_FIELD", "");
+    const auto * pipeline_spec = getEnvVarOrDefault("IO_PIPELINE", "");
+    const int pipeline_batch_size = std::stoi(getEnvVarOrDefault("IO_PIPELINE_BATCH_SIZE", "64"));
+    const float pipeline_linger_ms = std::stof(getEnvVarOrDefault("IO_PIPELINE_LINGER_MS", "5"));
+    const int pipeline_max_pending = std::stoi(getEnvVarOrDefault("IO_PIPELINE_MAX_PENDING", "65536"));
+    const auto * trace_file = getEnvVarOrDefault("IO_TRACE_FILE", "");
+    const int trace_events_per_thread = std::stoi(getEnvVarOrDefault("IO_TRACE_EVENTS_PER_THREAD", "65536"));
+    LowLatency.enabled = std::stoi(getEnvVarOrDefault("IO_LOW_LATENCY", "0")) != 0;
+    LowLatency.network_cpu = std::stoi(getEnvVarOrDefault("IO_NETWORK_CPU", "-1"));
+    LowLatency.publisher_cpu = std::stoi(getEnvVarOrDefault("IO_PUBLISHER_CPU", "-1"));
+    LowLatency.spin = std::chrono::microseconds(std::stoi(getEnvVarOrDefault("IO_SPIN_MICROSECONDS", "50")));
+    LowLatency.busy_poll_us =
+        std::stoi(getEnvVarOrDefault("IO_BUSY_POLL_MICROSECONDS", LowLatency.enabled ? "50" : "0"));
+    const bool jitter_report =
+        std::stoi(getEnvVarOrDefault("IO_JITTER_REPORT", LowLatency.enabled ? "1" : "0")) != 0;
+    const auto * overrun_policy_name = getEnvVarOrDefault("IO_OVERRUN_POLICY", "catch-up");
+    const std::string_view benchmark_transports = getEnvVarOrDefault("IO_BENCHMARK_TRANSPORTS", "");
+    const float benchmark_rate = std::stof(getEnvVarOrDefault("IO_BENCHMARK_RATE", "0"));
+    const int benchmark_messages = std::stoi(getEnvVarOrDefault("IO_BENCHMARK_MESSAGES", "10000"));
+    const int payload_size = std::stoi(getEnvVarOrDefault("IO_PAYLOAD_SIZE", "64"));
+    const int qos = std::stoi(getEnvVarOrDefault("IO_QOS", "0"));
+    const auto * send_file = getEnvVarOrDefault("IO_SEND_FILE", "");
+    const int chunk_size = std::stoi(getEnvVarOrDefault("IO_CHUNK_SIZE", "32768"));
+    const int chunks_in_flight = std::stoi(getEnvVarOrDefault("IO_CHUNKS_IN_FLIGHT", "16"));
+    const auto * receive_dir = getEnvVarOrDefault("IO_RECEIVE_DIR", "");
+    const long long receive_max_bytes = std::stoll(getEnvVarOrDefault("IO_RECEIVE_MAX_BYTES", "1073741824"));
+    const int outgoing_queue_bytes = std::stoi(getEnvVarOrDefault("IO_OUTGOING_QUEUE_BYTES", "0"));
+    const int outgoing_in_flight = std::stoi(getEnvVarOrDefault("IO_OUTGOING_IN_FLIGHT", "64"));
+    const auto * outgoing_policy = getEnvVarOrDefault("IO_OUTGOING_POLICY", "drop-oldest");
+    const auto * priority_lanes = getEnvVarOrDefault("IO_PRIORITY_LANES", "");
+    const auto * subscribe_file = getEnvVarOrDefault("IO_SUBSCRIBE_FILE", "");
+    const int subscribe_max_packet_size = std::stoi(getEnvVarOrDefault("IO_SUBSCRIBE_MAX_PACKET_SIZE", "131072"));
+    const int subscribe_batch_filters = std::stoi(getEnvVarOrDefault("IO_SUBSCRIBE_BATCH_FILTERS", "512"));
+    const float subscribe_timeout_sec = std::stof(getEnvVarOrDefault("IO_SUBSCRIBE_TIMEOUT_SECONDS", "5"));
+    const bool reconnect = std::stoi(getEnvVarOrDefault("IO_RECONNECT", "0")) != 0;
+    const int reconnect_initial_ms = std::stoi(getEnvVarOrDefault("IO_RECONNECT_INITIAL_MS", "200"));
+    const int reconnect_max_ms = std::stoi(getEnvVarOrDefault("IO_RECONNECT_MAX_MS", "30000"));
+    const float reconnect_jitter = std::stof(getEnvVarOrDefault("IO_RECONNECT_JITTER", "0.5"));
+    const float connect_timeout_sec = std::stof(getEnvVarOrDefault("IO_CONNECT_TIMEOUT_SECONDS", "10"));
+    const auto * message_filter = getEnvVarOrDefault("IO_MESSAGE_FILTER", "");
+    const auto * shm_ring_name = getEnvVarOrDefault("IO_SHM_RING", "");
+    const int shm_ring_bytes = std::stoi(getEnvVarOrDefault("IO_SHM_RING_BYTES", "4194304"));
+
+    ConnectionSettings settings;
+    settings.host = host;
+    settings.port = port;
+    settings.username = username;
+    settings.password = password;
 
     /* TLS */
-    const auto * ca_file = getEnvVarOrDefault("IO_CAFILE");
-    const auto * ca_path = getEnvVarOrDefault("IO_CAPATH");
-    const auto * cert_file = getEnvVarOrDefault("IO_CERTFILE");
-    const auto * key_file = getEnvVarOrDefault("IO_KEYFILE");
-    const auto * pass_phrase = getEnvVarOrDefault("IO_PASSPHRASE");
+    settings.ca_file = getEnvVarOrDefault("IO_CAFILE");
+    settings.ca_path = getEnvVarOrDefault("IO_CAPATH");
+    settings.cert_file = getEnvVarOrDefault("IO_CERTFILE");
+    settings.key_file = getEnvVarOrDefault("IO_KEYFILE");
+    settings.pass_phrase = getEnvVarOrDefault("IO_PASSPHRASE");
+
+    if (!isValidTopicName(publish_topic)) {
+        std::cerr << "Invalid IO_PUBLISH_TOPIC '" << publish_topic << "', it can't contain wildcards" << std::endl;
+        return 1;
+    }
+    PeriodicOverrunPolicy overrun_policy = PERIODIC_CATCH_UP;
+    if (periodicOverrunPolicyParse(overrun_policy_name, &overrun_policy) != 0) {
+        std::cerr << "Invalid IO_OVERRUN_POLICY '" << overrun_policy_name << "', expected catch-up or skip"
+                  << std::endl;
+        return 1;
+    }
+    if (message_period_sec < 0) {
+        std::cerr << "Invalid IO_MESSAGE_PERIOD_SECONDS '" << message_period_sec << "', it can't be negative"
+                  << std::endl;
+        return 1;
+    }
+    if (!isTransportKind(transport_kind)) {
+        std::cerr << "Invalid IO_TRANSPORT '" << transport_kind << "', expected " << TRANSPORT_KINDS << std::endl;
+        return 1;
+    }
+    std::vector<std::string_view> benchmarked_kinds;
+    for (std::string_view kinds = benchmark_transports; !kinds.empty();) {
+        const auto comma = kinds.find(',');
+        const auto kind = kinds.substr(0, comma);
+        if (!isTransportKind(kind)) {
+            std::cerr << "Invalid IO_BENCHMARK_TRANSPORTS '" << benchmark_transports << "', expected a list of "
+                      << TRANSPORT_KINDS << std::endl;
+            return 1;
+        }
+        benchmarked_kinds.push_back(kind);
+        kinds = comma == std::string_view::npos ? std::string_view() : kinds.substr(comma + 1);
+    }
+    if (!benchmarked_kinds.empty() && benchmark_messages <= 0) {
+        std::cerr << "Invalid IO_BENCHMARK_MESSAGES '" << benchmark_messages << "', it must be positive" << std::endl;
+        return 1;
+    }
+    if (qos < 0 || qos > 2) {
+        std::cerr << "Invalid IO_QOS '" << qos << "', expected 0, 1 or 2" << std::endl;
+        return 1;
+    }
+    auto queue_options = OutgoingQueueOptions::parsePolicies(outgoing_policy);
+    if (!queue_options) {
+        std::cerr << "Invalid IO_OUTGOING_POLICY '" << outgoing_policy
+                  << "', expected [<filter>=]drop-oldest|drop-newest|block|conflate,..." << std::endl;
+        return 1;
+    }
+    queue_options->max_in_flight = outgoing_in_flight;
+    if (outgoing_queue_bytes > 0) {
+        queue_options->memory_budget = static_cast<size_t>(outgoing_queue_bytes);
+        OutgoingQueue = queue_options;
+    }
+    if (*priority_lanes != '\0') {
+        PriorityLanes = PriorityLaneOptions::parse(priority_lanes);
+        if (!PriorityLanes) {
+            std::cerr << "Invalid IO_PRIORITY_LANES '" << priority_lanes
+                      << "', expected <name>:<filter>[,<filter>...][:<weight>][:own];..." << std::endl;
+            return 1;
+        }
+        /* Every lane gets a queue of its own with this budget and these policies */
+        PriorityLanes->queue = *queue_options;
+    }
+    std::vector<std::string> subscribe_filters;
+    if (*subscribe_file != '\0') {
+        std::string error;
+        auto filters = loadTopicFilters(subscribe_file, error);
+        if (!filters) {
+            std::cerr << "Invalid IO_SUBSCRIBE_FILE '" << subscribe_file << "': " << error << std::endl;
+            return 1;
+        }
+        if (filters->empty()) {
+            std::cerr << "Invalid IO_SUBSCRIBE_FILE '" << subscribe_file << "', it holds no topic filters" << std::endl;
+            return 1;
+        }
+        subscribe_filters = std::move(*filters);
+    }
+    if (subscribe_max_packet_size <= 0 || subscribe_batch_filters <= 0) {
+        std::cerr << "Invalid IO_SUBSCRIBE_MAX_PACKET_SIZE '" << subscribe_max_packet_size
+                  << "' or IO_SUBSCRIBE_BATCH_FILTERS '" << subscribe_batch_filters << "', they must be positive"
+                  << std::endl;
+        return 1;
+    }
+    SubscribeLimits.max_packet_size = static_cast<size_t>(subscribe_max_packet_size);
+    SubscribeLimits.max_filters = static_cast<size_t>(subscribe_batch_filters);
+    if (reconnect) {
+        if (reconnect_initial_ms <= 0 || reconnect_max_ms < reconnect_initial_ms) {
+            std::cerr << "Invalid IO_RECONNECT_INITIAL_MS '" << reconnect_initial_ms << "' or IO_RECONNECT_MAX_MS '"
+                      << reconnect_max_ms << "', expected 0 < initial <= max" << std::endl;
+            return 1;
+        }
+        if (reconnect_jitter < 0 || reconnect_jitter > 1) {
+            std::cerr << "Invalid IO_RECONNECT_JITTER '" << reconnect_jitter << "', expected 0 to 1" << std::endl;
+            return 1;
+        }
+        if (connect_timeout_sec <= 0) {
+            std::cerr << "Invalid IO_CONNECT_TIMEOUT_SECONDS '" << connect_timeout_sec << "', it must be positive"
+                      << std::endl;
+            return 1;
+        }
+        ReconnectPolicy policy;
+        policy.initial_delay = std::chrono::milliseconds(reconnect_initial_ms);
+        policy.max_delay = std::chrono::milliseconds(reconnect_max_ms);
+        policy.jitter = reconnect_jitter;
+        policy.connect_timeout = std::chrono::milliseconds(static_cast<int64_t>(connect_timeout_sec * 1000));
+        Reconnects = std::make_unique<ReconnectManager>(policy);
+    }
+    if (*message_filter != '\0') {
+        std::string error;
+        InboundFilters = MessageFilters::parse(message_filter, error);
+        if (!InboundFilters) {
+            std::cerr << "Invalid IO_MESSAGE_FILTER '" << message_filter << "': " << error << std::endl;
+            return 1;
+        }
+    }
+    if (chunk_size <= 0) {
+        std::cerr << "Invalid IO_CHUNK_SIZE '" << chunk_size << "', it must be positive" << std::endl;
+        return 1;
+    }
+    if (receive_max_bytes <= 0) {
+        std::cerr << "Invalid IO_RECEIVE_MAX_BYTES '" << receive_max_bytes << "', it must be positive" << std::endl;
+        return 1;
+    }
+    if (*brokers_spec == '\0') {
+        Brokers.push_back({ host, port });
+    } else if (auto brokers = parseBrokerList(brokers_spec, port)) {
+        Brokers = std::move(*brokers);
+    } else {
+        std::cerr << "Invalid IO_BROKERS '" << brokers_spec << "', expected host[:port],host[:port],..." << std::endl;
+        return 1;
+    }
+    if (broker_mode == "fanout") {
+        BrokerMode = ShardedTransport::Mode::FAN_OUT;
+    } else if (broker_mode != "shard") {
+        std::cerr << "Invalid IO_BROKER_MODE '" << broker_mode << "', expected shard or fanout" << std::endl;
+        return 1;
+    }
 
     struct sigaction sa = {};
     setupSigintHandler(&sa);
 
-    /* Required before calling other mosquitto functions */
-    mosquitto_lib_init();
-
-    /* Create a new client instance.
-     * id = device id that is registered with the broker
-     * clean session = true -> the broker should remove old sessions when we connect
-     * obj = consume_topic -> pass the consume topic name as user data  */
-    auto * mosq = mosquitto_new(device_id, true, (void *)consume_topic);
-    if (mosq == nullptr) {
-        (void)fprintf(stderr, "Error: Out of memory.\n");
-        return 1;
+    if (*trace_file != '\0') {
+        FlightRecorder::enable(std::max(trace_events_per_thread, 1), trace_file);
+        FlightRecorder::setThreadName("main");
     }
 
-    /* Configure callbacks. This should be done before connecting ideally. */
-    mosquitto_connect_callback_set(mosq, onConnect);
-    mosquitto_subscribe_callback_set(mosq, onSubscribe);
-    mosquitto_message_callback_set(mosq, onMessage);
-    mosquitto_disconnect_callback_set(mosq, onDisconnect);
-
-    /* Set username and password before connecting */
-    if (username && password && strlen(username) && strlen(password)) {
-        mosquitto_username_pw_set(mosq, username, password);
+    if (num_worker_threads > 0) {
+        auto ordering = OrderingPolicy::parse(ordering_key);
+        if (!ordering) {
+            std::cerr << "Invalid IO_ORDERING_KEY '" << ordering_key << "', expected topic, none or levels:<N>"
+                      << std::endl;
+            return 1;
+        }
+        MessageWorkers = std::make_unique<WorkerPool>(num_worker_threads, *ordering, handleMessage);
     }
 
-    int ver = MQTT_PROTOCOL_V311;
-    mosquitto_opts_set(mosq, MOSQ_OPT_PROTOCOL_VERSION, &ver);
+    if (*receive_dir != '\0') {
+        FileReceiver = std::make_unique<ChunkReassembler>(receive_dir, static_cast<uint64_t>(receive_max_bytes));
+    }
 
-    if ((ca_file || ca_path)) {
-        auto lambda = [](char * buf, int /*size*/, int /*rwflag*/, void * /*userdata*/) -> int {
-            const auto * pass_phrase = getEnvVarOrDefault("IO_PASSPHRASE");
-            if (pass_phrase) {
-                strcpy(buf, pass_phrase);
-                return strlen(pass_phrase);
-            }
-            return 0;
-        };
-        mosquitto_tls_set(mosq, ca_file, ca_path, cert_file, key_file, lambda);
+    if (*shm_ring_name != '\0') {
+        if (shm_ring_bytes <= 0) {
+            std::cerr << "Invalid IO_SHM_RING_BYTES '" << shm_ring_bytes << "', it must be positive" << std::endl;
+            return 1;
+        }
+        SharedRing.reset(shmRingWriterCreate(shm_ring_name, static_cast<size_t>(shm_ring_bytes)));
+        if (!SharedRing) {
+            std::cerr << "Invalid IO_SHM_RING '" << shm_ring_name << "': " << std::strerror(errno) << std::endl;
+            return 1;
+        }
     }
 
-    /* Connect to the MQTT broker */
-    std::cout << "Connecting to " << host << ":" << port << " ..." << std::endl;
-    int rc = mosquitto_connect(mosq, host, port, 60);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        mosquitto_destroy(mosq);
-        printMosquittoError(rc, "Failed to connect");
-        return 1;
+    /* Required before calling other mosquitto functions */
+    MosquittoTransport::libInit();
+
+    if (!benchmarked_kinds.empty()) {
+        TransportBenchmarkOptions options;
+        options.topic = publish_topic;
+        options.num_messages = benchmark_messages;
+        options.rate = benchmark_rate;
+        options.payload_size = static_cast<size_t>(std::max(payload_size, 0));
+        options.qos = qos;
+        const int rc = runTransportBenchmarks(benchmarked_kinds, device_id, settings, options);
+        MosquittoTransport::libCleanup();
+        return rc;
     }
 
-    rc = mosquitto_loop_start(mosq);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        mosquitto_destroy(mosq);
-        printMosquittoError(rc, "Failed to start loop");
-        return 1;
+    /* The first member's connection is also used for publishing. With a consumer group, each extra member opens its
+     * own connection subscribed to the same shared subscription. Without one, extra members split the filters of
+     * IO_SUBSCRIBE_FILE between them. */
+    size_t num_members = std::max(num_consumers, 1);
+    if (*consumer_group == '\0') {
+        num_members = std::min(num_members, std::max<size_t>(subscribe_filters.size(), 1));
+    }
+    ConsumerGroup consumers(consumer_group, consume_topic, device_id, num_members);
+    if (!subscribe_filters.empty()) {
+        if (consumers.isShared()) {
+            for (auto & filter : subscribe_filters) {
+                filter = ConsumerGroup::sharedSubscriptionTopic(consumer_group, filter);
+            }
+        }
+        BulkSubscriber = std::make_unique<BulkSubscription>(
+            subscribe_filters, consumers.size(), !consumers.isShared(), SubscribeLimits);
+    }
+    std::vector<std::unique_ptr<LoopbackBroker>> loopback_brokers;
+    for (size_t i = 0; i < Brokers.size(); ++i) {
+        loopback_brokers.push_back(std::make_unique<LoopbackBroker>());
+    }
+    std::vector<std::unique_ptr<Transport>> clients;
+    auto destroyClients = [&clients] {
+        for (auto & client : clients) {
+            client->stop();
+            const Transport * transport = client.get();
+            /* A QueuedTransport is a single-lane PriorityTransport */
+            if (const auto * queued = dynamic_cast<const QueuedTransport *>(transport)) {
+                queued->printStats(std::cout);
+                transport = &queued->inner();
+            } else if (const auto * priority = dynamic_cast<const PriorityTransport *>(transport)) {
+                priority->printStats(std::cout);
+            }
+            if (const auto * sharded = dynamic_cast<const ShardedTransport *>(transport)) {
+                sharded->printStats(std::cout);
+            }
+        }
+        clients.clear();
+    };
+    if (analytics_window_sec > 0) {
+        /* Results go out on the publishing connection, the timer only starts once it exists */
+        Analytics = std::make_unique<WindowAggregator>(
+            std::chrono::milliseconds(static_cast<int64_t>(analytics_window_sec * 1000)),
+            std::chrono::milliseconds(static_cast<int64_t>(analytics_slide_sec * 1000)),
+            analytics_prefix,
+            analytics_field,
+            [&clients](const std::string & topic, const std::string & payload) {
+                int rc = clients.front()->publish(topic.c_str(), payload.data(), payload.size(), 0, false, nullptr);
+                if (rc != 0) {
+                    printTransportError(*clients.front(), rc, "Error publishing window stats");
+                }
+            });
     }
+    if (*pipeline_spec != '\0') {
+        /* Like the window stats, pipeline results go out on the publishing connection */
+        PipelineOutput = std::make_unique<PublishBatcher>(
+            std::max(pipeline_batch_size, 1),
+            std::chrono::microseconds(static_cast<int64_t>(pipeline_linger_ms * 1000)),
+            static_cast<size_t>(std::max(pipeline_max_pending, 1)),
+            [&clients](const char * topic, const void * payload, size_t payload_len) {
+                int rc = clients.front()->publish(topic, payload, payload_len, 0, false, nullptr);
+                if (rc != 0) {
+                    printTransportError(*clients.front(), rc, "Error publishing pipeline output");
+                }
+                return rc;
+            });
+        MessagePipeline = Pipeline::create(pipeline_spec, [](std::string_view topic, std::string_view payload) {
+            PipelineOutput->add(topic, payload);
+        });
+        if (!MessagePipeline) {
+            std::cerr << "Invalid IO_PIPELINE '" << pipeline_spec << "', see include/pipeline.h for the syntax"
+                      << std::endl;
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < consumers.size(); ++i) {
+        auto client = createTransport(transport_kind, consumers.member(i), settings, loopback_brokers, i == 0);
+        if (!client || !startTransport(*client)) {
+            destroyClients();
+            return 1;
+        }
+        clients.push_back(std::move(client));
+    }
+    auto & transport = *clients.front();
 
     std::mutex m;
     std::unique_lock lk(m);
-    using namespace std::chrono_literals;
-    if (!OnSubscribedCondVar.wait_for(lk, 5s, []() -> bool { return IsSubscribed; })) {
-        std::cerr << "Unable to connect and subscribe to the specified topic" << std::endl;
-        return 1;
+    auto all_subscribed = [&consumers]() -> bool { return consumers.subscribedCount() == consumers.size(); };
+    const auto subscribe_timeout = std::chrono::milliseconds(static_cast<int64_t>(subscribe_timeout_sec * 1000));
+    if (!OnSubscribedCondVar.wait_for(lk, subscribe_timeout, all_subscribed)) {
+        if (!Reconnects) {
+            std::cerr << "Unable to connect and subscribe to the specified topic" << std::endl;
+            destroyClients();
+            return 1;
+        }
+        /* The connections keep trying, and subscribe as soon as they are up */
+        std::cerr << "Not subscribed after " << subscribe_timeout_sec << "s, carrying on while reconnecting"
+                  << std::endl;
     };
+    if (Analytics) {
+        Analytics->start();
+    }
+    if (MessagePipeline) {
+        PipelineOutput->start();
+        MessagePipeline->start();
+    }
+    if (consumers.isShared()) {
+        consumers.startReporter(std::chrono::milliseconds(static_cast<int64_t>(stats_interval_sec * 1000)));
+    }
 
-    std::thread publisher([&] {
-        int num_messages = 0;
-        std::mutex m;
-        auto period_us = std::chrono::microseconds(static_cast<int64_t>(message_period_sec * 1000000));
-        {
-            std::unique_lock lk(m);
-            OnStoppingCondVar.wait_for(lk, period_us, []() -> bool { return StopPublisherLoop; });
-        }
-        auto start_tp = std::chrono::steady_clock::now();
-        while ((num_messages_to_send <= 0 || num_messages < num_messages_to_send) && !StopPublisherLoop) {
-            publishSensorData(mosq, publish_topic);
-            ++num_messages;
-            auto sleep_until = start_tp + num_messages * period_us;
-            std::unique_lock lk(m);
-            OnStoppingCondVar.wait_until(lk, sleep_until, []() -> bool { return StopPublisherLoop; });
+    auto publish_start_tp = std::chrono::steady_clock::now();
+    int num_messages_sent = 0;
+    if (num_async_flows > 0) {
+        /* Coroutine flows get a connection of their own, AsyncClient takes over its callbacks */
+        auto async_client_id = std::string(device_id) + "-async";
+        auto async_transport = makeTransport(transport_kind, async_client_id, settings, loopback_brokers);
+        if (async_transport) {
+            auto report = runAsyncFlows(*async_transport,
+                                        publish_topic,
+                                        num_async_flows,
+                                        num_messages_to_send,
+                                        getTemperature,
+                                        StopPublisherLoop,
+                                        verify_async_flows);
+            if (report.connect_rc != 0) {
+                printTransportError(*async_transport, report.connect_rc, "Failed to connect async flows");
+            }
+            if (report.publish_rc != 0) {
+                printTransportError(*async_transport, report.publish_rc, "Async flow stopped");
+            }
+            if (report.subscribe_rc < 0) {
+                printTransportError(*async_transport, -report.subscribe_rc, "Unable to subscribe async flows");
+            } else if (report.subscribe_rc != 0) {
+                std::cerr << "Unable to subscribe async flows: rejected by the broker" << std::endl;
+            }
+            report.print(std::cout);
+            num_messages_sent = static_cast<int>(report.acked + report.failed);
         }
-    });
-    publisher.join();
+    } else if (*send_file != '\0') {
+        /* Like async flows, the file goes out on a connection of its own, whose acks pace the chunks */
+        auto file_transport
+            = makeTransport(transport_kind, std::string(device_id) + "-file", settings, loopback_brokers);
+        if (file_transport) {
+            FileSendOptions options;
+            options.path = send_file;
+            options.topic = publish_topic;
+            options.chunk_size = static_cast<uint32_t>(chunk_size);
+            options.max_in_flight = chunks_in_flight;
+            options.qos = qos;
+            auto report = sendFile(*file_transport, options, StopPublisherLoop);
+            report.print(std::cout);
+            num_messages_sent = static_cast<int>(report.chunks_acked);
+        }
+    } else {
+        const auto period_ns = static_cast<int64_t>(static_cast<double>(message_period_sec) * 1e9);
+        const auto spin_ns = LowLatency.enabled ? std::chrono::nanoseconds(LowLatency.spin).count() : 0;
+        std::unique_ptr<PeriodicScheduler, decltype(&periodicSchedulerDestroy)> schedule(
+            periodicSchedulerCreate(period_ns, overrun_policy, spin_ns), periodicSchedulerDestroy);
+        if (!schedule) {
+            (void)fprintf(stderr, "Error: Out of memory.\n");
+        } else {
+            PublisherSchedule = schedule.get();
+            if (StopPublisherLoop) {
+                periodicSchedulerCancel(schedule.get());
+            }
+            std::thread publisher([&] {
+                FlightRecorder::setThreadName("publisher");
+                if (LowLatency.enabled && LowLatency.publisher_cpu >= 0 &&
+                    !pinCurrentThread(LowLatency.publisher_cpu)) {
+                    std::cerr << "Unable to pin the publisher thread to CPU " << LowLatency.publisher_cpu << std::endl;
+                }
+                num_messages_sent = runPublisherLoop(transport, publish_topic, num_messages_to_send, *schedule);
+            });
+            publisher.join();
+            PublisherSchedule = nullptr;
+            if (jitter_report) {
+                periodicSchedulerPrintStats(schedule.get(), stdout, "publisher");
+            }
+        }
+    }
 
     std::cout << "Stopping publisher timer ..." << std::endl;
-    mosquitto_loop_stop(mosq, true);
+    /* Inbound side first: whatever was received goes through the workers, window stats and pipeline and out on the
+     * connections, which are still up */
+    stopConsuming(consumers);
+    if (FileReceiver) {
+        /* Saves the transfers that completed */
+        FileReceiver->stop();
+    }
+    if (MessageWorkers) {
+        MessageWorkers->stop();
+    }
+    if (Analytics) {
+        /* Publishes the last windows */
+        Analytics->stop();
+    }
+    if (MessagePipeline) {
+        MessagePipeline->stop();
+        PipelineOutput->stop();
+    }
+    destroyClients();
+    if (consumers.isShared()) {
+        consumers.stopReporter();
+        consumers.printSummary(std::cout);
+    }
+    if (MessageWorkers) {
+        MessageWorkers->printStats(std::cout);
+    }
+    if (MessagePipeline) {
+        MessagePipeline->printStats(std::cout);
+        PipelineOutput->printStats(std::cout);
+    }
+    if (FileReceiver) {
+        FileReceiver->printStats(std::cout);
+    }
+    if (InboundFilters) {
+        InboundFilters->printStats(std::cout);
+    }
+    /* Carrying on past the subscribe timeout is no success if nothing ever connected */
+    const bool never_connected = Reconnects && !Reconnects->anyConnected();
+    if (Reconnects) {
+        Reconnects->printStats(std::cout);
+    }
+    if (SharedRing) {
+        /* Readers stop once they drained what is left */
+        shmRingWriterPrintStats(SharedRing.get(), stdout);
+        SharedRing.reset();
+    }
+    if (BenchmarkMode) {
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - publish_start_tp;
+        uint64_t num_received = 0;
+        for (size_t i = 0; i < consumers.size(); ++i) {
+            num_received += consumers.member(i).messages;
+        }
+        std::cout << "Benchmark: sent=" << num_messages_sent << " received=" << num_received
+                  << " elapsed=" << elapsed.count() << "s rate=" << num_received / elapsed.count() << " msg/s"
+                  << std::endl;
+    }
+    MessagePool::instance().printStats(std::cout);
     std::cout << "Cleaning up mosquitto client ..." << std::endl;
-    mosquitto_lib_cleanup();
+    MosquittoTransport::libCleanup();
     std::cout << "Done!" << std::endl;
+    if (never_connected) {
+        std::cerr << "No connection was ever accepted by the broker" << std::endl;
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
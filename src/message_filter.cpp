@@ -0,0 +1,523 @@
+#include "message_filter.h"
+
+#include "payload_parser.h"
+#include "topic_filter.h"
+
+#include <cctype>
+#include <charconv>
+
+namespace {
+
+/* Returns the position of the first `c` outside a string literal, or npos */
+size_t findUnquoted(std::string_view s, char c)
+{
+    bool quoted = false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (quoted && s[i] == '\\') {
+            ++i;
+        } else if (s[i] == '"') {
+            quoted = !quoted;
+        } else if (!quoted && s[i] == c) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/* Level `level` of `topic`, std::nullopt when the topic has fewer levels */
+std::optional<std::string_view> topicLevel(std::string_view topic, uint32_t level)
+{
+    for (; level > 0; --level) {
+        const auto slash = topic.find('/');
+        if (slash == std::string_view::npos) {
+            return std::nullopt;
+        }
+        topic.remove_prefix(slash + 1);
+    }
+    return topic.substr(0, topic.find('/'));
+}
+
+} // namespace
+
+/* An operand's value for one message, viewing the message or the filter's literals */
+struct MessageFilter::Value
+{
+    bool present = false;
+    bool is_number = false;
+    double number = 0;
+    std::string_view text;
+
+    std::optional<double> asNumber() const
+    {
+        if (!present) {
+            return std::nullopt;
+        }
+        return is_number ? std::optional<double>(number) : parseNumber<double>(text);
+    }
+
+    bool truthy() const
+    {
+        if (!present) {
+            return false;
+        }
+        if (is_number) {
+            return number != 0;
+        }
+        return !text.empty() && text != "0" && text != "false" && text != "null";
+    }
+};
+
+/* Recursive descent over the expression, emitting the program as it goes */
+class MessageFilter::Compiler
+{
+public:
+    Compiler(std::string_view expression, MessageFilter & filter)
+    : text_(expression)
+    , filter_(filter)
+    {
+    }
+
+    bool compile(std::string & error)
+    {
+        skipSpace();
+        if (pos_ == text_.size()) {
+            error = "empty expression";
+            return false;
+        }
+        if (!parseOr() || !expectEnd()) {
+            error = error_;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool fail(std::string message)
+    {
+        if (error_.empty()) {
+            error_ = std::move(message) + " at offset " + std::to_string(pos_);
+        }
+        return false;
+    }
+
+    void skipSpace()
+    {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    /* Consumes `token` when it comes next. Words must not run on into an identifier. */
+    bool accept(std::string_view token)
+    {
+        if (text_.substr(pos_, token.size()) != token) {
+            return false;
+        }
+        const size_t end = pos_ + token.size();
+        if (std::isalpha(static_cast<unsigned char>(token.back())) && end < text_.size()
+            && (std::isalnum(static_cast<unsigned char>(text_[end])) || text_[end] == '_')) {
+            return false;
+        }
+        pos_ = end;
+        skipSpace();
+        return true;
+    }
+
+    bool expectEnd()
+    {
+        return pos_ == text_.size() || fail("unexpected '" + std::string(1, text_[pos_]) + "'");
+    }
+
+    size_t emit(Instruction::Op op, uint32_t arg = 0)
+    {
+        filter_.program_.push_back({ op, arg });
+        return filter_.program_.size() - 1;
+    }
+
+    /* Points the jumps at the next instruction to be emitted */
+    void patch(const std::vector<size_t> & jumps)
+    {
+        for (size_t jump : jumps) {
+            filter_.program_[jump].arg = static_cast<uint32_t>(filter_.program_.size());
+        }
+    }
+
+    bool parseOr()
+    {
+        if (!parseAnd()) {
+            return false;
+        }
+        std::vector<size_t> jumps;
+        while (accept("||") || accept("or")) {
+            /* Already true, skip the rest of the chain */
+            jumps.push_back(emit(Instruction::Op::JUMP_IF_TRUE));
+            if (!parseAnd()) {
+                return false;
+            }
+        }
+        patch(jumps);
+        return true;
+    }
+
+    bool parseAnd()
+    {
+        if (!parseUnary()) {
+            return false;
+        }
+        std::vector<size_t> jumps;
+        while (accept("&&") || accept("and")) {
+            jumps.push_back(emit(Instruction::Op::JUMP_IF_FALSE));
+            if (!parseUnary()) {
+                return false;
+            }
+        }
+        patch(jumps);
+        return true;
+    }
+
+    bool parseUnary()
+    {
+        /* "!=" only follows an operand, so a '!' here is always a negation */
+        if (accept("!") || accept("not")) {
+            if (!parseUnary()) {
+                return false;
+            }
+            emit(Instruction::Op::NOT);
+            return true;
+        }
+        if (accept("(")) {
+            return parseOr() && (accept(")") || fail("expected ')'"));
+        }
+        return parseComparison();
+    }
+
+    bool parseComparison()
+    {
+        Comparison comparison;
+        if (!parseOperand(comparison.lhs)) {
+            return false;
+        }
+        static constexpr std::pair<std::string_view, Comparison::Op> OPERATORS[] = {
+            { "==", Comparison::Op::EQ }, { "!=", Comparison::Op::NE }, { "<=", Comparison::Op::LE },
+            { ">=", Comparison::Op::GE }, { "<", Comparison::Op::LT },  { ">", Comparison::Op::GT },
+            { "~", Comparison::Op::MATCHES },
+        };
+        for (const auto & [token, op] : OPERATORS) {
+            if (accept(token)) {
+                comparison.op = op;
+                break;
+            }
+        }
+        if (comparison.op != Comparison::Op::TRUTHY) {
+            const size_t rhs_pos = pos_;
+            if (!parseOperand(comparison.rhs)) {
+                return false;
+            }
+            if (!check(comparison, rhs_pos)) {
+                return false;
+            }
+        }
+        filter_.comparisons_.push_back(std::move(comparison));
+        emit(Instruction::Op::TEST, static_cast<uint32_t>(filter_.comparisons_.size() - 1));
+        return true;
+    }
+
+    /* Validates the operands of a binary comparison and picks how it compares */
+    bool check(Comparison & comparison, size_t rhs_pos)
+    {
+        using Kind = Operand::Kind;
+        const auto & lhs = comparison.lhs;
+        const auto & rhs = comparison.rhs;
+        if (comparison.op == Comparison::Op::MATCHES) {
+            if (rhs.kind != Kind::STRING || !isValidTopicFilter(rhs.text)) {
+                pos_ = rhs_pos;
+                return fail("~ needs a quoted topic filter on its right");
+            }
+            return true;
+        }
+        const auto numeric = [](const Operand & o) {
+            return o.kind == Kind::NUMBER || o.kind == Kind::QOS || o.kind == Kind::RETAIN;
+        };
+        const bool any_numeric = numeric(lhs) || numeric(rhs);
+        const bool any_text = lhs.kind == Kind::STRING || rhs.kind == Kind::STRING;
+        if (any_numeric && any_text) {
+            pos_ = rhs_pos;
+            return fail("can't compare a number with a string");
+        }
+        comparison.mode = any_numeric ? Comparison::Mode::NUMERIC
+                          : any_text  ? Comparison::Mode::TEXT
+                                      : Comparison::Mode::EITHER;
+        return true;
+    }
+
+    bool parseOperand(Operand & operand)
+    {
+        using Kind = Operand::Kind;
+        if (pos_ == text_.size()) {
+            return fail("expected an operand");
+        }
+        const char c = text_[pos_];
+        if (c == '"') {
+            operand.kind = Kind::STRING;
+            return parseString(operand.text);
+        }
+        if (c == '.') {
+            ++pos_;
+            operand.kind = Kind::FIELD;
+            if (pos_ < text_.size() && text_[pos_] == '"') {
+                return parseString(operand.text);
+            }
+            const size_t begin = pos_;
+            while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '_'
+                                           || text_[pos_] == '-')) {
+                ++pos_;
+            }
+            if (pos_ == begin) {
+                return fail("expected a field name");
+            }
+            operand.text = text_.substr(begin, pos_ - begin);
+            skipSpace();
+            return true;
+        }
+        if (c == '-' || c == '+' || std::isdigit(static_cast<unsigned char>(c))) {
+            operand.kind = Kind::NUMBER;
+            const char * begin = text_.data() + pos_ + (c == '+' ? 1 : 0);
+            auto [ptr, ec] = std::from_chars(begin, text_.data() + text_.size(), operand.number);
+            if (ec != std::errc()) {
+                return fail("invalid number");
+            }
+            pos_ = ptr - text_.data();
+            skipSpace();
+            return true;
+        }
+        if (accept("topic")) {
+            operand.kind = Kind::TOPIC;
+            if (accept("[")) {
+                operand.kind = Kind::TOPIC_LEVEL;
+                auto [ptr, ec] = std::from_chars(text_.data() + pos_, text_.data() + text_.size(), operand.level);
+                if (ec != std::errc()) {
+                    return fail("expected a topic level");
+                }
+                pos_ = ptr - text_.data();
+                skipSpace();
+                return accept("]") || fail("expected ']'");
+            }
+            return true;
+        }
+        if (accept("payload")) {
+            operand.kind = Kind::PAYLOAD;
+            return true;
+        }
+        if (accept("qos")) {
+            operand.kind = Kind::QOS;
+            return true;
+        }
+        if (accept("retain")) {
+            operand.kind = Kind::RETAIN;
+            return true;
+        }
+        return fail("expected an operand");
+    }
+
+    bool parseString(std::string & out)
+    {
+        for (++pos_; pos_ < text_.size() && text_[pos_] != '"'; ++pos_) {
+            if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) {
+                ++pos_;
+            }
+            out += text_[pos_];
+        }
+        if (pos_ == text_.size()) {
+            return fail("unterminated string");
+        }
+        ++pos_;
+        skipSpace();
+        return true;
+    }
+
+    std::string_view text_;
+    MessageFilter & filter_;
+    size_t pos_ = 0;
+    std::string error_;
+};
+
+std::optional<MessageFilter> MessageFilter::compile(std::string_view expression, std::string & error)
+{
+    MessageFilter filter;
+    filter.text_ = trimPayload(expression);
+    if (!Compiler(filter.text_, filter).compile(error)) {
+        return std::nullopt;
+    }
+    return filter;
+}
+
+MessageFilter::Value MessageFilter::load(const Operand & operand, const FilterInput & msg) const
+{
+    using Kind = Operand::Kind;
+    Value value;
+    value.present = true;
+    switch (operand.kind) {
+        case Kind::NUMBER:
+            value.is_number = true;
+            value.number = operand.number;
+            break;
+        case Kind::STRING:
+            value.text = operand.text;
+            break;
+        case Kind::TOPIC:
+            value.text = msg.topic;
+            break;
+        case Kind::TOPIC_LEVEL:
+            if (auto level = topicLevel(msg.topic, operand.level)) {
+                value.text = *level;
+            } else {
+                value.present = false;
+            }
+            break;
+        case Kind::PAYLOAD:
+            value.text = msg.payload;
+            break;
+        case Kind::FIELD:
+            if (auto field = findJsonField(msg.payload, operand.text)) {
+                value.text = *field;
+            } else {
+                value.present = false;
+            }
+            break;
+        case Kind::QOS:
+            value.is_number = true;
+            value.number = msg.qos;
+            break;
+        case Kind::RETAIN:
+            value.is_number = true;
+            value.number = msg.retain ? 1 : 0;
+            break;
+    }
+    return value;
+}
+
+bool MessageFilter::test(const Comparison & comparison, const FilterInput & msg) const
+{
+    const Value lhs = load(comparison.lhs, msg);
+    if (comparison.op == Comparison::Op::TRUTHY) {
+        return lhs.truthy();
+    }
+    if (comparison.op == Comparison::Op::MATCHES) {
+        return lhs.present && !lhs.is_number && topicMatchesFilter(comparison.rhs.text, lhs.text);
+    }
+    const Value rhs = load(comparison.rhs, msg);
+    if (!lhs.present || !rhs.present) {
+        return false;
+    }
+    const auto compare = [op = comparison.op](const auto & a, const auto & b) {
+        switch (op) {
+            case Comparison::Op::EQ:
+                return a == b;
+            case Comparison::Op::NE:
+                return a != b;
+            case Comparison::Op::LT:
+                return a < b;
+            case Comparison::Op::LE:
+                return a <= b;
+            case Comparison::Op::GT:
+                return a > b;
+            default:
+                return a >= b;
+        }
+    };
+    if (comparison.mode != Comparison::Mode::TEXT) {
+        const auto a = lhs.asNumber();
+        const auto b = rhs.asNumber();
+        if (a && b) {
+            return compare(*a, *b);
+        }
+        if (comparison.mode == Comparison::Mode::NUMERIC) {
+            return false;
+        }
+    }
+    return compare(lhs.text, rhs.text);
+}
+
+bool MessageFilter::matches(const FilterInput & msg) const
+{
+    bool result = false;
+    for (size_t pc = 0; pc < program_.size(); ++pc) {
+        const Instruction & instruction = program_[pc];
+        switch (instruction.op) {
+            case Instruction::Op::TEST:
+                result = test(comparisons_[instruction.arg], msg);
+                break;
+            case Instruction::Op::NOT:
+                result = !result;
+                break;
+            case Instruction::Op::JUMP_IF_FALSE:
+                if (!result) {
+                    pc = instruction.arg - 1;
+                }
+                break;
+            case Instruction::Op::JUMP_IF_TRUE:
+                if (result) {
+                    pc = instruction.arg - 1;
+                }
+                break;
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<MessageFilters> MessageFilters::parse(std::string_view spec, std::string & error)
+{
+    auto filters = std::make_unique<MessageFilters>();
+    while (!spec.empty()) {
+        const auto end = findUnquoted(spec, ';');
+        auto entry_spec = trimPayload(spec.substr(0, end));
+        spec = end == std::string_view::npos ? std::string_view() : spec.substr(end + 1);
+        if (entry_spec.empty()) {
+            continue;
+        }
+        std::string_view topic_filter;
+        if (const auto colon = findUnquoted(entry_spec, ':'); colon != std::string_view::npos) {
+            topic_filter = trimPayload(entry_spec.substr(0, colon));
+            entry_spec.remove_prefix(colon + 1);
+            if (!isValidTopicFilter(topic_filter)) {
+                error = "invalid topic filter '" + std::string(topic_filter) + "'";
+                return nullptr;
+            }
+        }
+        auto filter = MessageFilter::compile(entry_spec, error);
+        if (!filter) {
+            error = "filter " + std::to_string(filters->entries_.size()) + ": " + error;
+            return nullptr;
+        }
+        filters->entries_.push_back(std::make_unique<Entry>(std::string(topic_filter), std::move(*filter)));
+    }
+    if (filters->entries_.empty()) {
+        error = "no filters";
+        return nullptr;
+    }
+    return filters;
+}
+
+bool MessageFilters::accept(const FilterInput & msg)
+{
+    for (auto & entry : entries_) {
+        if (!entry->topic_filter.empty() && !topicMatchesFilter(entry->topic_filter, msg.topic)) {
+            continue;
+        }
+        const bool keep = entry->filter.matches(msg);
+        (keep ? entry->passed : entry->dropped).fetch_add(1, std::memory_order_relaxed);
+        return keep;
+    }
+    return true;
+}
+
+void MessageFilters::printStats(std::ostream & os) const
+{
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        const Entry & entry = *entries_[i];
+        os << "Message filter " << i << ": topics=" << (entry.topic_filter.empty() ? "#" : entry.topic_filter)
+           << " expression='" << entry.filter.text() << "' instructions=" << entry.filter.size()
+           << " passed=" << entry.passed.load(std::memory_order_relaxed)
+           << " dropped=" << entry.dropped.load(std::memory_order_relaxed) << std::endl;
+    }
+}
@@ -0,0 +1,252 @@
+#include "message_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace {
+/* Blocks a thread keeps per size class before handing half of them back to the shared list */
+constexpr size_t THREAD_CACHE_LIMIT = 64;
+/* Blocks pulled from the shared list in one go when a thread cache runs dry */
+constexpr size_t THREAD_CACHE_REFILL = 16;
+} // namespace
+
+/* Per-thread free lists. A thread that only releases (a consumer) overflows into the shared list, a thread that only
+ * acquires (the mosquitto network thread) refills from it in batches, so the shared mutex is taken once per batch. */
+struct ThreadCache
+{
+    std::array<std::vector<void *>, MessagePool::NUM_CLASSES> free_blocks;
+
+    ThreadCache()
+    {
+        for (auto & blocks : free_blocks) {
+            blocks.reserve(THREAD_CACHE_LIMIT);
+        }
+    }
+
+    ~ThreadCache()
+    {
+        auto & pool = MessagePool::instance();
+        for (size_t i = 0; i < free_blocks.size(); ++i) {
+            pool.giveShared(i, free_blocks[i], free_blocks[i].size());
+        }
+    }
+};
+
+namespace {
+ThreadCache & threadCache()
+{
+    thread_local ThreadCache cache;
+    return cache;
+}
+} // namespace
+
+uint64_t MessagePool::Stats::totalHits() const
+{
+    uint64_t total = 0;
+    for (const auto & c : classes) {
+        total += c.hits;
+    }
+    return total;
+}
+
+uint64_t MessagePool::Stats::totalMisses() const
+{
+    uint64_t total = 0;
+    for (const auto & c : classes) {
+        total += c.misses;
+    }
+    return total;
+}
+
+MessagePool & MessagePool::instance()
+{
+    /* Never destroyed: thread caches of late-exiting threads flush into it */
+    static auto * pool = new MessagePool();
+    return *pool;
+}
+
+size_t MessagePool::classFor(size_t size)
+{
+    const auto * it = std::lower_bound(SIZE_CLASSES.begin(), SIZE_CLASSES.end(), size);
+    return static_cast<size_t>(it - SIZE_CLASSES.begin());
+}
+
+PooledBuffer MessagePool::acquire(size_t size)
+{
+    const size_t size_class = classFor(size);
+    auto & counters = counters_[size_class];
+
+    if (size_class == OVERSIZE_CLASS) {
+        auto * block = static_cast<char *>(std::malloc(size));
+        if (block == nullptr) {
+            throw std::bad_alloc();
+        }
+        counters.misses.fetch_add(1, std::memory_order_relaxed);
+        noteInUse(size_class, 1);
+        return { block, size, size_class };
+    }
+
+    auto & blocks = threadCache().free_blocks[size_class];
+    if (blocks.empty()) {
+        takeShared(size_class, blocks, THREAD_CACHE_REFILL);
+    }
+
+    void * block = nullptr;
+    if (!blocks.empty()) {
+        block = blocks.back();
+        blocks.pop_back();
+        counters.hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        block = std::malloc(SIZE_CLASSES[size_class]);
+        if (block == nullptr) {
+            throw std::bad_alloc();
+        }
+        counters.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    noteInUse(size_class, 1);
+    return { static_cast<char *>(block), SIZE_CLASSES[size_class], size_class };
+}
+
+void MessagePool::release(void * block, size_t size_class)
+{
+    noteInUse(size_class, -1);
+    if (size_class == OVERSIZE_CLASS) {
+        std::free(block);
+        return;
+    }
+    auto & blocks = threadCache().free_blocks[size_class];
+    blocks.push_back(block);
+    if (blocks.size() > THREAD_CACHE_LIMIT) {
+        giveShared(size_class, blocks, blocks.size() / 2);
+    }
+}
+
+void MessagePool::noteInUse(size_t size_class, int64_t delta)
+{
+    auto & counters = counters_[size_class];
+    const auto in_use = counters.in_use.fetch_add(delta, std::memory_order_relaxed) + delta;
+    auto high_water = counters.high_water.load(std::memory_order_relaxed);
+    while (in_use > high_water && !counters.high_water.compare_exchange_weak(high_water, in_use)) {
+    }
+}
+
+size_t MessagePool::takeShared(size_t size_class, std::vector<void *> & out, size_t count)
+{
+    auto & shared = shared_[size_class];
+    std::lock_guard lk(shared.mutex);
+    count = std::min(count, shared.blocks.size());
+    out.insert(out.end(), shared.blocks.end() - static_cast<ptrdiff_t>(count), shared.blocks.end());
+    shared.blocks.resize(shared.blocks.size() - count);
+    return count;
+}
+
+void MessagePool::giveShared(size_t size_class, std::vector<void *> & in, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    auto & shared = shared_[size_class];
+    {
+        std::lock_guard lk(shared.mutex);
+        shared.blocks.insert(shared.blocks.end(), in.end() - static_cast<ptrdiff_t>(count), in.end());
+    }
+    in.resize(in.size() - count);
+}
+
+MessagePool::Stats MessagePool::stats() const
+{
+    Stats stats;
+    for (size_t i = 0; i < counters_.size(); ++i) {
+        auto & c = stats.classes[i];
+        c.block_size = i < NUM_CLASSES ? SIZE_CLASSES[i] : 0;
+        c.hits = counters_[i].hits.load(std::memory_order_relaxed);
+        c.misses = counters_[i].misses.load(std::memory_order_relaxed);
+        c.in_use = counters_[i].in_use.load(std::memory_order_relaxed);
+        c.high_water = counters_[i].high_water.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void MessagePool::printStats(std::ostream & os) const
+{
+    const auto s = stats();
+    os << "Message pool: hits=" << s.totalHits() << " misses=" << s.totalMisses() << std::endl;
+    for (const auto & c : s.classes) {
+        if (c.hits + c.misses == 0) {
+            continue;
+        }
+        os << "  class " << (c.block_size ? std::to_string(c.block_size) : std::string("oversize"))
+           << ": hits=" << c.hits << " misses=" << c.misses << " in_use=" << c.in_use << " high_water=" << c.high_water
+           << std::endl;
+    }
+}
+
+PooledBuffer::PooledBuffer(char * data, size_t capacity, size_t size_class)
+: data_(data)
+, capacity_(capacity)
+, size_class_(size_class)
+{
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer && other) noexcept
+: data_(std::exchange(other.data_, nullptr))
+, capacity_(std::exchange(other.capacity_, 0))
+, size_class_(other.size_class_)
+{
+}
+
+PooledBuffer & PooledBuffer::operator=(PooledBuffer && other) noexcept
+{
+    if (this != &other) {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        capacity_ = std::exchange(other.capacity_, 0);
+        size_class_ = other.size_class_;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    reset();
+}
+
+void PooledBuffer::reset()
+{
+    if (data_ != nullptr) {
+        MessagePool::instance().release(data_, size_class_);
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+}
+
+ReceivedMessage makeReceivedMessage(std::string_view topic,
+                                    const void * payload,
+                                    size_t payload_len,
+                                    int qos,
+                                    bool retain,
+                                    int mid)
+{
+    auto & pool = MessagePool::instance();
+    ReceivedMessage msg;
+    msg.topic_buffer = pool.acquire(topic.size() + 1);
+    std::memcpy(msg.topic_buffer.data(), topic.data(), topic.size());
+    msg.topic_buffer.data()[topic.size()] = '\0';
+    msg.topic_len = topic.size();
+
+    msg.payload_buffer = pool.acquire(payload_len + 1);
+    if (payload_len > 0) {
+        std::memcpy(msg.payload_buffer.data(), payload, payload_len);
+    }
+    msg.payload_buffer.data()[payload_len] = '\0';
+    msg.payload_len = payload_len;
+
+    msg.qos = qos;
+    msg.retain = retain;
+    msg.mid = mid;
+    return msg;
+}
@@ -0,0 +1,243 @@
+#include "mosquitto_transport.h"
+
+#include <mosquitto.h>
+#include <pthread.h>
+
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+/* select() timeout of the low-latency loop once it stops spinning, bounds how long stop() takes */
+constexpr int PARK_TIMEOUT_MS = 100;
+/* Same delay mosquitto_loop_forever() uses before reconnecting */
+constexpr auto RECONNECT_DELAY = std::chrono::seconds(1);
+} // namespace
+
+int MosquittoTransport::libInit()
+{
+    return mosquitto_lib_init();
+}
+
+void MosquittoTransport::libCleanup()
+{
+    mosquitto_lib_cleanup();
+}
+
+MosquittoTransport::MosquittoTransport(std::string client_id, const ConnectionSettings & settings)
+: client_id_(std::move(client_id))
+, settings_(settings)
+{
+    /* Create a new client instance.
+     * id = device id that is registered with the broker
+     * clean session = true -> the broker should remove old sessions when we connect
+     * obj = this -> the static callbacks forward to the transport */
+    mosq_ = mosquitto_new(client_id_.c_str(), true, this);
+    if (mosq_ == nullptr) {
+        return;
+    }
+
+    /* Configure callbacks. This should be done before connecting ideally. */
+    mosquitto_connect_callback_set(mosq_, onConnect);
+    mosquitto_disconnect_callback_set(mosq_, onDisconnect);
+    mosquitto_subscribe_callback_set(mosq_, onSubscribe);
+    mosquitto_message_callback_set(mosq_, onMessage);
+    mosquitto_publish_callback_set(mosq_, onPublish);
+
+    /* Set username and password before connecting */
+    if (settings_.username && settings_.password && strlen(settings_.username) && strlen(settings_.password)) {
+        mosquitto_username_pw_set(mosq_, settings_.username, settings_.password);
+    }
+
+    int ver = MQTT_PROTOCOL_V311;
+    mosquitto_opts_set(mosq_, MOSQ_OPT_PROTOCOL_VERSION, &ver);
+
+    if ((settings_.ca_file || settings_.ca_path)) {
+        /* libmosquitto passes the client user data, i.e. this transport, to the password callback */
+        auto lambda = [](char * buf, int size, int /*rwflag*/, void * userdata) -> int {
+            const auto * pass_phrase = static_cast<MosquittoTransport *>(userdata)->settings_.pass_phrase;
+            if (pass_phrase && static_cast<int>(strlen(pass_phrase)) < size) {
+                strcpy(buf, pass_phrase);
+                return static_cast<int>(strlen(pass_phrase));
+            }
+            return 0;
+        };
+        mosquitto_tls_set(
+            mosq_, settings_.ca_file, settings_.ca_path, settings_.cert_file, settings_.key_file, lambda);
+    }
+}
+
+MosquittoTransport::~MosquittoTransport()
+{
+    if (mosq_ != nullptr) {
+        stop();
+        mosquitto_destroy(mosq_);
+    }
+}
+
+int MosquittoTransport::connect()
+{
+    disconnect_requested_ = false;
+    return mosquitto_connect(mosq_, settings_.host, settings_.port, settings_.keepalive_sec);
+}
+
+int MosquittoTransport::disconnect()
+{
+    disconnect_requested_ = true;
+    return mosquitto_disconnect(mosq_);
+}
+
+int MosquittoTransport::start()
+{
+    if (low_latency_.enabled || !auto_reconnect_) {
+        if (network_thread_.joinable()) {
+            return MOSQ_ERR_INVAL;
+        }
+        /* Tells libmosquitto that publishing threads must wake a loop it doesn't own */
+        mosquitto_threaded_set(mosq_, true);
+        stop_network_thread_ = false;
+        network_thread_ = std::thread([this] { runNetworkLoop(); });
+        return MOSQ_ERR_SUCCESS;
+    }
+    int rc = mosquitto_loop_start(mosq_);
+    loop_started_ = rc == MOSQ_ERR_SUCCESS;
+    return rc;
+}
+
+void MosquittoTransport::stop()
+{
+    if (network_thread_.joinable()) {
+        stop_network_thread_ = true;
+        network_thread_.join();
+    }
+    if (loop_started_) {
+        mosquitto_loop_stop(mosq_, true);
+        loop_started_ = false;
+    }
+}
+
+void MosquittoTransport::runNetworkLoop()
+{
+    pthread_setname_np(pthread_self(), "network");
+    if (low_latency_.enabled && low_latency_.network_cpu >= 0 && !pinCurrentThread(low_latency_.network_cpu)) {
+        (void)fprintf(stderr, "Unable to pin the network thread to CPU %d\n", low_latency_.network_cpu);
+    }
+
+    int busy_poll_fd = -1;
+    uint64_t seen_activity = activity_.load(std::memory_order_relaxed);
+    auto last_activity_tp = std::chrono::steady_clock::now();
+    while (!stop_network_thread_) {
+        /* The socket changes on every reconnect */
+        if (low_latency_.enabled && low_latency_.busy_poll_us > 0) {
+            const int fd = mosquitto_socket(mosq_);
+            if (fd >= 0 && fd != busy_poll_fd) {
+                busy_poll_fd = fd;
+                if (int err = setBusyPoll(fd, low_latency_.busy_poll_us); err != 0) {
+                    (void)fprintf(stderr, "Unable to enable SO_BUSY_POLL: %s\n", strerror(err));
+                }
+            }
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool spinning = low_latency_.enabled && now - last_activity_tp < low_latency_.spin;
+        const int rc = mosquitto_loop(mosq_, spinning ? 0 : PARK_TIMEOUT_MS, 1);
+        if (const auto activity = activity_.load(std::memory_order_relaxed); activity != seen_activity) {
+            seen_activity = activity;
+            last_activity_tp = std::chrono::steady_clock::now();
+        }
+        if (rc == MOSQ_ERR_SUCCESS) {
+            continue;
+        }
+
+        if (!auto_reconnect_) {
+            /* Connection lost, whoever turned auto-reconnect off stops this thread and connects again */
+            std::this_thread::sleep_for(std::chrono::milliseconds(PARK_TIMEOUT_MS));
+            continue;
+        }
+        /* Connection lost: like mosquitto_loop_forever(), wait and reconnect unless we were asked to disconnect */
+        const auto reconnect_tp = std::chrono::steady_clock::now() + RECONNECT_DELAY;
+        while (!stop_network_thread_ && std::chrono::steady_clock::now() < reconnect_tp) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(PARK_TIMEOUT_MS));
+        }
+        if (!stop_network_thread_ && !disconnect_requested_) {
+            mosquitto_reconnect(mosq_);
+        }
+    }
+}
+
+int MosquittoTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    return mosquitto_subscribe(mosq_, mid, topic_filter, qos);
+}
+
+int MosquittoTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    /* libmosquitto doesn't modify the filters despite the non-const pointers */
+    return mosquitto_subscribe_multiple(mosq_, mid, count, const_cast<char * const *>(topic_filters), qos, 0, nullptr);
+}
+
+int MosquittoTransport::publish(const char * topic,
+                                const void * payload,
+                                size_t payload_len,
+                                int qos,
+                                bool retain,
+                                int * mid)
+{
+    if (payload_len > INT_MAX) {
+        return MOSQ_ERR_PAYLOAD_SIZE;
+    }
+    return mosquitto_publish(mosq_, mid, topic, static_cast<int>(payload_len), payload, qos, retain);
+}
+
+const char * MosquittoTransport::errorString(int rc) const
+{
+    return mosquitto_strerror(rc);
+}
+
+const char * MosquittoTransport::connackString(int reason_code) const
+{
+    /* mosquitto_connack_string() produces an appropriate string for MQTT v3.x clients, the equivalent for MQTT v5.0
+     * clients is mosquitto_reason_string(). */
+    return mosquitto_connack_string(reason_code);
+}
+
+void MosquittoTransport::onConnect(struct mosquitto * /*mosq*/, void * user_data, int reason_code)
+{
+    static_cast<MosquittoTransport *>(user_data)->notifyConnect(reason_code);
+}
+
+void MosquittoTransport::onDisconnect(struct mosquitto * /*mosq*/, void * user_data, int reason_code)
+{
+    static_cast<MosquittoTransport *>(user_data)->notifyDisconnect(reason_code);
+}
+
+void MosquittoTransport::onSubscribe(struct mosquitto * /*mosq*/,
+                                     void * user_data,
+                                     int mid,
+                                     int qos_count,
+                                     const int * granted_qos)
+{
+    static_cast<MosquittoTransport *>(user_data)->notifySubscribe(mid, qos_count, granted_qos);
+}
+
+void MosquittoTransport::onMessage(struct mosquitto * /*mosq*/, void * user_data, const struct mosquitto_message * msg)
+{
+    TransportMessage message;
+    message.topic = msg->topic;
+    message.payload = msg->payload;
+    message.payload_len = static_cast<size_t>(msg->payloadlen);
+    message.qos = msg->qos;
+    message.retain = msg->retain;
+    message.mid = msg->mid;
+    auto * transport = static_cast<MosquittoTransport *>(user_data);
+    transport->activity_.fetch_add(1, std::memory_order_relaxed);
+    transport->notifyMessage(message);
+}
+
+void MosquittoTransport::onPublish(struct mosquitto * /*mosq*/, void * user_data, int mid)
+{
+    auto * transport = static_cast<MosquittoTransport *>(user_data);
+    transport->activity_.fetch_add(1, std::memory_order_relaxed);
+    transport->notifyPublish(mid);
+}
@@ -0,0 +1,301 @@
+#include "paho_transport.h"
+
+#include <MQTTAsync.h>
+#include <MQTTClientPersistence.h>
+
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <vector>
+
+namespace {
+/* How long the destructor waits for a clean disconnect */
+constexpr auto DISCONNECT_TIMEOUT = std::chrono::seconds(2);
+/* Retry intervals of Paho's automatic reconnect, in seconds */
+constexpr int MIN_RETRY_INTERVAL_SEC = 1;
+constexpr int MAX_RETRY_INTERVAL_SEC = 60;
+
+MQTTAsync handleOf(void * client)
+{
+    return static_cast<MQTTAsync>(client);
+}
+} // namespace
+
+struct PahoCallbacks
+{
+    static PahoTransport & transport(void * context)
+    {
+        return *static_cast<PahoTransport *>(context);
+    }
+
+    static void onConnected(void * context, char * /*cause*/)
+    {
+        auto & self = transport(context);
+        self.connected_ = true;
+        self.notifyConnect(0);
+    }
+
+    static void onConnectFailure(void * context, MQTTAsync_failureData * response)
+    {
+        /* Positive codes are CONNACK return codes, negative ones Paho errors */
+        transport(context).notifyConnect(response != nullptr && response->code != 0 ? response->code
+                                                                                     : MQTTASYNC_FAILURE);
+    }
+
+    static void onConnectionLost(void * context, char * /*cause*/)
+    {
+        auto & self = transport(context);
+        self.connected_ = false;
+        self.notifyDisconnect(MQTTASYNC_DISCONNECTED);
+    }
+
+    static int onMessageArrived(void * context, char * topic_name, int topic_len, MQTTAsync_message * message)
+    {
+        TransportMessage msg;
+        /* A length of 0 means the topic is NUL-terminated */
+        msg.topic = topic_len > 0 ? std::string_view(topic_name, static_cast<size_t>(topic_len))
+                                  : std::string_view(topic_name);
+        msg.payload = message->payload;
+        msg.payload_len = static_cast<size_t>(message->payloadlen);
+        msg.qos = message->qos;
+        msg.retain = message->retained != 0;
+        msg.mid = message->msgid;
+        transport(context).notifyMessage(msg);
+        MQTTAsync_freeMessage(&message);
+        MQTTAsync_free(topic_name);
+        /* Tells Paho the message was handled */
+        return 1;
+    }
+
+    static void onSubscribe(void * context, MQTTAsync_successData * response)
+    {
+        int granted_qos = response->alt.qos;
+        transport(context).notifySubscribe(response->token, 1, &granted_qos);
+    }
+
+    static void onSubscribeFailure(void * context, MQTTAsync_failureData * response)
+    {
+        /* Reported like a SUBACK refusing the subscription */
+        int granted_qos = 0x80;
+        transport(context).notifySubscribe(response->token, 1, &granted_qos);
+    }
+
+    /* Paho's response to subscribeMany doesn't say how many filters it covers */
+    struct SubscribeManyContext
+    {
+        PahoTransport * transport = nullptr;
+        int count = 0;
+    };
+
+    static void onSubscribeMany(void * context, MQTTAsync_successData * response)
+    {
+        std::unique_ptr<SubscribeManyContext> many(static_cast<SubscribeManyContext *>(context));
+        many->transport->notifySubscribe(response->token, many->count, response->alt.qosList);
+    }
+
+    static void onSubscribeManyFailure(void * context, MQTTAsync_failureData * response)
+    {
+        std::unique_ptr<SubscribeManyContext> many(static_cast<SubscribeManyContext *>(context));
+        const std::vector<int> granted_qos(static_cast<size_t>(many->count), 0x80);
+        many->transport->notifySubscribe(response->token, many->count, granted_qos.data());
+    }
+
+    static void onPublish(void * context, MQTTAsync_successData * response)
+    {
+        transport(context).notifyPublish(response->token);
+    }
+
+    static void onDisconnected(void * context, MQTTAsync_successData * /*response*/)
+    {
+        auto & self = transport(context);
+        self.connected_ = false;
+        self.notifyDisconnect(0);
+        self.disconnectDone();
+    }
+
+    static void onDisconnectFailure(void * context, MQTTAsync_failureData * /*response*/)
+    {
+        transport(context).disconnectDone();
+    }
+};
+
+PahoTransport::PahoTransport(std::string client_id, const ConnectionSettings & settings)
+: client_id_(std::move(client_id))
+, settings_(settings)
+{
+    const bool tls = settings_.ca_file || settings_.ca_path || settings_.cert_file;
+    const auto uri = std::string(tls ? "ssl://" : "tcp://") + settings_.host + ":" + std::to_string(settings_.port);
+    MQTTAsync client = nullptr;
+    if (MQTTAsync_create(&client, uri.c_str(), client_id_.c_str(), MQTTCLIENT_PERSISTENCE_NONE, nullptr)
+        != MQTTASYNC_SUCCESS) {
+        return;
+    }
+    client_ = client;
+    MQTTAsync_setCallbacks(
+        client, this, PahoCallbacks::onConnectionLost, PahoCallbacks::onMessageArrived, nullptr);
+    /* Called for the first connection and every automatic reconnect, like mosquitto's connect callback */
+    MQTTAsync_setConnected(client, this, PahoCallbacks::onConnected);
+}
+
+PahoTransport::~PahoTransport()
+{
+    if (client_ == nullptr) {
+        return;
+    }
+    if (connected_ && disconnect() == MQTTASYNC_SUCCESS) {
+        std::unique_lock lk(mutex_);
+        cond_var_.wait_for(lk, DISCONNECT_TIMEOUT, [this] { return !disconnecting_; });
+    }
+    MQTTAsync client = handleOf(client_);
+    MQTTAsync_destroy(&client);
+}
+
+int PahoTransport::connect()
+{
+    MQTTAsync_connectOptions options = MQTTAsync_connectOptions_initializer;
+    options.keepAliveInterval = settings_.keepalive_sec;
+    options.cleansession = 1;
+    options.username = settings_.username;
+    options.password = settings_.password;
+    options.automaticReconnect = auto_reconnect_ ? 1 : 0;
+    options.minRetryInterval = MIN_RETRY_INTERVAL_SEC;
+    options.maxRetryInterval = MAX_RETRY_INTERVAL_SEC;
+    options.onFailure = PahoCallbacks::onConnectFailure;
+    options.context = this;
+
+    MQTTAsync_SSLOptions ssl_options = MQTTAsync_SSLOptions_initializer;
+    if (settings_.ca_file || settings_.ca_path || settings_.cert_file) {
+        ssl_options.trustStore = settings_.ca_file;
+        ssl_options.CApath = settings_.ca_path;
+        ssl_options.keyStore = settings_.cert_file;
+        ssl_options.privateKey = settings_.key_file;
+        ssl_options.privateKeyPassword = settings_.pass_phrase;
+        ssl_options.verify = 1;
+        options.ssl = &ssl_options;
+    }
+    return MQTTAsync_connect(handleOf(client_), &options);
+}
+
+int PahoTransport::disconnect()
+{
+    MQTTAsync_disconnectOptions options = MQTTAsync_disconnectOptions_initializer;
+    options.onSuccess = PahoCallbacks::onDisconnected;
+    options.onFailure = PahoCallbacks::onDisconnectFailure;
+    options.context = this;
+    {
+        std::lock_guard lk(mutex_);
+        disconnecting_ = true;
+    }
+    int rc = MQTTAsync_disconnect(handleOf(client_), &options);
+    if (rc != MQTTASYNC_SUCCESS) {
+        disconnectDone();
+    }
+    return rc;
+}
+
+void PahoTransport::disconnectDone()
+{
+    {
+        std::lock_guard lk(mutex_);
+        disconnecting_ = false;
+    }
+    cond_var_.notify_all();
+}
+
+int PahoTransport::start()
+{
+    /* Paho's threads already run */
+    return MQTTASYNC_SUCCESS;
+}
+
+void PahoTransport::stop()
+{
+}
+
+int PahoTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    MQTTAsync_responseOptions options = MQTTAsync_responseOptions_initializer;
+    options.onSuccess = PahoCallbacks::onSubscribe;
+    options.onFailure = PahoCallbacks::onSubscribeFailure;
+    options.context = this;
+    int rc = MQTTAsync_subscribe(handleOf(client_), topic_filter, qos, &options);
+    if (rc == MQTTASYNC_SUCCESS && mid != nullptr) {
+        *mid = options.token;
+    }
+    return rc;
+}
+
+int PahoTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    if (count == 1) {
+        /* A single granted QoS comes back in alt.qos rather than alt.qosList */
+        return subscribe(topic_filters[0], qos, mid);
+    }
+    auto context = std::make_unique<PahoCallbacks::SubscribeManyContext>();
+    context->transport = this;
+    context->count = count;
+    const std::vector<int> qos_list(static_cast<size_t>(count), qos);
+    MQTTAsync_responseOptions options = MQTTAsync_responseOptions_initializer;
+    options.onSuccess = PahoCallbacks::onSubscribeMany;
+    options.onFailure = PahoCallbacks::onSubscribeManyFailure;
+    options.context = context.get();
+    /* Paho copies the filters despite the non-const pointers */
+    int rc = MQTTAsync_subscribeMany(
+        handleOf(client_), count, const_cast<char * const *>(topic_filters), qos_list.data(), &options);
+    if (rc == MQTTASYNC_SUCCESS) {
+        /* Owned by the callbacks from now on */
+        (void)context.release();
+        if (mid != nullptr) {
+            *mid = options.token;
+        }
+    }
+    return rc;
+}
+
+int PahoTransport::publish(const char * topic,
+                           const void * payload,
+                           size_t payload_len,
+                           int qos,
+                           bool retain,
+                           int * mid)
+{
+    if (payload_len > static_cast<size_t>(INT_MAX)) {
+        return MQTTASYNC_FAILURE;
+    }
+    MQTTAsync_responseOptions options = MQTTAsync_responseOptions_initializer;
+    options.onSuccess = PahoCallbacks::onPublish;
+    options.context = this;
+    int rc = MQTTAsync_send(
+        handleOf(client_), topic, static_cast<int>(payload_len), payload, qos, retain ? 1 : 0, &options);
+    if (rc == MQTTASYNC_SUCCESS && mid != nullptr) {
+        *mid = options.token;
+    }
+    return rc;
+}
+
+const char * PahoTransport::errorString(int rc) const
+{
+    const char * error = MQTTAsync_strerror(rc);
+    return error != nullptr ? error : "Unknown error.";
+}
+
+const char * PahoTransport::connackString(int reason_code) const
+{
+    /* MQTT 3.1.1 CONNACK return codes, worded like mosquitto_connack_string() */
+    switch (reason_code) {
+        case 0:
+            return "Connection Accepted.";
+        case 1:
+            return "Connection Refused: unacceptable protocol version.";
+        case 2:
+            return "Connection Refused: identifier rejected.";
+        case 3:
+            return "Connection Refused: broker unavailable.";
+        case 4:
+            return "Connection Refused: bad user name or password.";
+        case 5:
+            return "Connection Refused: not authorised.";
+        default:
+            return reason_code < 0 ? errorString(reason_code) : "Connection Refused: unknown reason.";
+    }
+}
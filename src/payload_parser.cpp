@@ -0,0 +1,120 @@
+#include "payload_parser.h"
+
+namespace {
+
+/* Just enough of a JSON tokenizer to walk the fields of one object */
+class JsonScanner
+{
+public:
+    explicit JsonScanner(std::string_view text)
+    : text_(text)
+    {
+    }
+
+    void skipWhitespace()
+    {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r' || text_[pos_] == '\n')) {
+            ++pos_;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    /* Contents of a string, escapes left in place */
+    std::optional<std::string_view> string()
+    {
+        if (!consume('"')) {
+            return std::nullopt;
+        }
+        const size_t begin = pos_;
+        for (; pos_ < text_.size(); ++pos_) {
+            if (text_[pos_] == '\\') {
+                ++pos_;
+            } else if (text_[pos_] == '"') {
+                return text_.substr(begin, pos_++ - begin);
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<std::string_view> value()
+    {
+        skipWhitespace();
+        if (pos_ >= text_.size()) {
+            return std::nullopt;
+        }
+        const char c = text_[pos_];
+        if (c == '"') {
+            return string();
+        }
+        const size_t begin = pos_;
+        if (c == '{' || c == '[') {
+            return skipNested() ? std::optional(text_.substr(begin, pos_ - begin)) : std::nullopt;
+        }
+        while (pos_ < text_.size() && std::string_view(",}] \t\r\n").find(text_[pos_]) == std::string_view::npos) {
+            ++pos_;
+        }
+        if (pos_ == begin) {
+            return std::nullopt;
+        }
+        return text_.substr(begin, pos_ - begin);
+    }
+
+private:
+    /* Skips a whole object or array, including brackets inside strings */
+    bool skipNested()
+    {
+        int depth = 0;
+        for (; pos_ < text_.size(); ++pos_) {
+            const char c = text_[pos_];
+            if (c == '"') {
+                if (!string()) {
+                    return false;
+                }
+                --pos_;
+            } else if (c == '{' || c == '[') {
+                ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                ++pos_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+};
+
+} // namespace
+
+std::optional<std::string_view> findJsonField(std::string_view json, std::string_view key)
+{
+    JsonScanner scanner(json);
+    if (!scanner.consume('{') || scanner.consume('}')) {
+        return std::nullopt;
+    }
+    do {
+        auto field_key = scanner.string();
+        if (!field_key || !scanner.consume(':')) {
+            return std::nullopt;
+        }
+        auto value = scanner.value();
+        if (!value) {
+            return std::nullopt;
+        }
+        if (*field_key == key) {
+            return value;
+        }
+    } while (scanner.consume(','));
+    return std::nullopt;
+}
@@ -0,0 +1,282 @@
+/* clock_nanosleep() and friends */
+#define _POSIX_C_SOURCE 200809L
+
+#include "periodic_scheduler.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#define HAVE_TIMERFD 1
+#endif
+
+#define NS_PER_SEC 1000000000LL
+
+/* Lateness below LINEAR_BUCKETS ns is counted exactly, above it each power of two is split into SUB_BUCKETS */
+enum
+{
+    SUB_BUCKET_BITS = 3,
+    SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+    LINEAR_BUCKETS = 2 * SUB_BUCKETS,
+    NUM_BUCKETS = LINEAR_BUCKETS + (63 - SUB_BUCKET_BITS - 1) * SUB_BUCKETS,
+};
+
+struct PeriodicScheduler
+{
+    int64_t period_ns;
+    int64_t spin_ns;
+    enum PeriodicOverrunPolicy policy;
+    int64_t start_ns;
+    /* Ticks returned so far, the next one is due at start_ns + (tick + 1) * period_ns */
+    uint64_t tick;
+    int timer_fd;
+    /* Becomes readable on cancel, so a wait blocked in poll() returns */
+    int cancel_fd;
+    atomic_int cancelled;
+
+    uint64_t overruns;
+    uint64_t skipped;
+    uint64_t samples;
+    int64_t max_lateness_ns;
+    uint64_t histogram[NUM_BUCKETS];
+};
+
+static int64_t monotonicNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static struct timespec toTimespec(int64_t ns)
+{
+    struct timespec ts = { ns / NS_PER_SEC, ns % NS_PER_SEC };
+    return ts;
+}
+
+static void cpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static int bucketIndex(int64_t ns)
+{
+    if (ns < LINEAR_BUCKETS) {
+        return ns < 0 ? 0 : (int)ns;
+    }
+    const int exponent = 63 - __builtin_clzll((unsigned long long)ns);
+    const int sub_bucket = (int)(ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return LINEAR_BUCKETS + (exponent - SUB_BUCKET_BITS - 1) * SUB_BUCKETS + sub_bucket;
+}
+
+/* Middle of the values counted by bucket `index` */
+static int64_t bucketValue(int index)
+{
+    if (index < LINEAR_BUCKETS) {
+        return index;
+    }
+    const int exponent = (index - LINEAR_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS + 1;
+    const int64_t sub_bucket = (index - LINEAR_BUCKETS) % SUB_BUCKETS;
+    const int64_t width = INT64_C(1) << (exponent - SUB_BUCKET_BITS);
+    return (SUB_BUCKETS + sub_bucket) * width + width / 2;
+}
+
+static void recordLateness(struct PeriodicScheduler * scheduler, int64_t lateness_ns)
+{
+    ++scheduler->histogram[bucketIndex(lateness_ns)];
+    ++scheduler->samples;
+    if (lateness_ns > scheduler->max_lateness_ns) {
+        scheduler->max_lateness_ns = lateness_ns;
+    }
+}
+
+/* Blocks until `deadline_ns`, returns -1 when cancelled first */
+static int sleepUntil(struct PeriodicScheduler * scheduler, int64_t deadline_ns)
+{
+    const struct timespec deadline = toTimespec(deadline_ns);
+#if defined(HAVE_TIMERFD)
+    if (scheduler->timer_fd >= 0) {
+        const struct itimerspec spec = { { 0, 0 }, deadline };
+        if (timerfd_settime(scheduler->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+            struct pollfd fds[2] = { { scheduler->timer_fd, POLLIN, 0 }, { scheduler->cancel_fd, POLLIN, 0 } };
+            while (!atomic_load(&scheduler->cancelled)) {
+                if (poll(fds, 2, -1) < 0) {
+                    continue; /* EINTR */
+                }
+                if (fds[0].revents & POLLIN) {
+                    uint64_t expirations = 0;
+                    ssize_t rc = read(scheduler->timer_fd, &expirations, sizeof(expirations));
+                    (void)rc;
+                    return 0;
+                }
+            }
+            return -1;
+        }
+    }
+#endif
+    /* Cancelling from a signal handler interrupts this with EINTR, from another thread it takes effect on return */
+    while (!atomic_load(&scheduler->cancelled)) {
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != EINTR) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct PeriodicScheduler * periodicSchedulerCreate(int64_t period_ns,
+                                                   enum PeriodicOverrunPolicy policy,
+                                                   int64_t spin_ns)
+{
+    if (period_ns < 0) {
+        return NULL;
+    }
+    struct PeriodicScheduler * scheduler = calloc(1, sizeof(*scheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    scheduler->period_ns = period_ns;
+    scheduler->spin_ns = spin_ns > 0 ? spin_ns : 0;
+    scheduler->policy = policy;
+    scheduler->timer_fd = -1;
+    scheduler->cancel_fd = -1;
+    atomic_init(&scheduler->cancelled, 0);
+#if defined(HAVE_TIMERFD)
+    /* Without them waits fall back to clock_nanosleep() */
+    scheduler->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    scheduler->cancel_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (scheduler->timer_fd < 0 || scheduler->cancel_fd < 0) {
+        if (scheduler->timer_fd >= 0) {
+            close(scheduler->timer_fd);
+            scheduler->timer_fd = -1;
+        }
+        if (scheduler->cancel_fd >= 0) {
+            close(scheduler->cancel_fd);
+            scheduler->cancel_fd = -1;
+        }
+    }
+#endif
+    scheduler->start_ns = monotonicNow();
+    return scheduler;
+}
+
+void periodicSchedulerDestroy(struct PeriodicScheduler * scheduler)
+{
+    if (scheduler == NULL) {
+        return;
+    }
+    if (scheduler->timer_fd >= 0) {
+        close(scheduler->timer_fd);
+    }
+    if (scheduler->cancel_fd >= 0) {
+        close(scheduler->cancel_fd);
+    }
+    free(scheduler);
+}
+
+int periodicSchedulerWait(struct PeriodicScheduler * scheduler)
+{
+    if (atomic_load(&scheduler->cancelled)) {
+        return -1;
+    }
+    if (scheduler->period_ns == 0) {
+        return 0;
+    }
+
+    int64_t due_ns = scheduler->start_ns + (int64_t)(scheduler->tick + 1) * scheduler->period_ns;
+    int64_t now_ns = monotonicNow();
+    int skipped = 0;
+    if (now_ns >= due_ns) {
+        ++scheduler->overruns;
+        if (scheduler->policy == PERIODIC_SKIP) {
+            /* First tick strictly after now */
+            const uint64_t next_tick = (uint64_t)((now_ns - scheduler->start_ns) / scheduler->period_ns) + 1;
+            skipped = (int)(next_tick - scheduler->tick - 1);
+            scheduler->skipped += (uint64_t)skipped;
+            scheduler->tick = next_tick - 1;
+            due_ns = scheduler->start_ns + (int64_t)next_tick * scheduler->period_ns;
+        }
+    }
+
+    if (now_ns < due_ns) {
+        if (due_ns - scheduler->spin_ns > now_ns && sleepUntil(scheduler, due_ns - scheduler->spin_ns) != 0) {
+            return -1;
+        }
+        while ((now_ns = monotonicNow()) < due_ns) {
+            if (atomic_load_explicit(&scheduler->cancelled, memory_order_relaxed)) {
+                return -1;
+            }
+            cpuRelax();
+        }
+    }
+    ++scheduler->tick;
+    recordLateness(scheduler, now_ns - due_ns);
+    return skipped;
+}
+
+void periodicSchedulerCancel(struct PeriodicScheduler * scheduler)
+{
+    atomic_store(&scheduler->cancelled, 1);
+    if (scheduler->cancel_fd >= 0) {
+        const uint64_t one = 1;
+        ssize_t rc = write(scheduler->cancel_fd, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+int periodicOverrunPolicyParse(const char * text, enum PeriodicOverrunPolicy * policy)
+{
+    if (strcmp(text, "catch-up") == 0) {
+        *policy = PERIODIC_CATCH_UP;
+    } else if (strcmp(text, "skip") == 0) {
+        *policy = PERIODIC_SKIP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int64_t periodicSchedulerLatenessQuantile(const struct PeriodicScheduler * scheduler, double q)
+{
+    if (scheduler->samples == 0) {
+        return 0;
+    }
+    const double rank = ceil(q * (double)scheduler->samples);
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        seen += scheduler->histogram[i];
+        if (seen > 0 && (double)seen >= rank) {
+            const int64_t value = bucketValue(i);
+            return value < scheduler->max_lateness_ns ? value : scheduler->max_lateness_ns;
+        }
+    }
+    return scheduler->max_lateness_ns;
+}
+
+void periodicSchedulerPrintStats(const struct PeriodicScheduler * scheduler, FILE * out, const char * name)
+{
+    (void)fprintf(out,
+                  "Schedule (%s): ticks=%" PRIu64 " overruns=%" PRIu64 " skipped=%" PRIu64
+                  " lateness p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+                  name,
+                  scheduler->samples,
+                  scheduler->overruns,
+                  scheduler->skipped,
+                  (double)periodicSchedulerLatenessQuantile(scheduler, 0.5) / 1000.0,
+                  (double)periodicSchedulerLatenessQuantile(scheduler, 0.99) / 1000.0,
+                  (double)periodicSchedulerLatenessQuantile(scheduler, 0.999) / 1000.0,
+                  (double)scheduler->max_lateness_ns / 1000.0);
+    (void)fflush(out);
+}
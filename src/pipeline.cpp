@@ -0,0 +1,213 @@
+#include "pipeline.h"
+
+#include "payload_parser.h"
+#include "topic_filter.h"
+
+#include <charconv>
+#include <chrono>
+
+namespace {
+/* Window stats are published under this prefix internally, then re-topiced by the publish stage */
+constexpr std::string_view WINDOW_TOPIC_PREFIX = "$pipeline-window";
+constexpr std::string_view SOURCE_TOPIC_PLACEHOLDER = "{topic}";
+
+/* Splits "a:b:c" into its first part and the rest */
+std::pair<std::string_view, std::string_view> splitFirst(std::string_view s, char separator)
+{
+    const auto pos = s.find(separator);
+    if (pos == std::string_view::npos) {
+        return { s, {} };
+    }
+    return { s.substr(0, pos), s.substr(pos + 1) };
+}
+
+std::chrono::milliseconds parseSeconds(std::string_view text)
+{
+    auto seconds = parseNumber<double>(text);
+    return std::chrono::milliseconds(seconds && *seconds > 0 ? static_cast<int64_t>(*seconds * 1000) : 0);
+}
+} // namespace
+
+Pipeline::Pipeline(Output output)
+: output_(std::move(output))
+{
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+}
+
+std::unique_ptr<Pipeline> Pipeline::create(std::string_view spec, Output output)
+{
+    std::unique_ptr<Pipeline> pipeline(new Pipeline(std::move(output)));
+    bool have_publish = false;
+    while (!spec.empty()) {
+        auto [stage_spec, rest] = splitFirst(spec, '|');
+        spec = rest;
+        auto [name, args] = splitFirst(trimPayload(stage_spec), ':');
+        /* Only publish may follow publish or window */
+        if (have_publish || (pipeline->window_ && name != "publish")) {
+            return nullptr;
+        }
+
+        if (name == "filter") {
+            if (!isValidTopicFilter(args)) {
+                return nullptr;
+            }
+            pipeline->stages_.push_back({ Stage::Kind::FILTER, std::string(args) });
+        } else if (name == "field") {
+            if (args.empty()) {
+                return nullptr;
+            }
+            pipeline->stages_.push_back({ Stage::Kind::FIELD, std::string(args) });
+        } else if (name == "range" || name == "scale") {
+            auto [first, second] = splitFirst(args, ':');
+            auto a = parseNumber<double>(first);
+            auto b = parseNumber<double>(second);
+            if (!a || !b) {
+                return nullptr;
+            }
+            pipeline->stages_.push_back({ name == "range" ? Stage::Kind::RANGE : Stage::Kind::SCALE, {}, *a, *b });
+        } else if (name == "window") {
+            auto [window_spec, slide_spec] = splitFirst(args, ':');
+            const auto window = parseSeconds(window_spec);
+            const auto slide = slide_spec.empty() ? window : parseSeconds(slide_spec);
+            if (window.count() <= 0 || slide.count() <= 0) {
+                return nullptr;
+            }
+            auto * self = pipeline.get();
+            pipeline->window_ = std::make_unique<WindowAggregator>(
+                window,
+                slide,
+                std::string(WINDOW_TOPIC_PREFIX),
+                "",
+                [self](const std::string & topic, const std::string & payload) {
+                    self->emit(std::string_view(topic).substr(WINDOW_TOPIC_PREFIX.size() + 1), payload);
+                });
+        } else if (name == "publish") {
+            const auto placeholder = args.find(SOURCE_TOPIC_PLACEHOLDER);
+            pipeline->topic_has_source_ = placeholder != std::string_view::npos;
+            pipeline->topic_prefix_ = args.substr(0, placeholder);
+            if (pipeline->topic_has_source_) {
+                pipeline->topic_suffix_ = args.substr(placeholder + SOURCE_TOPIC_PLACEHOLDER.size());
+            }
+            if (!isValidTopicName(pipeline->topic_prefix_ + "x" + pipeline->topic_suffix_)) {
+                return nullptr;
+            }
+            if (pipeline->topic_has_source_ && pipeline->topic_prefix_.empty() && pipeline->topic_suffix_.empty()) {
+                /* Every output would land back on its source topic */
+                return nullptr;
+            }
+            have_publish = true;
+        } else {
+            return nullptr;
+        }
+    }
+    return have_publish ? std::move(pipeline) : nullptr;
+}
+
+void Pipeline::process(std::string_view topic, std::string_view payload)
+{
+    if (isOwnOutput(topic)) {
+        num_own_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    num_in_.fetch_add(1, std::memory_order_relaxed);
+    Message msg{ topic, payload, std::nullopt, {} };
+    for (const auto & stage : stages_) {
+        if (!runStage(stage, msg)) {
+            num_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (window_) {
+        if (!window_->add(msg.topic, msg.payload)) {
+            num_dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    emit(msg.topic, msg.payload);
+}
+
+bool Pipeline::runStage(const Stage & stage, Message & msg) const
+{
+    switch (stage.kind) {
+        case Stage::Kind::FILTER:
+            return topicMatchesFilter(stage.text, msg.topic);
+        case Stage::Kind::FIELD: {
+            auto field = findJsonField(msg.payload, stage.text);
+            if (!field) {
+                return false;
+            }
+            msg.payload = *field;
+            msg.value.reset();
+            return true;
+        }
+        case Stage::Kind::RANGE:
+            if (!msg.value) {
+                msg.value = parseNumber<double>(msg.payload);
+            }
+            return msg.value && *msg.value >= stage.a && *msg.value <= stage.b;
+        case Stage::Kind::SCALE: {
+            if (!msg.value) {
+                msg.value = parseNumber<double>(msg.payload);
+            }
+            if (!msg.value) {
+                return false;
+            }
+            *msg.value = stage.a * *msg.value + stage.b;
+            auto [end, ec] = std::to_chars(msg.scratch.data(), msg.scratch.data() + msg.scratch.size(), *msg.value);
+            if (ec != std::errc()) {
+                return false;
+            }
+            msg.payload = std::string_view(msg.scratch.data(), static_cast<size_t>(end - msg.scratch.data()));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Pipeline::isOwnOutput(std::string_view topic) const
+{
+    if (!topic_has_source_) {
+        return topic == topic_prefix_;
+    }
+    return topic.size() > topic_prefix_.size() + topic_suffix_.size() && topic.starts_with(topic_prefix_)
+           && topic.ends_with(topic_suffix_);
+}
+
+void Pipeline::emit(std::string_view topic, std::string_view payload)
+{
+    if (topic_has_source_) {
+        /* Keeps its capacity, so building the output topic doesn't allocate after the first few messages */
+        thread_local std::string output_topic;
+        output_topic.assign(topic_prefix_);
+        output_topic.append(topic);
+        output_topic.append(topic_suffix_);
+        output_(output_topic, payload);
+    } else {
+        output_(topic_prefix_, payload);
+    }
+    num_out_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Pipeline::start()
+{
+    if (window_) {
+        window_->start();
+    }
+}
+
+void Pipeline::stop()
+{
+    if (window_) {
+        window_->stop();
+    }
+}
+
+void Pipeline::printStats(std::ostream & os) const
+{
+    os << "Pipeline: in=" << num_in_.load() << " out=" << num_out_.load() << " dropped=" << num_dropped_.load()
+       << " own=" << num_own_.load() << std::endl;
+}
@@ -0,0 +1,431 @@
+#include "priority_transport.h"
+
+#include "topic_filter.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+
+namespace {
+
+/* Splits off the part of `spec` before the first `separator` */
+std::string_view nextField(std::string_view & spec, char separator)
+{
+    const auto end = spec.find(separator);
+    const auto field = spec.substr(0, end);
+    spec = end == std::string_view::npos ? std::string_view() : spec.substr(end + 1);
+    return field;
+}
+
+} // namespace
+
+std::optional<PriorityLaneOptions> PriorityLaneOptions::parse(std::string_view spec)
+{
+    PriorityLaneOptions options;
+    while (!spec.empty()) {
+        auto fields = nextField(spec, ';');
+        PriorityLane & lane = options.lanes.emplace_back();
+        lane.name = nextField(fields, ':');
+        for (auto filters = nextField(fields, ':'); !filters.empty();) {
+            const auto filter = nextField(filters, ',');
+            if (!isValidTopicFilter(filter)) {
+                return std::nullopt;
+            }
+            lane.filters.emplace_back(filter);
+        }
+        if (lane.name.empty() || lane.filters.empty()) {
+            return std::nullopt;
+        }
+        while (!fields.empty()) {
+            const auto field = nextField(fields, ':');
+            if (field == "own") {
+                lane.own_connection = true;
+                continue;
+            }
+            auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), lane.weight);
+            if (ec != std::errc() || ptr != field.data() + field.size() || lane.weight <= 0) {
+                return std::nullopt;
+            }
+        }
+    }
+    if (options.lanes.empty()) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+size_t PriorityLaneOptions::laneFor(std::string_view topic) const
+{
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        for (const auto & filter : lanes[i].filters) {
+            if (topicMatchesFilter(filter, topic)) {
+                return i;
+            }
+        }
+    }
+    return lanes.size() - 1;
+}
+
+PriorityTransport::PriorityTransport(std::unique_ptr<Transport> shared, PriorityLaneOptions options)
+: options_(std::move(options))
+{
+    options_.queue.max_in_flight = std::max(options_.queue.max_in_flight, 1);
+    auto & connection = *connections_.emplace_back(std::make_unique<Connection>());
+    connection.transport = std::move(shared);
+    attach(connection);
+    for (const auto & config : options_.lanes) {
+        auto & lane = *lanes_.emplace_back(std::make_unique<Lane>(config, options_.queue));
+        lane.connection = &connection;
+        connection.lanes.push_back(&lane);
+    }
+}
+
+PriorityTransport::~PriorityTransport()
+{
+    /* The connections' network threads call back into us */
+    stop();
+}
+
+void PriorityTransport::attach(Connection & connection)
+{
+    auto & t = *connection.transport;
+    t.setConnectCallback([this, &connection](Transport &, int reason_code) {
+        onConnectionConnect(connection, reason_code);
+    });
+    t.setDisconnectCallback([this, &connection](Transport &, int reason_code) {
+        onConnectionDisconnect(connection, reason_code);
+    });
+    t.setPublishCallback([this, &connection](Transport &, int mid) { onConnectionPublish(connection, mid); });
+    if (&connection == connections_.front().get()) {
+        t.setSubscribeCallback([this](Transport &, int mid, int qos_count, const int * granted_qos) {
+            notifySubscribe(mid, qos_count, granted_qos);
+        });
+        t.setMessageCallback([this](Transport &, const TransportMessage & msg) { notifyMessage(msg); });
+    }
+}
+
+void PriorityTransport::setLaneConnection(size_t lane, std::unique_ptr<Transport> transport)
+{
+    auto & connection = *connections_.emplace_back(std::make_unique<Connection>());
+    connection.transport = std::move(transport);
+    attach(connection);
+    Lane & l = *lanes_.at(lane);
+    auto & shared_lanes = l.connection->lanes;
+    shared_lanes.erase(std::remove(shared_lanes.begin(), shared_lanes.end(), &l), shared_lanes.end());
+    l.connection = &connection;
+    connection.lanes.push_back(&l);
+}
+
+int PriorityTransport::nextMid()
+{
+    return static_cast<int>(next_mid_.fetch_add(1, std::memory_order_relaxed) % INT_MAX) + 1;
+}
+
+int PriorityTransport::connect()
+{
+    {
+        std::lock_guard lk(mutex_);
+        closed_ = false;
+        num_connected_ = 0;
+        for (auto & connection : connections_) {
+            connection->connected_once = false;
+        }
+    }
+    for (auto & connection : connections_) {
+        if (int rc = connection->transport->connect(); rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int PriorityTransport::disconnect()
+{
+    int first_error = 0;
+    for (auto & connection : connections_) {
+        if (int rc = connection->transport->disconnect(); rc != 0 && first_error == 0) {
+            first_error = rc;
+        }
+    }
+    return first_error;
+}
+
+int PriorityTransport::start()
+{
+    {
+        std::lock_guard lk(mutex_);
+        closed_ = false;
+    }
+    for (auto & connection : connections_) {
+        if (int rc = connection->transport->start(); rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+void PriorityTransport::stop()
+{
+    {
+        std::lock_guard lk(mutex_);
+        closed_ = true;
+        for (auto & lane : lanes_) {
+            lane->queue.wakeAll();
+        }
+    }
+    for (auto & connection : connections_) {
+        connection->transport->stop();
+    }
+}
+
+int PriorityTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    return connections_.front()->transport->subscribe(topic_filter, qos, mid);
+}
+
+int PriorityTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    return connections_.front()->transport->subscribeMultiple(topic_filters, count, qos, mid);
+}
+
+int PriorityTransport::publish(const char * topic,
+                               const void * payload,
+                               size_t payload_len,
+                               int qos,
+                               bool retain,
+                               int * mid)
+{
+    const int outer_mid = nextMid();
+    if (mid != nullptr) {
+        *mid = outer_mid;
+    }
+    Lane & lane = *lanes_[lanes_.size() == 1 ? 0 : options_.laneFor(topic)];
+    Connection & connection = *lane.connection;
+    std::unique_lock lk(mutex_);
+    if (lane.queue.empty() && connection.connected && connection.in_flight_count < options_.queue.max_in_flight) {
+        /* Nothing of this lane to overtake, whatever the other lanes have queued */
+        ++connection.in_flight_count;
+        lane.wait_us.add(0);
+        lk.unlock();
+        int rc = 0;
+        if (send(lane, topic, payload, payload_len, qos, retain, outer_mid, rc)) {
+            return rc;
+        }
+        /* Disconnected in the meantime, queued below like any other message while disconnected */
+        lk.lock();
+    }
+
+    if (int rc = lane.queue.push(lk, closed_, topic, payload, payload_len, qos, retain, outer_mid); rc != 0) {
+        return rc;
+    }
+    lk.unlock();
+
+    /* Slots may have freed up while we queued */
+    drain(connection);
+    return 0;
+}
+
+PriorityTransport::Lane * PriorityTransport::pickLane(Connection & connection)
+{
+    /* Every lane with something queued earns its weight, the richest sends and pays for the round */
+    Lane * best = nullptr;
+    int64_t total = 0;
+    for (Lane * lane : connection.lanes) {
+        if (lane->queue.empty()) {
+            continue;
+        }
+        lane->credit += lane->config.weight;
+        total += lane->config.weight;
+        if (best == nullptr || lane->credit > best->credit) {
+            best = lane;
+        }
+    }
+    if (best != nullptr) {
+        best->credit -= total;
+    }
+    return best;
+}
+
+bool PriorityTransport::send(Lane & lane,
+                             const char * topic,
+                             const void * payload,
+                             size_t payload_len,
+                             int qos,
+                             bool retain,
+                             int mid,
+                             int & rc)
+{
+    Connection & connection = *lane.connection;
+    int inner_mid = 0;
+    rc = connection.transport->publish(topic, payload, payload_len, qos, retain, &inner_mid);
+    bool done = false;
+    {
+        std::lock_guard lk(mutex_);
+        if (rc != 0) {
+            --connection.in_flight_count;
+            if (!connection.connected) {
+                return false;
+            }
+            ++lane.failed;
+            return true;
+        }
+        ++lane.sent;
+        if (connection.early.erase(inner_mid) != 0) {
+            --connection.in_flight_count;
+            done = true;
+        } else {
+            connection.in_flight.emplace(inner_mid, InFlight{ mid, qos, &lane });
+        }
+    }
+    if (done) {
+        notifyPublish(mid);
+    }
+    return true;
+}
+
+void PriorityTransport::drain(Connection & connection)
+{
+    std::unique_lock lk(mutex_);
+    if (connection.draining) {
+        /* A drain further up this or another thread's stack picks up the freed slot */
+        return;
+    }
+    connection.draining = true;
+    while (connection.connected && connection.in_flight_count < options_.queue.max_in_flight) {
+        Lane * lane = pickLane(connection);
+        if (lane == nullptr) {
+            break;
+        }
+        auto entry = lane->queue.pop();
+        ++connection.in_flight_count;
+        const std::chrono::duration<double, std::micro> waited = std::chrono::steady_clock::now() - entry.enqueue_tp;
+        lane->wait_us.add(waited.count());
+        lk.unlock();
+        /* Already accepted by publish(), a failure can only be counted */
+        int rc = 0;
+        const bool sent = send(*lane,
+                               entry.topic.c_str(),
+                               entry.payload.data(),
+                               entry.payload.size(),
+                               entry.qos,
+                               entry.retain,
+                               entry.mid,
+                               rc);
+        lk.lock();
+        if (!sent) {
+            /* Back to the front of its lane until reconnected */
+            lane->queue.pushFront(std::move(entry));
+            break;
+        }
+    }
+    connection.draining = false;
+}
+
+void PriorityTransport::onConnectionPublish(Connection & connection, int mid)
+{
+    std::optional<int> outer_mid;
+    {
+        std::lock_guard lk(mutex_);
+        if (auto it = connection.in_flight.find(mid); it != connection.in_flight.end()) {
+            outer_mid = it->second.mid;
+            connection.in_flight.erase(it);
+            --connection.in_flight_count;
+        } else {
+            connection.early.insert(mid);
+        }
+    }
+    if (outer_mid) {
+        notifyPublish(*outer_mid);
+        drain(connection);
+    }
+}
+
+void PriorityTransport::onConnectionConnect(Connection & connection, int reason_code)
+{
+    if (reason_code != 0) {
+        notifyConnect(reason_code);
+        return;
+    }
+    bool notify = false;
+    {
+        std::lock_guard lk(mutex_);
+        connection.connected = true;
+        if (!connection.connected_once) {
+            connection.connected_once = true;
+            notify = ++num_connected_ == connections_.size();
+        } else {
+            /* Only the shared connection holds subscriptions to renew */
+            notify = &connection == connections_.front().get() && num_connected_ == connections_.size();
+        }
+    }
+    if (notify) {
+        notifyConnect(0);
+    }
+    drain(connection);
+}
+
+void PriorityTransport::onConnectionDisconnect(Connection & connection, int reason_code)
+{
+    {
+        std::lock_guard lk(mutex_);
+        connection.connected = false;
+        /* QoS 0 messages not yet written are dropped with the connection, without a completion. QoS 1 and 2 ones are
+         * resent by the connection once reconnected. */
+        for (auto it = connection.in_flight.begin(); it != connection.in_flight.end();) {
+            if (it->second.qos == 0) {
+                ++it->second.lane->failed;
+                --connection.in_flight_count;
+                it = connection.in_flight.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        /* The connection may reuse their mids once reconnected */
+        connection.early.clear();
+    }
+    notifyDisconnect(reason_code);
+}
+
+const char * PriorityTransport::errorString(int rc) const
+{
+    switch (rc) {
+        case QUEUE_ERR_FULL:
+            return "Outgoing queue full.";
+        case QUEUE_ERR_CLOSED:
+            return "Outgoing queue closed.";
+        default:
+            return connections_.front()->transport->errorString(rc);
+    }
+}
+
+const char * PriorityTransport::connackString(int reason_code) const
+{
+    return connections_.front()->transport->connackString(reason_code);
+}
+
+PriorityTransport::LaneStats PriorityTransport::laneStats(size_t lane) const
+{
+    std::lock_guard lk(mutex_);
+    const Lane & l = *lanes_.at(lane);
+    LaneStats stats;
+    stats.sent = l.sent;
+    stats.failed = l.failed;
+    stats.queue = l.queue.stats();
+    return stats;
+}
+
+void PriorityTransport::printStats(std::ostream & os) const
+{
+    std::lock_guard lk(mutex_);
+    for (const auto & lane : lanes_) {
+        const auto queue = lane->queue.stats();
+        os << "Lane " << lane->config.name << ": weight=" << lane->config.weight
+           << " connection=" << (lane->connection == connections_.front().get() ? "shared" : "own")
+           << " sent=" << lane->sent << " dropped=" << queue.dropped_oldest + queue.dropped_newest
+           << " conflated=" << queue.conflated << " blocked=" << queue.blocked << " failed=" << lane->failed
+           << " queued=" << queue.queued << " max_queued=" << queue.max_queued
+           << " wait_us p50=" << lane->wait_us.quantile(0.5) << " p99=" << lane->wait_us.quantile(0.99)
+           << " max=" << lane->wait_us.quantile(1.0) << std::endl;
+    }
+}
@@ -0,0 +1,124 @@
+#include "publish_batcher.h"
+
+#include <algorithm>
+
+PublishBatcher::PublishBatcher(size_t batch_size,
+                               std::chrono::microseconds linger,
+                               size_t max_pending,
+                               Publisher publisher)
+: batch_size_(std::max<size_t>(batch_size, 1))
+, linger_(linger)
+, max_pending_(std::max(max_pending, batch_size_))
+, publisher_(std::move(publisher))
+{
+}
+
+PublishBatcher::~PublishBatcher()
+{
+    stop();
+}
+
+void PublishBatcher::add(std::string_view topic, std::string_view payload)
+{
+    bool wake = false;
+    {
+        std::lock_guard lk(mutex_);
+        if (stopping_ || pending_.entries.size() >= max_pending_) {
+            num_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto & arena = pending_.arena;
+        if (pending_.entries.empty()) {
+            /* Starts the linger timer */
+            oldest_tp_ = std::chrono::steady_clock::now();
+            wake = true;
+        }
+        Entry entry{ arena.size(), arena.size() + topic.size() + 1, payload.size() };
+        arena.insert(arena.end(), topic.begin(), topic.end());
+        arena.push_back('\0');
+        arena.insert(arena.end(), payload.begin(), payload.end());
+        pending_.entries.push_back(entry);
+        wake = wake || pending_.entries.size() == batch_size_;
+    }
+    if (wake) {
+        cond_var_.notify_one();
+    }
+}
+
+void PublishBatcher::start()
+{
+    std::lock_guard lk(mutex_);
+    if (thread_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    thread_ = std::thread([this] { run(); });
+}
+
+void PublishBatcher::stop()
+{
+    std::unique_lock lk(mutex_);
+    stopping_ = true;
+    if (!thread_.joinable()) {
+        /* Never started, or stopped already: publish what was queued from here */
+        Batch batch;
+        std::swap(batch, pending_);
+        lk.unlock();
+        flush(batch);
+        return;
+    }
+    lk.unlock();
+    cond_var_.notify_one();
+    thread_.join();
+}
+
+void PublishBatcher::run()
+{
+    Batch batch;
+    std::unique_lock lk(mutex_);
+    while (true) {
+        auto ready = [this] { return stopping_ || pending_.entries.size() >= batch_size_; };
+        if (pending_.entries.empty()) {
+            cond_var_.wait(lk, [this] { return stopping_ || !pending_.entries.empty(); });
+        }
+        if (!pending_.entries.empty() && !ready()) {
+            cond_var_.wait_until(lk, oldest_tp_ + linger_, ready);
+        }
+        if (pending_.entries.empty() && stopping_) {
+            break;
+        }
+        std::swap(batch, pending_);
+        lk.unlock();
+        flush(batch);
+        lk.lock();
+    }
+}
+
+void PublishBatcher::flush(Batch & batch)
+{
+    if (batch.entries.empty()) {
+        return;
+    }
+    uint64_t failed = 0;
+    for (const auto & entry : batch.entries) {
+        const char * topic = batch.arena.data() + entry.topic_offset;
+        if (publisher_(topic, batch.arena.data() + entry.payload_offset, entry.payload_len) != 0) {
+            ++failed;
+        }
+    }
+    num_batches_.fetch_add(1, std::memory_order_relaxed);
+    num_published_.fetch_add(batch.entries.size() - failed, std::memory_order_relaxed);
+    num_failed_.fetch_add(failed, std::memory_order_relaxed);
+    batch.arena.clear();
+    batch.entries.clear();
+}
+
+void PublishBatcher::printStats(std::ostream & os) const
+{
+    const auto batches = num_batches_.load();
+    const auto published = num_published_.load();
+    const auto failed = num_failed_.load();
+    os << "Publish batcher: batches=" << batches << " published=" << published << " failed=" << failed
+       << " dropped=" << num_dropped_.load()
+       << " mean_batch=" << (batches > 0 ? static_cast<double>(published + failed) / batches : 0.0) << std::endl;
+}
@@ -0,0 +1,202 @@
+#include "publish_queue.h"
+
+#include "topic_filter.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+std::optional<OverflowPolicy> parsePolicy(std::string_view name)
+{
+    if (name == "drop-oldest") {
+        return OverflowPolicy::DROP_OLDEST;
+    }
+    if (name == "drop-newest") {
+        return OverflowPolicy::DROP_NEWEST;
+    }
+    if (name == "block") {
+        return OverflowPolicy::BLOCK;
+    }
+    if (name == "conflate") {
+        return OverflowPolicy::CONFLATE;
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+std::optional<OutgoingQueueOptions> OutgoingQueueOptions::parsePolicies(std::string_view spec)
+{
+    OutgoingQueueOptions options;
+    while (!spec.empty()) {
+        const auto comma = spec.find(',');
+        const auto item = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+        const auto equals = item.rfind('=');
+        const auto policy = parsePolicy(equals == std::string_view::npos ? item : item.substr(equals + 1));
+        if (!policy) {
+            return std::nullopt;
+        }
+        if (equals == std::string_view::npos) {
+            options.default_policy = *policy;
+            continue;
+        }
+        const auto filter = item.substr(0, equals);
+        if (!isValidTopicFilter(filter)) {
+            return std::nullopt;
+        }
+        options.topic_policies.emplace_back(filter, *policy);
+    }
+    return options;
+}
+
+PublishQueue::PublishQueue(const OutgoingQueueOptions & options)
+: memory_budget_(options.memory_budget)
+, default_policy_(options.default_policy)
+, topic_policies_(options.topic_policies)
+{
+}
+
+OverflowPolicy PublishQueue::policyFor(std::string_view topic) const
+{
+    for (const auto & [filter, policy] : topic_policies_) {
+        if (topicMatchesFilter(filter, topic)) {
+            return policy;
+        }
+    }
+    return default_policy_;
+}
+
+int PublishQueue::push(std::unique_lock<std::mutex> & lk,
+                       const bool & closed,
+                       std::string_view topic,
+                       const void * payload,
+                       size_t payload_len,
+                       int qos,
+                       bool retain,
+                       int mid)
+{
+    const auto policy = policyFor(topic);
+    const size_t bytes = topic.size() + payload_len;
+    if (policy == OverflowPolicy::CONFLATE) {
+        if (auto it = latest_.find(topic); it != latest_.end()) {
+            /* Replaces the stale value in place, the topic keeps its turn */
+            Entry & entry = *it->second;
+            queued_bytes_ = queued_bytes_ - entry.payload.size() + payload_len;
+            entry.payload.assign(static_cast<const char *>(payload), payload_len);
+            entry.qos = qos;
+            entry.retain = retain;
+            entry.mid = mid;
+            max_queued_bytes_ = std::max(max_queued_bytes_, queued_bytes_);
+            ++conflated_;
+            return 0;
+        }
+    }
+    if (bytes > memory_budget_) {
+        ++dropped_newest_;
+        return QUEUE_ERR_FULL;
+    }
+    if (queued_bytes_ + bytes > memory_budget_) {
+        switch (policy) {
+            case OverflowPolicy::DROP_NEWEST:
+                ++dropped_newest_;
+                return QUEUE_ERR_FULL;
+            case OverflowPolicy::BLOCK:
+                ++blocked_;
+                room_cond_var_.wait(lk, [&] { return queued_bytes_ + bytes <= memory_budget_ || closed; });
+                if (queued_bytes_ + bytes > memory_budget_) {
+                    return QUEUE_ERR_CLOSED;
+                }
+                break;
+            case OverflowPolicy::DROP_OLDEST:
+            case OverflowPolicy::CONFLATE:
+                if (!makeRoom(bytes)) {
+                    ++dropped_newest_;
+                    return QUEUE_ERR_FULL;
+                }
+                break;
+        }
+    }
+
+    Entry & entry = queue_.emplace_back();
+    entry.topic = topic;
+    entry.payload.assign(static_cast<const char *>(payload), payload_len);
+    entry.qos = qos;
+    entry.retain = retain;
+    entry.mid = mid;
+    entry.policy = policy;
+    entry.enqueue_tp = std::chrono::steady_clock::now();
+    if (policy == OverflowPolicy::CONFLATE) {
+        latest_.emplace(entry.topic, std::prev(queue_.end()));
+    }
+    queued_bytes_ += bytes;
+    max_queued_bytes_ = std::max(max_queued_bytes_, queued_bytes_);
+    max_queued_ = std::max(max_queued_, queue_.size());
+    return 0;
+}
+
+bool PublishQueue::makeRoom(size_t bytes)
+{
+    for (auto it = queue_.begin(); it != queue_.end() && queued_bytes_ + bytes > memory_budget_;) {
+        if (it->policy == OverflowPolicy::BLOCK) {
+            ++it;
+            continue;
+        }
+        ++dropped_oldest_;
+        auto next = std::next(it);
+        erase(it);
+        it = next;
+    }
+    return queued_bytes_ + bytes <= memory_budget_;
+}
+
+void PublishQueue::erase(std::list<Entry>::iterator it)
+{
+    if (it->policy == OverflowPolicy::CONFLATE) {
+        latest_.erase(it->topic);
+    }
+    queued_bytes_ -= it->bytes();
+    queue_.erase(it);
+}
+
+PublishQueue::Entry PublishQueue::pop()
+{
+    auto front = queue_.begin();
+    if (front->policy == OverflowPolicy::CONFLATE) {
+        latest_.erase(front->topic);
+    }
+    Entry entry = std::move(*front);
+    queued_bytes_ -= entry.bytes();
+    queue_.erase(front);
+    room_cond_var_.notify_all();
+    return entry;
+}
+
+void PublishQueue::pushFront(Entry entry)
+{
+    if (entry.policy == OverflowPolicy::CONFLATE && latest_.count(entry.topic) != 0) {
+        ++conflated_;
+        return;
+    }
+    queued_bytes_ += entry.bytes();
+    queue_.push_front(std::move(entry));
+    if (queue_.front().policy == OverflowPolicy::CONFLATE) {
+        latest_.emplace(queue_.front().topic, queue_.begin());
+    }
+}
+
+PublishQueue::Stats PublishQueue::stats() const
+{
+    Stats stats;
+    stats.dropped_oldest = dropped_oldest_;
+    stats.dropped_newest = dropped_newest_;
+    stats.conflated = conflated_;
+    stats.blocked = blocked_;
+    stats.queued = queue_.size();
+    stats.max_queued = max_queued_;
+    stats.max_queued_bytes = max_queued_bytes_;
+    stats.budget = memory_budget_;
+    return stats;
+}
@@ -47,6 +47,8 @@ void usage(struct PubSubOpts * opts, PubSubOptsNameValue * name_values, const ch
     if (opts->publisher) {
         printf("       [-r] [-n] [-m message] [-f filename]\n");
         printf("       [--maxdatalen len] [--message-expiry seconds] [--user-property name value]\n");
+        printf("       [--message-interval seconds] [--message-count count] [--overrun catch-up|skip]\n");
+        printf("       [--chunk-size bytes] [--max-in-flight count]\n");
     } else {
         printf("       [-R] [--no-delimiter]\n");
     }
@@ -90,6 +92,17 @@ void usage(struct PubSubOpts * opts, PubSubOptsNameValue * name_values, const ch
                opts->maxdatalen);
         printf("  --message-expiry    : MQTT 5 only.  Sets the message expiry property in seconds.\n");
         printf("  --user-property     : MQTT 5 only.  Sets a user property.\n");
+        printf("  --message-interval  : seconds between messages.  Default is %g.\n", opts->message_interval_sec);
+        printf("  --message-count     : number of messages to send, 0 sends until stopped.  Default is %d.\n",
+               opts->message_count);
+        printf("  --overrun           : when a publish overruns the interval, \"catch-up\" sends the missed messages\n"
+               "                        right away, \"skip\" drops them to keep the spacing.  Default is catch-up.\n");
+        printf("  --chunk-size        : with -f, stream the file in chunks of this many bytes, each a message with a\n"
+               "                        sequence and offset header (see chunked_transfer.h).  Default is 0, the\n"
+               "                        whole file in one message.\n");
+        printf("  --max-in-flight     : chunks sent before waiting for the oldest one to be acknowledged.  Default is"
+               " %d.\n",
+               opts->max_in_flight);
     } else {
         printf("  --no-delimiter      : do not use a delimiter string between messages.\n");
         printf("  -R (--no-retained)  : do not print retained messages.\n");
@@ -305,6 +318,19 @@ int getopts(int argc, char ** argv, struct PubSubOpts * opts)
                 opts->message_interval_sec = atof(argv[count]);
             else
                 return 1;
+        } else if (strcmp(argv[count], "--overrun") == 0) {
+            if (++count >= argc || periodicOverrunPolicyParse(argv[count], &opts->overrun_policy) != 0)
+                return 1;
+        } else if (strcmp(argv[count], "--chunk-size") == 0) {
+            if (++count < argc && atoi(argv[count]) >= 0)
+                opts->chunk_size = atoi(argv[count]);
+            else
+                return 1;
+        } else if (strcmp(argv[count], "--max-in-flight") == 0) {
+            if (++count < argc && atoi(argv[count]) > 0)
+                opts->max_in_flight = atoi(argv[count]);
+            else
+                return 1;
         } else if (opts->publisher == 0) {
             if (strcmp(argv[count], "--no-retained") == 0 || strcmp(argv[count], "-R") == 0)
                 opts->retained = 1;
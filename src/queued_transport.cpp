@@ -0,0 +1,32 @@
+#include "queued_transport.h"
+
+#include <utility>
+
+namespace {
+
+PriorityLaneOptions singleLane(OutgoingQueueOptions options)
+{
+    PriorityLaneOptions lanes;
+    PriorityLane & lane = lanes.lanes.emplace_back();
+    lane.name = "outgoing";
+    lane.filters.emplace_back("#");
+    lanes.queue = std::move(options);
+    return lanes;
+}
+
+} // namespace
+
+QueuedTransport::QueuedTransport(std::unique_ptr<Transport> inner, OutgoingQueueOptions options)
+: PriorityTransport(std::move(inner), singleLane(std::move(options)))
+{
+}
+
+void QueuedTransport::printStats(std::ostream & os) const
+{
+    const auto stats = laneStats(0);
+    os << "Outgoing queue: sent=" << stats.sent << " dropped_oldest=" << stats.queue.dropped_oldest
+       << " dropped_newest=" << stats.queue.dropped_newest << " conflated=" << stats.queue.conflated
+       << " blocked=" << stats.queue.blocked << " failed=" << stats.failed << " queued=" << stats.queue.queued
+       << " max_queued=" << stats.queue.max_queued << " max_queued_bytes=" << stats.queue.max_queued_bytes
+       << " budget=" << stats.queue.budget << std::endl;
+}
@@ -0,0 +1,359 @@
+#include "reconnect_manager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <utility>
+
+namespace {
+
+double toMilliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void printSketch(std::ostream & os, const char * name, const DDSketch & sketch)
+{
+    os << " " << name << " p50=" << sketch.quantile(0.5) << " p99=" << sketch.quantile(0.99)
+       << " max=" << sketch.quantile(1.0);
+}
+
+} // namespace
+
+std::chrono::milliseconds ReconnectPolicy::delay(int attempt, double random) const
+{
+    const double backoff = std::min(static_cast<double>(max_delay.count()),
+                                    static_cast<double>(initial_delay.count()) * std::pow(multiplier, attempt));
+    return std::chrono::milliseconds(static_cast<int64_t>(backoff * (1 - std::clamp(jitter, 0.0, 1.0) * random)));
+}
+
+ReconnectManager::ReconnectManager(ReconnectPolicy policy)
+: policy_(policy)
+, random_(std::random_device()())
+{
+}
+
+std::unique_ptr<Transport> ReconnectManager::manage(std::unique_ptr<Transport> inner)
+{
+    {
+        std::lock_guard lk(mutex_);
+        ++connections_;
+    }
+    /* Two recoveries racing each other would undo one another */
+    inner->setAutoReconnect(false);
+    return std::make_unique<ReconnectingTransport>(std::move(inner), *this);
+}
+
+std::chrono::milliseconds ReconnectManager::nextDelay(int attempt)
+{
+    std::lock_guard lk(mutex_);
+    return policy_.delay(attempt, std::uniform_real_distribution<double>(0, 1)(random_));
+}
+
+void ReconnectManager::recordConnected(bool recovery, std::chrono::steady_clock::duration elapsed)
+{
+    std::lock_guard lk(mutex_);
+    (recovery ? recovery_ : startup_).connected_ms.add(toMilliseconds(elapsed));
+}
+
+void ReconnectManager::recordSubscribed(bool recovery, std::chrono::steady_clock::duration elapsed)
+{
+    std::lock_guard lk(mutex_);
+    (recovery ? recovery_ : startup_).subscribed_ms.add(toMilliseconds(elapsed));
+}
+
+void ReconnectManager::recordDrop()
+{
+    std::lock_guard lk(mutex_);
+    ++drops_;
+}
+
+void ReconnectManager::recordFailedAttempt()
+{
+    std::lock_guard lk(mutex_);
+    ++failed_attempts_;
+}
+
+bool ReconnectManager::anyConnected() const
+{
+    std::lock_guard lk(mutex_);
+    return startup_.connected_ms.count() > 0;
+}
+
+void ReconnectManager::printStats(std::ostream & os) const
+{
+    std::lock_guard lk(mutex_);
+    os << "Reconnect manager: connections=" << connections_ << " drops=" << drops_
+       << " failed_attempts=" << failed_attempts_ << std::endl;
+    os << std::fixed << std::setprecision(1);
+    for (const auto & [name, readiness] : { std::pair{ "startup", &startup_ }, std::pair{ "recovery", &recovery_ } }) {
+        os << "Reconnect " << name << ": connected=" << readiness->connected_ms.count();
+        printSketch(os, "time_to_connected_ms", readiness->connected_ms);
+        os << " subscribed=" << readiness->subscribed_ms.count();
+        printSketch(os, "time_to_subscribed_ms", readiness->subscribed_ms);
+        os << std::endl;
+    }
+    os << std::defaultfloat;
+}
+
+ReconnectingTransport::ReconnectingTransport(std::unique_ptr<Transport> inner, ReconnectManager & manager)
+: inner_(std::move(inner))
+, manager_(manager)
+{
+    inner_->setConnectCallback([this](Transport &, int reason_code) { onInnerConnect(reason_code); });
+    inner_->setDisconnectCallback([this](Transport &, int reason_code) { onInnerDisconnect(reason_code); });
+    inner_->setSubscribeCallback([this](Transport &, int mid, int qos_count, const int * granted_qos) {
+        onInnerSubscribe(mid, qos_count, granted_qos);
+    });
+    inner_->setMessageCallback([this](Transport &, const TransportMessage & msg) { notifyMessage(msg); });
+    inner_->setPublishCallback([this](Transport &, int mid) { notifyPublish(mid); });
+}
+
+ReconnectingTransport::~ReconnectingTransport()
+{
+    /* The connector and the network thread call back into us */
+    stop();
+}
+
+int ReconnectingTransport::connect()
+{
+    {
+        std::lock_guard lk(mutex_);
+        if (wanted_) {
+            return 0;
+        }
+        wanted_ = true;
+        attempt_ = 0;
+        recovery_ = false;
+        down_tp_ = Clock::now();
+        next_attempt_tp_ = down_tp_;
+    }
+    cond_var_.notify_all();
+    return 0;
+}
+
+int ReconnectingTransport::disconnect()
+{
+    {
+        std::lock_guard lk(mutex_);
+        wanted_ = false;
+        connected_ = false;
+        next_attempt_tp_.reset();
+        connack_deadline_.reset();
+        /* An attempt in progress undoes itself once it sees this */
+        needs_teardown_ = true;
+    }
+    return inner_->disconnect();
+}
+
+int ReconnectingTransport::start()
+{
+    std::lock_guard lk(mutex_);
+    if (!started_) {
+        started_ = true;
+        connector_ = std::thread([this] { runConnector(); });
+    }
+    return 0;
+}
+
+void ReconnectingTransport::stop()
+{
+    {
+        std::lock_guard lk(mutex_);
+        stopping_ = true;
+    }
+    cond_var_.notify_all();
+    if (connector_.joinable()) {
+        connector_.join();
+    }
+    inner_->stop();
+}
+
+void ReconnectingTransport::runConnector()
+{
+    std::unique_lock lk(mutex_);
+    while (!stopping_) {
+        const auto now = Clock::now();
+        if (connack_deadline_ && now >= *connack_deadline_) {
+            connack_deadline_.reset();
+            manager_.recordFailedAttempt();
+            retry();
+            continue;
+        }
+        if (next_attempt_tp_ && now >= *next_attempt_tp_) {
+            next_attempt_tp_.reset();
+            attempt(lk);
+            continue;
+        }
+        std::optional<Clock::time_point> wake_tp = next_attempt_tp_;
+        if (connack_deadline_ && (!wake_tp || *connack_deadline_ < *wake_tp)) {
+            wake_tp = connack_deadline_;
+        }
+        if (wake_tp) {
+            cond_var_.wait_until(lk, *wake_tp);
+        } else {
+            cond_var_.wait(lk);
+        }
+    }
+}
+
+void ReconnectingTransport::attempt(std::unique_lock<std::mutex> & lk)
+{
+    const bool teardown = std::exchange(needs_teardown_, false);
+    tearing_down_ = teardown;
+    lk.unlock();
+    if (teardown) {
+        /* The network thread goes too, start() makes a new one */
+        inner_->disconnect();
+        inner_->stop();
+    }
+    lk.lock();
+    tearing_down_ = false;
+    if (stopping_ || !wanted_) {
+        return;
+    }
+    lk.unlock();
+
+    /* Resolves the name and connects, however long that takes */
+    int rc = inner_->connect();
+    if (rc == 0) {
+        rc = inner_->start();
+    }
+
+    lk.lock();
+    needs_teardown_ = true;
+    if (stopping_) {
+        return;
+    }
+    if (!wanted_) {
+        /* disconnect() was called meanwhile, before there was anything to disconnect */
+        lk.unlock();
+        inner_->disconnect();
+        lk.lock();
+        return;
+    }
+    if (rc != 0) {
+        manager_.recordFailedAttempt();
+        retry();
+        return;
+    }
+    if (!connected_ && !next_attempt_tp_) {
+        /* Unless the CONNACK came in already, accepting the connection or refusing it */
+        connack_deadline_ = Clock::now() + manager_.policy_.connect_timeout;
+    }
+}
+
+void ReconnectingTransport::retry()
+{
+    next_attempt_tp_ = Clock::now() + manager_.nextDelay(attempt_++);
+    cond_var_.notify_all();
+}
+
+void ReconnectingTransport::onInnerConnect(int reason_code)
+{
+    {
+        std::lock_guard lk(mutex_);
+        connack_deadline_.reset();
+        if (reason_code != 0) {
+            /* Refused by the broker */
+            manager_.recordFailedAttempt();
+            if (wanted_ && !stopping_) {
+                retry();
+            }
+        } else {
+            /* Late for its deadline, but up after all */
+            next_attempt_tp_.reset();
+            connected_ = true;
+            attempt_ = 0;
+            pending_subscribes_ = 0;
+            subscribed_ = false;
+            manager_.recordConnected(recovery_, Clock::now() - down_tp_);
+        }
+    }
+    notifyConnect(reason_code);
+}
+
+void ReconnectingTransport::onInnerDisconnect(int reason_code)
+{
+    bool notify = false;
+    {
+        std::lock_guard lk(mutex_);
+        if (tearing_down_) {
+            return;
+        }
+        const bool was_connected = std::exchange(connected_, false);
+        /* Disconnects asked for are passed on, failed handshakes only count as failed attempts */
+        notify = was_connected || !wanted_;
+        /* libmosquitto follows a refusing CONNACK with a disconnect, the refusal already scheduled the retry */
+        const bool retrying = !was_connected && next_attempt_tp_.has_value();
+        if (wanted_ && !stopping_ && !retrying) {
+            connack_deadline_.reset();
+            if (was_connected) {
+                manager_.recordDrop();
+                recovery_ = true;
+                down_tp_ = Clock::now();
+                attempt_ = 0;
+            } else {
+                /* Lost during the handshake */
+                manager_.recordFailedAttempt();
+            }
+            retry();
+        }
+    }
+    if (notify) {
+        notifyDisconnect(reason_code);
+    }
+}
+
+void ReconnectingTransport::onInnerSubscribe(int mid, int qos_count, const int * granted_qos)
+{
+    {
+        std::lock_guard lk(mutex_);
+        if (pending_subscribes_ > 0 && --pending_subscribes_ == 0 && !subscribed_) {
+            subscribed_ = true;
+            manager_.recordSubscribed(recovery_, Clock::now() - down_tp_);
+        }
+    }
+    notifySubscribe(mid, qos_count, granted_qos);
+}
+
+int ReconnectingTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    return subscribeMultiple(&topic_filter, 1, qos, mid);
+}
+
+int ReconnectingTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    {
+        /* Before sending, the SUBACK may come back before the call returns */
+        std::lock_guard lk(mutex_);
+        ++pending_subscribes_;
+    }
+    const int rc = count == 1 ? inner_->subscribe(topic_filters[0], qos, mid)
+                              : inner_->subscribeMultiple(topic_filters, count, qos, mid);
+    if (rc != 0) {
+        std::lock_guard lk(mutex_);
+        pending_subscribes_ = std::max(pending_subscribes_ - 1, 0);
+    }
+    return rc;
+}
+
+int ReconnectingTransport::publish(const char * topic,
+                                   const void * payload,
+                                   size_t payload_len,
+                                   int qos,
+                                   bool retain,
+                                   int * mid)
+{
+    return inner_->publish(topic, payload, payload_len, qos, retain, mid);
+}
+
+const char * ReconnectingTransport::errorString(int rc) const
+{
+    return inner_->errorString(rc);
+}
+
+const char * ReconnectingTransport::connackString(int reason_code) const
+{
+    return inner_->connackString(reason_code);
+}
@@ -0,0 +1,441 @@
+#include "sharded_transport.h"
+
+#include "payload_parser.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+/* Granted QoS reported for a broker that refused or couldn't take a subscription */
+constexpr int SUBSCRIPTION_REFUSED = 0x80;
+constexpr int MAX_QOS = 2;
+
+/* A filter is granted the lower of two brokers' QoS, and refused when either refused it */
+int mergeGrantedQos(int a, int b)
+{
+    return a >= SUBSCRIPTION_REFUSED || b >= SUBSCRIPTION_REFUSED ? std::max(a, b) : std::min(a, b);
+}
+
+/* FNV-1a, fixed across builds so that every client maps a topic to the same broker */
+uint64_t stableHash(std::string_view s)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char c : s) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* splitmix64 finalizer, spreads the combined topic and broker hashes */
+uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+} // namespace
+
+std::optional<std::vector<BrokerAddress>> parseBrokerList(std::string_view spec, int default_port)
+{
+    std::vector<BrokerAddress> brokers;
+    while (!spec.empty()) {
+        const auto comma = spec.find(',');
+        auto entry = trimPayload(spec.substr(0, comma));
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+        BrokerAddress broker{ std::string(entry), default_port };
+        if (const auto colon = entry.rfind(':'); colon != std::string_view::npos) {
+            auto port = parseNumber<int>(entry.substr(colon + 1));
+            if (!port || *port <= 0 || *port > 65535) {
+                return std::nullopt;
+            }
+            broker = { std::string(entry.substr(0, colon)), *port };
+        }
+        if (broker.host.empty()) {
+            return std::nullopt;
+        }
+        brokers.push_back(std::move(broker));
+    }
+    if (brokers.empty()) {
+        return std::nullopt;
+    }
+    return brokers;
+}
+
+std::optional<std::vector<int>> ShardedTransport::MidMap::add(int inner_mid, int outer_mid)
+{
+    std::lock_guard lk(mutex_);
+    if (auto it = early_.find(inner_mid); it != early_.end()) {
+        auto granted_qos = std::move(it->second);
+        early_.erase(it);
+        return granted_qos;
+    }
+    pending_[inner_mid] = outer_mid;
+    return std::nullopt;
+}
+
+std::optional<int> ShardedTransport::MidMap::complete(int inner_mid, const std::vector<int> & granted_qos)
+{
+    std::lock_guard lk(mutex_);
+    if (auto it = pending_.find(inner_mid); it != pending_.end()) {
+        const int outer_mid = it->second;
+        pending_.erase(it);
+        return outer_mid;
+    }
+    early_[inner_mid] = granted_qos;
+    return std::nullopt;
+}
+
+ShardedTransport::ShardedTransport(std::string client_id, Mode mode)
+: client_id_(std::move(client_id))
+, mode_(mode)
+{
+}
+
+ShardedTransport::~ShardedTransport()
+{
+    /* The shards' network threads call back into us */
+    stop();
+}
+
+void ShardedTransport::addShard(const BrokerAddress & broker, std::unique_ptr<Transport> transport)
+{
+    auto shard = std::make_unique<Shard>();
+    shard->label = broker.label();
+    shard->seed = stableHash(shard->label);
+    shard->transport = std::move(transport);
+
+    auto & s = *shard;
+    s.transport->setConnectCallback([this, &s](Transport &, int reason_code) { onShardConnect(s, reason_code); });
+    s.transport->setDisconnectCallback([this](Transport &, int reason_code) { notifyDisconnect(reason_code); });
+    s.transport->setSubscribeCallback([this, &s](Transport &, int mid, int qos_count, const int * granted_qos) {
+        onShardSubscribe(s, mid, qos_count, granted_qos);
+    });
+    s.transport->setMessageCallback([this](Transport &, const TransportMessage & msg) { notifyMessage(msg); });
+    s.transport->setPublishCallback([this, &s](Transport &, int mid) { onShardPublish(s, mid); });
+    shards_.push_back(std::move(shard));
+}
+
+int ShardedTransport::nextMid()
+{
+    return static_cast<int>(next_mid_.fetch_add(1, std::memory_order_relaxed) % INT_MAX) + 1;
+}
+
+size_t ShardedTransport::shardFor(std::string_view topic) const
+{
+    /* Rendezvous hashing: the broker scoring highest for the topic owns it */
+    const uint64_t topic_hash = stableHash(topic);
+    size_t best = 0;
+    uint64_t best_score = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        const uint64_t score = mix(topic_hash ^ shards_[i]->seed);
+        if (i == 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+int ShardedTransport::connect()
+{
+    {
+        std::lock_guard lk(mutex_);
+        num_connected_ = 0;
+        for (auto & shard : shards_) {
+            shard->connected_once = false;
+        }
+    }
+    for (auto & shard : shards_) {
+        if (int rc = shard->transport->connect(); rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int ShardedTransport::disconnect()
+{
+    int first_error = 0;
+    for (auto & shard : shards_) {
+        if (int rc = shard->transport->disconnect(); rc != 0 && first_error == 0) {
+            first_error = rc;
+        }
+    }
+    return first_error;
+}
+
+int ShardedTransport::start()
+{
+    for (auto & shard : shards_) {
+        if (int rc = shard->transport->start(); rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+void ShardedTransport::stop()
+{
+    for (auto & shard : shards_) {
+        shard->transport->stop();
+    }
+}
+
+void ShardedTransport::onShardConnect(Shard & shard, int reason_code)
+{
+    if (reason_code != 0) {
+        notifyConnect(reason_code);
+        return;
+    }
+    bool all_connected = false;
+    std::vector<std::pair<std::string, int>> renew;
+    {
+        std::lock_guard lk(mutex_);
+        if (shard.connected_once) {
+            renew = subscriptions_;
+        } else {
+            shard.connected_once = true;
+            all_connected = ++num_connected_ == shards_.size();
+        }
+    }
+    if (!renew.empty()) {
+        resubscribe(shard, renew);
+    }
+    if (all_connected) {
+        notifyConnect(0);
+    }
+}
+
+void ShardedTransport::resubscribe(Shard & shard, const std::vector<std::pair<std::string, int>> & subscriptions)
+{
+    for (int qos = 0; qos <= 2; ++qos) {
+        std::vector<std::string> filters;
+        for (const auto & [topic_filter, filter_qos] : subscriptions) {
+            if (filter_qos == qos) {
+                filters.push_back(topic_filter);
+            }
+        }
+        std::vector<const char *> filter_ptrs;
+        filter_ptrs.reserve(filters.size());
+        for (const auto & filter : filters) {
+            filter_ptrs.push_back(filter.c_str());
+        }
+        size_t begin = 0;
+        for (const size_t end : planSubscribeBatches(filters, subscribe_limits_)) {
+            subscribeOn(shard, filter_ptrs.data() + begin, static_cast<int>(end - begin), qos, INTERNAL_MID);
+            begin = end;
+        }
+    }
+}
+
+int ShardedTransport::subscribe(const char * topic_filter, int qos, int * mid)
+{
+    return subscribeMultiple(&topic_filter, 1, qos, mid);
+}
+
+int ShardedTransport::subscribeMultiple(const char * const * topic_filters, int count, int qos, int * mid)
+{
+    const int outer_mid = nextMid();
+    {
+        std::lock_guard lk(mutex_);
+        for (int i = 0; i < count; ++i) {
+            const std::string filter(topic_filters[i]);
+            if (auto [it, added] = subscription_index_.try_emplace(filter, subscriptions_.size()); !added) {
+                subscriptions_[it->second].second = qos;
+            } else {
+                subscriptions_.emplace_back(filter, qos);
+            }
+        }
+        pending_subscribes_[outer_mid]
+            = Pending{ shards_.size(), std::vector<int>(static_cast<size_t>(count), MAX_QOS) };
+    }
+    if (mid != nullptr) {
+        *mid = outer_mid;
+    }
+
+    int first_error = 0;
+    size_t num_failed = 0;
+    for (auto & shard : shards_) {
+        if (int rc = subscribeOn(*shard, topic_filters, count, qos, outer_mid); rc != 0) {
+            first_error = first_error != 0 ? first_error : rc;
+            ++num_failed;
+        }
+    }
+    if (num_failed == shards_.size()) {
+        std::lock_guard lk(mutex_);
+        pending_subscribes_.erase(outer_mid);
+        return first_error;
+    }
+    /* A broker that didn't take the subscription counts as refusing it */
+    for (size_t i = 0; i < num_failed; ++i) {
+        completeSubscribe(outer_mid, {});
+    }
+    return 0;
+}
+
+int ShardedTransport::subscribeOn(Shard & shard,
+                                  const char * const * topic_filters,
+                                  int count,
+                                  int qos,
+                                  int outer_mid)
+{
+    int inner_mid = 0;
+    const int rc = count == 1 ? shard.transport->subscribe(topic_filters[0], qos, &inner_mid)
+                              : shard.transport->subscribeMultiple(topic_filters, count, qos, &inner_mid);
+    if (rc != 0) {
+        return rc;
+    }
+    if (auto granted_qos = shard.subscribes.add(inner_mid, outer_mid)) {
+        completeSubscribe(outer_mid, *granted_qos);
+    }
+    return 0;
+}
+
+void ShardedTransport::onShardSubscribe(Shard & shard, int mid, int qos_count, const int * granted_qos)
+{
+    const std::vector<int> granted(granted_qos, granted_qos + std::max(qos_count, 0));
+    if (auto outer_mid = shard.subscribes.complete(mid, granted)) {
+        completeSubscribe(*outer_mid, granted);
+    }
+}
+
+void ShardedTransport::completeSubscribe(int outer_mid, const std::vector<int> & granted_qos)
+{
+    if (outer_mid == INTERNAL_MID) {
+        return;
+    }
+    std::vector<int> granted;
+    {
+        std::lock_guard lk(mutex_);
+        auto it = pending_subscribes_.find(outer_mid);
+        if (it == pending_subscribes_.end()) {
+            return;
+        }
+        auto & merged = it->second.granted_qos;
+        for (size_t i = 0; i < merged.size(); ++i) {
+            /* Filters the SUBACK has no result for count as refused */
+            merged[i] = mergeGrantedQos(merged[i], i < granted_qos.size() ? granted_qos[i] : SUBSCRIPTION_REFUSED);
+        }
+        if (--it->second.remaining > 0) {
+            return;
+        }
+        granted = std::move(merged);
+        pending_subscribes_.erase(it);
+    }
+    notifySubscribe(outer_mid, static_cast<int>(granted.size()), granted.data());
+}
+
+int ShardedTransport::publish(const char * topic,
+                              const void * payload,
+                              size_t payload_len,
+                              int qos,
+                              bool retain,
+                              int * mid)
+{
+    const int outer_mid = nextMid();
+    if (mode_ == Mode::SHARD) {
+        int rc = publishOn(*shards_[shardFor(topic)], topic, payload, payload_len, qos, retain, outer_mid);
+        if (rc == 0 && mid != nullptr) {
+            *mid = outer_mid;
+        }
+        return rc;
+    }
+
+    {
+        std::lock_guard lk(mutex_);
+        pending_publishes_[outer_mid] = Pending{ shards_.size(), {} };
+    }
+    /* Every copy is only queued here, each shard's network thread sends its own */
+    int first_error = 0;
+    size_t num_failed = 0;
+    for (auto & shard : shards_) {
+        if (int rc = publishOn(*shard, topic, payload, payload_len, qos, retain, outer_mid); rc != 0) {
+            first_error = first_error != 0 ? first_error : rc;
+            ++num_failed;
+        }
+    }
+    if (num_failed == shards_.size()) {
+        std::lock_guard lk(mutex_);
+        pending_publishes_.erase(outer_mid);
+        return first_error;
+    }
+    if (mid != nullptr) {
+        *mid = outer_mid;
+    }
+    if (num_failed > 0) {
+        completePublish(outer_mid, num_failed);
+    }
+    return 0;
+}
+
+int ShardedTransport::publishOn(Shard & shard,
+                                const char * topic,
+                                const void * payload,
+                                size_t payload_len,
+                                int qos,
+                                bool retain,
+                                int outer_mid)
+{
+    /* Counted up front, the completion may arrive before publish() returns */
+    const auto in_flight = shard.in_flight.fetch_add(1, std::memory_order_relaxed) + 1;
+    int inner_mid = 0;
+    if (int rc = shard.transport->publish(topic, payload, payload_len, qos, retain, &inner_mid); rc != 0) {
+        shard.in_flight.fetch_sub(1, std::memory_order_relaxed);
+        return rc;
+    }
+    shard.published.fetch_add(1, std::memory_order_relaxed);
+    auto max_in_flight = shard.max_in_flight.load(std::memory_order_relaxed);
+    while (in_flight > max_in_flight
+           && !shard.max_in_flight.compare_exchange_weak(max_in_flight, in_flight, std::memory_order_relaxed)) {
+    }
+    if (shard.publishes.add(inner_mid, outer_mid)) {
+        completePublish(outer_mid, 1);
+    }
+    return 0;
+}
+
+void ShardedTransport::onShardPublish(Shard & shard, int mid)
+{
+    shard.acked.fetch_add(1, std::memory_order_relaxed);
+    shard.in_flight.fetch_sub(1, std::memory_order_relaxed);
+    if (auto outer_mid = shard.publishes.complete(mid, {})) {
+        completePublish(*outer_mid, 1);
+    }
+}
+
+void ShardedTransport::completePublish(int outer_mid, size_t copies)
+{
+    if (mode_ == Mode::FAN_OUT) {
+        std::lock_guard lk(mutex_);
+        auto it = pending_publishes_.find(outer_mid);
+        if (it == pending_publishes_.end()) {
+            return;
+        }
+        it->second.remaining -= std::min(copies, it->second.remaining);
+        if (it->second.remaining > 0) {
+            return;
+        }
+        pending_publishes_.erase(it);
+    }
+    notifyPublish(outer_mid);
+}
+
+const char * ShardedTransport::errorString(int rc) const
+{
+    return shards_.empty() ? "no brokers" : shards_.front()->transport->errorString(rc);
+}
+
+const char * ShardedTransport::connackString(int reason_code) const
+{
+    return shards_.empty() ? "no brokers" : shards_.front()->transport->connackString(reason_code);
+}
+
+void ShardedTransport::printStats(std::ostream & os) const
+{
+    for (const auto & shard : shards_) {
+        os << "Broker " << shard->label << ": published=" << shard->published.load()
+           << " acked=" << shard->acked.load() << " in_flight=" << shard->in_flight.load()
+           << " max_in_flight=" << shard->max_in_flight.load() << std::endl;
+    }
+}
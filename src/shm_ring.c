@@ -0,0 +1,427 @@
+/* syscall() for futexes, shm_open() and kill() */
+#define _GNU_SOURCE
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+
+/* "MQRB" */
+static const uint32_t SHM_RING_MAGIC = 0x4252514DU;
+/* Records start on this alignment, so a padding record always has room for its header */
+static const uint32_t RECORD_ALIGN = 16;
+static const size_t MIN_CAPACITY = 4096;
+
+enum
+{
+    RECORD_RETAIN = 1 << 0,
+    /* Fills the end of the ring when the next record doesn't fit before it wraps */
+    RECORD_PADDING = 1 << 1,
+};
+
+struct ShmRingSlot
+{
+    _Atomic uint64_t cursor;
+    /* 0 when free, -1 while being claimed */
+    _Atomic int32_t pid;
+    char padding[CACHE_LINE - sizeof(uint64_t) - sizeof(int32_t)];
+};
+
+struct ShmRingHeader
+{
+    /* Stored last when creating the ring, so readers never see a half-initialized header */
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    /* Written by the writer only: end of the last complete record */
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;
+    /* Futex word, bumped on every write */
+    _Atomic uint32_t seq;
+    _Atomic uint32_t waiters;
+    _Atomic uint32_t closed;
+    _Alignas(CACHE_LINE) struct ShmRingSlot slots[SHM_RING_MAX_READERS];
+};
+
+struct ShmRingRecord
+{
+    /* Of the whole record, header and padding included */
+    uint32_t size;
+    uint16_t topic_len;
+    uint8_t qos;
+    uint8_t flags;
+    uint32_t payload_len;
+    uint32_t reserved;
+};
+
+struct ShmRingWriter
+{
+    char name[NAME_MAX + 1];
+    struct ShmRingHeader * header;
+    unsigned char * data;
+    size_t map_size;
+    uint64_t capacity;
+    pthread_mutex_t mutex;
+    /* Lower bound of the slowest reader's cursor, cursors only move forward */
+    uint64_t min_cursor;
+    uint64_t written;
+    uint64_t dropped;
+    uint64_t oversize;
+};
+
+struct ShmRingReader
+{
+    struct ShmRingHeader * header;
+    struct ShmRingSlot * slot;
+    unsigned char * data;
+    size_t map_size;
+    uint64_t capacity;
+    uint64_t cursor;
+    /* Past the message last returned, the cursor moves there on the next call */
+    uint64_t next;
+};
+
+static size_t dataOffset(void)
+{
+    return (sizeof(struct ShmRingHeader) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+static int shmName(const char * name, char * out)
+{
+    const size_t len = strlen(name);
+    if (len == 0 || len + 1 >= NAME_MAX || strchr(name, '/') != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    out[0] = '/';
+    memcpy(out + 1, name, len + 1);
+    return 0;
+}
+
+static long futex(_Atomic uint32_t * word, int op, uint32_t value, const struct timespec * timeout)
+{
+    return syscall(SYS_futex, (uint32_t *)word, op, value, timeout, NULL, 0);
+}
+
+struct ShmRingWriter * shmRingWriterCreate(const char * name, size_t capacity)
+{
+    uint64_t rounded = MIN_CAPACITY;
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+    struct ShmRingWriter * writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+    if (shmName(name, writer->name) != 0) {
+        free(writer);
+        return NULL;
+    }
+    writer->capacity = rounded;
+    writer->map_size = dataOffset() + rounded;
+
+    /* A ring left behind by a crashed writer is replaced, its readers keep the old mapping */
+    shm_unlink(writer->name);
+    const int fd = shm_open(writer->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        free(writer);
+        return NULL;
+    }
+    void * map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)writer->map_size) == 0) {
+        map = mmap(NULL, writer->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const int saved_errno = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(writer->name);
+        free(writer);
+        errno = saved_errno;
+        return NULL;
+    }
+    pthread_mutex_init(&writer->mutex, NULL);
+    writer->header = map;
+    writer->data = (unsigned char *)map + dataOffset();
+    writer->header->version = SHM_RING_VERSION;
+    writer->header->capacity = rounded;
+    atomic_store_explicit(&writer->header->magic, SHM_RING_MAGIC, memory_order_release);
+    return writer;
+}
+
+void shmRingWriterDestroy(struct ShmRingWriter * writer)
+{
+    if (writer == NULL) {
+        return;
+    }
+    atomic_store(&writer->header->closed, 1);
+    atomic_fetch_add(&writer->header->seq, 1);
+    futex(&writer->header->seq, FUTEX_WAKE, INT_MAX, NULL);
+    munmap(writer->header, writer->map_size);
+    shm_unlink(writer->name);
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer);
+}
+
+/* Recomputes the slowest reader's cursor, `head` when there are no readers. With `reap`, also frees the slots of
+ * readers that died without closing. */
+static uint64_t slowestCursor(struct ShmRingWriter * writer, uint64_t head, int reap)
+{
+    /* Pairs with the fence in shmRingReaderOpen(): a reader whose pid we miss sees at least `head` */
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t min_cursor = head;
+    for (int i = 0; i < SHM_RING_MAX_READERS; ++i) {
+        struct ShmRingSlot * slot = &writer->header->slots[i];
+        int32_t pid = atomic_load_explicit(&slot->pid, memory_order_acquire);
+        if (pid <= 0) {
+            continue;
+        }
+        if (reap && kill(pid, 0) != 0 && errno == ESRCH) {
+            atomic_compare_exchange_strong(&slot->pid, &pid, 0);
+            continue;
+        }
+        const uint64_t cursor = atomic_load_explicit(&slot->cursor, memory_order_acquire);
+        if (cursor < min_cursor) {
+            min_cursor = cursor;
+        }
+    }
+    return min_cursor;
+}
+
+int shmRingWrite(struct ShmRingWriter * writer,
+                 const char * topic,
+                 size_t topic_len,
+                 const void * payload,
+                 size_t payload_len,
+                 int qos,
+                 int retain)
+{
+    const uint64_t size
+        = (sizeof(struct ShmRingRecord) + topic_len + payload_len + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+    pthread_mutex_lock(&writer->mutex);
+    if (topic_len > UINT16_MAX || size > writer->capacity / 4) {
+        ++writer->oversize;
+        pthread_mutex_unlock(&writer->mutex);
+        return -1;
+    }
+    struct ShmRingHeader * header = writer->header;
+    const uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    const uint64_t offset = head & (writer->capacity - 1);
+    const uint64_t padding = offset + size > writer->capacity ? writer->capacity - offset : 0;
+    const uint64_t end = head + padding + size;
+    if (end - writer->min_cursor > writer->capacity) {
+        writer->min_cursor = slowestCursor(writer, head, 0);
+        if (end - writer->min_cursor > writer->capacity) {
+            writer->min_cursor = slowestCursor(writer, head, 1);
+        }
+        if (end - writer->min_cursor > writer->capacity) {
+            ++writer->dropped;
+            pthread_mutex_unlock(&writer->mutex);
+            return -1;
+        }
+    }
+
+    if (padding > 0) {
+        struct ShmRingRecord fill = { (uint32_t)padding, 0, 0, RECORD_PADDING, 0, 0 };
+        memcpy(writer->data + offset, &fill, sizeof(fill));
+    }
+    unsigned char * out = writer->data + ((head + padding) & (writer->capacity - 1));
+    struct ShmRingRecord record = {
+        (uint32_t)size, (uint16_t)topic_len, (uint8_t)qos, retain ? RECORD_RETAIN : 0, (uint32_t)payload_len, 0
+    };
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), topic, topic_len);
+    memcpy(out + sizeof(record) + topic_len, payload, payload_len);
+    atomic_store_explicit(&header->head, end, memory_order_release);
+    ++writer->written;
+
+    atomic_fetch_add(&header->seq, 1);
+    if (atomic_load(&header->waiters) > 0) {
+        futex(&header->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return 0;
+}
+
+void shmRingWriterPrintStats(struct ShmRingWriter * writer, FILE * out)
+{
+    int readers = 0;
+    for (int i = 0; i < SHM_RING_MAX_READERS; ++i) {
+        readers += atomic_load(&writer->header->slots[i].pid) > 0 ? 1 : 0;
+    }
+    pthread_mutex_lock(&writer->mutex);
+    fprintf(out,
+            "Shared-memory ring %s: written=%llu dropped=%llu oversize=%llu readers=%d capacity=%llu\n",
+            writer->name + 1,
+            (unsigned long long)writer->written,
+            (unsigned long long)writer->dropped,
+            (unsigned long long)writer->oversize,
+            readers,
+            (unsigned long long)writer->capacity);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+struct ShmRingReader * shmRingReaderOpen(const char * name)
+{
+    char path[NAME_MAX + 1];
+    if (shmName(name, path) != 0) {
+        return NULL;
+    }
+    const int fd = shm_open(path, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void * map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > dataOffset()) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        errno = EPROTO;
+    }
+    const int saved_errno = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = saved_errno;
+        return NULL;
+    }
+    struct ShmRingHeader * header = map;
+    if (atomic_load_explicit(&header->magic, memory_order_acquire) != SHM_RING_MAGIC
+        || header->version != SHM_RING_VERSION || dataOffset() + header->capacity != (uint64_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    struct ShmRingReader * reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    reader->header = header;
+    reader->data = (unsigned char *)map + dataOffset();
+    reader->map_size = (size_t)st.st_size;
+    reader->capacity = header->capacity;
+    for (int i = 0; i < SHM_RING_MAX_READERS && reader->slot == NULL; ++i) {
+        int32_t expected = 0;
+        if (atomic_compare_exchange_strong(&header->slots[i].pid, &expected, -1)) {
+            reader->slot = &header->slots[i];
+        }
+    }
+    if (reader->slot == NULL) {
+        shmRingReaderClose(reader);
+        errno = EBUSY;
+        return NULL;
+    }
+    /* The writer ignores the slot until the pid is in, and may wrap past whatever head we read before that. So the pid
+     * goes in with a cursor the writer can respect meanwhile, and the cursor is taken again afterwards: either the
+     * writer saw the pid, or its bound came from a head no later than the one read here. */
+    atomic_store_explicit(&reader->slot->cursor, atomic_load(&header->head), memory_order_relaxed);
+    atomic_store_explicit(&reader->slot->pid, (int32_t)getpid(), memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    reader->cursor = atomic_load_explicit(&header->head, memory_order_acquire);
+    reader->next = reader->cursor;
+    atomic_store_explicit(&reader->slot->cursor, reader->cursor, memory_order_release);
+    return reader;
+}
+
+void shmRingReaderClose(struct ShmRingReader * reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    if (reader->slot != NULL) {
+        atomic_store_explicit(&reader->slot->pid, 0, memory_order_release);
+    }
+    munmap(reader->header, reader->map_size);
+    free(reader);
+}
+
+int shmRingReaderNext(struct ShmRingReader * reader, struct ShmRingMessage * message)
+{
+    for (;;) {
+        if (reader->next != reader->cursor) {
+            /* Done with the previous record, the writer may reuse its space */
+            reader->cursor = reader->next;
+            atomic_store_explicit(&reader->slot->cursor, reader->cursor, memory_order_release);
+        }
+        /* Closed first: a closed ring's head is final */
+        const int closed = atomic_load_explicit(&reader->header->closed, memory_order_acquire) != 0;
+        const uint64_t head = atomic_load_explicit(&reader->header->head, memory_order_acquire);
+        if (reader->cursor == head) {
+            return closed ? -1 : 0;
+        }
+        const uint64_t offset = reader->cursor & (reader->capacity - 1);
+        const unsigned char * in = reader->data + offset;
+        struct ShmRingRecord record;
+        memcpy(&record, in, sizeof(record));
+        /* Never trust the mapping: a record must lie within what was written and within the ring */
+        if (record.size < sizeof(record) || record.size % RECORD_ALIGN != 0 || record.size > head - reader->cursor
+            || offset + record.size > reader->capacity
+            || ((record.flags & RECORD_PADDING) == 0
+                && sizeof(record) + record.topic_len + (uint64_t)record.payload_len > record.size)) {
+            return -2;
+        }
+        reader->next = reader->cursor + record.size;
+        if ((record.flags & RECORD_PADDING) != 0) {
+            continue;
+        }
+        message->topic = (const char *)in + sizeof(record);
+        message->topic_len = record.topic_len;
+        message->payload = in + sizeof(record) + record.topic_len;
+        message->payload_len = record.payload_len;
+        message->qos = record.qos;
+        message->retain = (record.flags & RECORD_RETAIN) != 0;
+        return 1;
+    }
+}
+
+int shmRingReaderWait(struct ShmRingReader * reader, struct ShmRingMessage * message, int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    for (;;) {
+        /* Read before checking, so a write in between makes the futex wait return at once */
+        const uint32_t seq = atomic_load(&reader->header->seq);
+        const int rc = shmRingReaderNext(reader, message);
+        if (rc != 0 || timeout_ms == 0) {
+            return rc;
+        }
+        struct timespec remaining;
+        const struct timespec * timeout = NULL;
+        if (timeout_ms > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec -= 1;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0) {
+                return 0;
+            }
+            timeout = &remaining;
+        }
+        atomic_fetch_add(&reader->header->waiters, 1);
+        futex(&reader->header->seq, FUTEX_WAIT, seq, timeout);
+        atomic_fetch_sub(&reader->header->waiters, 1);
+    }
+}
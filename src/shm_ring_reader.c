@@ -0,0 +1,117 @@
+/*
+ shm-ring-reader: prints the messages mqtt-client-app fans out through its shared-memory ring (IO_SHM_RING), one
+ "<topic> <qos> <payload>" line each, until the app exits or SIGINT. Any number of them may read the same ring.
+
+ Usage: shm-ring-reader [-n count] [-q] [-w seconds] <name>
+   -n  stop after `count` messages
+   -q  only count the messages, print nothing per message
+   -w  wait up to `seconds` for the ring to be created
+ */
+
+/* getopt() and nanosleep() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How often a waiting reader looks for SIGINT or the ring to appear */
+static const int POLL_MS = 100;
+
+static volatile sig_atomic_t ToStop = 0;
+
+static void cfinish(int sig)
+{
+    (void)sig;
+    ToStop = 1;
+}
+
+static void usage(void)
+{
+    (void)fprintf(stderr, "Usage: shm-ring-reader [-n count] [-q] [-w seconds] <name>\n");
+}
+
+static struct ShmRingReader * openWaiting(const char * name, double wait_seconds)
+{
+    const struct timespec poll = { 0, POLL_MS * 1000000L };
+    for (double waited = 0;; waited += POLL_MS / 1000.0) {
+        struct ShmRingReader * reader = shmRingReaderOpen(name);
+        if (reader != NULL || errno != ENOENT || waited >= wait_seconds || ToStop) {
+            return reader;
+        }
+        nanosleep(&poll, NULL);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    long long limit = -1;
+    int quiet = 0;
+    double wait_seconds = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:qw:")) != -1) {
+        switch (opt) {
+        case 'n':
+            limit = atoll(optarg);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'w':
+            wait_seconds = atof(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+        return 1;
+    }
+    const char * name = argv[optind];
+
+    signal(SIGINT, cfinish);
+    signal(SIGTERM, cfinish);
+
+    struct ShmRingReader * reader = openWaiting(name, wait_seconds);
+    if (reader == NULL) {
+        (void)fprintf(stderr, "Can't open shared-memory ring %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    long long count = 0;
+    while (!ToStop && count != limit) {
+        struct ShmRingMessage msg;
+        const int rc = shmRingReaderWait(reader, &msg, POLL_MS);
+        if (rc == -2) {
+            (void)fprintf(stderr, "Malformed record in shared-memory ring %s\n", name);
+            shmRingReaderClose(reader);
+            return 1;
+        }
+        if (rc < 0) {
+            break;
+        }
+        if (rc == 0) {
+            continue;
+        }
+        ++count;
+        if (!quiet) {
+            printf("%.*s %d %.*s\n",
+                   (int)msg.topic_len,
+                   msg.topic,
+                   msg.qos,
+                   (int)msg.payload_len,
+                   (const char *)msg.payload);
+        }
+    }
+    shmRingReaderClose(reader);
+    printf("Read %lld messages\n", count);
+    return 0;
+}
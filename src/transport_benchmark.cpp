@@ -0,0 +1,207 @@
+#include "transport_benchmark.h"
+
+#include "periodic_scheduler.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace {
+
+/* How long connecting and subscribing may take */
+constexpr auto SETUP_TIMEOUT = std::chrono::seconds(5);
+/* Messages still missing once nothing arrived for this long are counted as lost */
+constexpr auto DRAIN_TIMEOUT = std::chrono::seconds(2);
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+/* SUBACK return code refusing a subscription */
+constexpr int SUBSCRIPTION_REFUSED = 0x80;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::chrono::duration<double> toDuration(const timeval & tv)
+{
+    return std::chrono::seconds(tv.tv_sec) + std::chrono::microseconds(tv.tv_usec);
+}
+
+struct BenchmarkState
+{
+    std::mutex mutex;
+    std::condition_variable cond_var;
+    std::optional<int> connect_rc;
+    std::optional<int> granted_qos;
+    uint64_t received = 0;
+    std::chrono::steady_clock::time_point last_received_tp;
+    DDSketch latency_us{ 0.01 };
+};
+
+/* Waits until `pred` holds, `timeout` passed or `stop` is raised, returns `pred()` */
+template<typename Pred>
+bool waitFor(BenchmarkState & state,
+             std::unique_lock<std::mutex> & lk,
+             std::chrono::steady_clock::duration timeout,
+             const std::atomic_bool & stop,
+             Pred pred)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!pred() && !stop && std::chrono::steady_clock::now() < deadline) {
+        state.cond_var.wait_for(lk, std::min<std::chrono::steady_clock::duration>(POLL_INTERVAL, timeout));
+    }
+    return pred();
+}
+
+} // namespace
+
+TransportBenchmarkReport runTransportBenchmark(Transport & transport,
+                                               const TransportBenchmarkOptions & options,
+                                               const std::atomic_bool & stop)
+{
+    TransportBenchmarkReport report;
+    report.transport = transport.name();
+    BenchmarkState state;
+
+    transport.setConnectCallback([&state](Transport &, int reason_code) {
+        {
+            std::lock_guard lk(state.mutex);
+            state.connect_rc = reason_code;
+        }
+        state.cond_var.notify_all();
+    });
+    /* The benchmark subscribes once, any SUBACK is for that subscription */
+    transport.setSubscribeCallback([&state](Transport &, int /*mid*/, int qos_count, const int * granted_qos) {
+        {
+            std::lock_guard lk(state.mutex);
+            state.granted_qos = qos_count > 0 ? granted_qos[0] : SUBSCRIPTION_REFUSED;
+        }
+        state.cond_var.notify_all();
+    });
+    transport.setMessageCallback([&state, &options](Transport &, const TransportMessage & msg) {
+        const int64_t received_ns = nowNs();
+        if (msg.topic != options.topic || msg.payload_len < sizeof(int64_t)) {
+            return;
+        }
+        int64_t sent_ns = 0;
+        std::memcpy(&sent_ns, msg.payload, sizeof(sent_ns));
+        {
+            std::lock_guard lk(state.mutex);
+            state.latency_us.add(static_cast<double>(received_ns - sent_ns) / 1000);
+            ++state.received;
+            state.last_received_tp = std::chrono::steady_clock::now();
+        }
+        state.cond_var.notify_all();
+    });
+    transport.setDisconnectCallback(nullptr);
+    transport.setPublishCallback(nullptr);
+
+    std::cout << "Benchmarking " << transport.name() << ": messages=" << options.num_messages
+              << " rate=" << options.rate << " msg/s payload=" << options.payload_size << "B qos=" << options.qos
+              << std::endl;
+    int rc = transport.connect();
+    if (rc != 0) {
+        report.error = std::string("Failed to connect: ") + transport.errorString(rc);
+        return report;
+    }
+    rc = transport.start();
+    if (rc != 0) {
+        report.error = std::string("Failed to start loop: ") + transport.errorString(rc);
+        return report;
+    }
+
+    std::unique_lock lk(state.mutex);
+    if (!waitFor(state, lk, SETUP_TIMEOUT, stop, [&state] { return state.connect_rc.has_value(); })) {
+        report.error = "Timed out connecting";
+    } else if (*state.connect_rc != 0) {
+        report.error = std::string("Connection refused: ") + transport.connackString(*state.connect_rc);
+    } else {
+        /* Transports may report the SUBACK from within subscribe() */
+        lk.unlock();
+        rc = transport.subscribe(options.topic.c_str(), options.qos, nullptr);
+        lk.lock();
+        if (rc != 0) {
+            report.error = std::string("Failed to subscribe: ") + transport.errorString(rc);
+        } else if (!waitFor(state, lk, SETUP_TIMEOUT, stop, [&state] { return state.granted_qos.has_value(); })) {
+            report.error = "Timed out subscribing";
+        } else if (*state.granted_qos >= SUBSCRIPTION_REFUSED) {
+            report.error = "Subscription refused";
+        }
+    }
+    lk.unlock();
+    if (!report.error.empty()) {
+        transport.disconnect();
+        transport.stop();
+        return report;
+    }
+
+    std::unique_ptr<PeriodicScheduler, decltype(&periodicSchedulerDestroy)> schedule(nullptr,
+                                                                                      periodicSchedulerDestroy);
+    if (options.rate > 0) {
+        schedule.reset(periodicSchedulerCreate(static_cast<int64_t>(1e9 / options.rate), PERIODIC_CATCH_UP, 0));
+    }
+    std::vector<char> payload(std::max(options.payload_size, sizeof(int64_t)), 'x');
+
+    rusage usage_start = {};
+    getrusage(RUSAGE_SELF, &usage_start);
+    const auto start_tp = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.num_messages && !stop; ++i) {
+        if (schedule && periodicSchedulerWait(schedule.get()) < 0) {
+            break;
+        }
+        const int64_t sent_ns = nowNs();
+        std::memcpy(payload.data(), &sent_ns, sizeof(sent_ns));
+        if (transport.publish(options.topic.c_str(), payload.data(), payload.size(), options.qos, false, nullptr)
+            == 0) {
+            ++report.sent;
+        } else {
+            ++report.failed;
+        }
+    }
+    const auto published_tp = std::chrono::steady_clock::now();
+
+    lk.lock();
+    uint64_t received = state.received;
+    while (state.received < report.sent && !stop) {
+        if (!waitFor(state, lk, DRAIN_TIMEOUT, stop, [&] { return state.received != received; })) {
+            break;
+        }
+        received = state.received;
+    }
+    report.received = state.received;
+    report.elapsed = std::max(published_tp, state.last_received_tp) - start_tp;
+    report.latency_us = state.latency_us;
+    lk.unlock();
+
+    rusage usage_end = {};
+    getrusage(RUSAGE_SELF, &usage_end);
+    report.cpu_user = toDuration(usage_end.ru_utime) - toDuration(usage_start.ru_utime);
+    report.cpu_system = toDuration(usage_end.ru_stime) - toDuration(usage_start.ru_stime);
+
+    transport.disconnect();
+    transport.stop();
+    return report;
+}
+
+void TransportBenchmarkReport::print(std::ostream & os) const
+{
+    if (!error.empty()) {
+        os << "Benchmark (" << transport << "): " << error << std::endl;
+        return;
+    }
+    const double seconds = std::max(elapsed.count(), 1e-9);
+    const auto cpu = cpu_user + cpu_system;
+    os << "Benchmark (" << transport << "): sent=" << sent << " failed=" << failed << " received=" << received
+       << " elapsed=" << elapsed.count() << "s throughput=" << received / seconds << " msg/s" << std::endl;
+    os << "  latency p50=" << latency_us.quantile(0.5) << "us p99=" << latency_us.quantile(0.99)
+       << "us p99.9=" << latency_us.quantile(0.999) << "us" << std::endl;
+    os << "  cpu user=" << cpu_user.count() << "s sys=" << cpu_system.count() << "s (" << 100 * cpu.count() / seconds
+       << "%) " << (received > 0 ? 1e6 * cpu.count() / static_cast<double>(received) : 0.0) << "us/msg" << std::endl;
+}
@@ -0,0 +1,211 @@
+#include "window_aggregator.h"
+
+#include "payload_parser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace {
+/* Pending values per topic before they are folded into the current pane */
+constexpr size_t BATCH_SIZE = 256;
+} // namespace
+
+std::string WindowStats::toJson() const
+{
+    std::ostringstream os;
+    os << R"({"window_ms":)" << window.count() << R"(,"count":)" << count << R"(,"min":)" << min << R"(,"max":)"
+       << max << R"(,"mean":)" << mean << R"(,"p50":)" << p50 << R"(,"p90":)" << p90 << R"(,"p99":)" << p99 << "}";
+    return os.str();
+}
+
+WindowAggregator::WindowAggregator(std::chrono::milliseconds window,
+                                   std::chrono::milliseconds slide,
+                                   std::string topic_prefix,
+                                   std::string value_field,
+                                   Publisher publisher)
+: window_(window)
+, slide_(std::clamp(slide, std::chrono::milliseconds(1), window))
+, num_panes_(static_cast<size_t>((window_ + slide_ - std::chrono::milliseconds(1)) / slide_))
+, topic_prefix_(std::move(topic_prefix))
+, value_field_(std::move(value_field))
+, publisher_(std::move(publisher))
+{
+}
+
+WindowAggregator::~WindowAggregator()
+{
+    stop();
+}
+
+std::optional<double> WindowAggregator::parseValue(std::string_view payload) const
+{
+    const PayloadView view(payload);
+    auto value = value_field_.empty() ? view.as<double>() : view.field<double>(value_field_);
+    if (!value || !std::isfinite(*value)) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+bool WindowAggregator::add(std::string_view topic, std::string_view payload)
+{
+    /* Don't aggregate our own output when the consume filter also matches it */
+    if (topic.starts_with(topic_prefix_) && topic.substr(topic_prefix_.size()).starts_with('/')) {
+        return false;
+    }
+    auto value = parseValue(payload);
+    if (!value) {
+        return false;
+    }
+
+    auto push = [&value](TopicWindow & window) {
+        std::lock_guard lk(window.mutex);
+        window.pending.push_back(*value);
+        if (window.pending.size() >= BATCH_SIZE) {
+            flushPending(window);
+        }
+    };
+    {
+        /* Windows are only removed by advance() under the exclusive lock */
+        std::shared_lock lk(topics_mutex_);
+        if (auto it = topics_.find(topic); it != topics_.end()) {
+            push(*it->second);
+            return true;
+        }
+    }
+    std::unique_lock lk(topics_mutex_);
+    auto & window = topics_[std::string(topic)];
+    if (!window) {
+        window = std::make_unique<TopicWindow>();
+        window->panes.emplace_back();
+    }
+    push(*window);
+    return true;
+}
+
+void WindowAggregator::flushPending(TopicWindow & window)
+{
+    const auto & values = window.pending;
+    if (values.empty()) {
+        return;
+    }
+    auto & pane = window.panes.back();
+    double min = values.front();
+    double max = values.front();
+    double sum = 0;
+    for (double value : values) {
+        min = std::min(min, value);
+        max = std::max(max, value);
+        sum += value;
+    }
+    pane.min = pane.count == 0 ? min : std::min(pane.min, min);
+    pane.max = pane.count == 0 ? max : std::max(pane.max, max);
+    pane.sum += sum;
+    pane.count += values.size();
+    pane.sketch.addBatch(values.data(), values.size());
+    window.pending.clear();
+}
+
+std::vector<WindowStats> WindowAggregator::advance()
+{
+    std::vector<WindowStats> stats;
+    std::vector<std::string> idle_topics;
+    {
+        std::shared_lock lk(topics_mutex_);
+        for (auto & [topic, window] : topics_) {
+            std::lock_guard window_lk(window->mutex);
+            flushPending(*window);
+
+            WindowStats topic_stats;
+            DDSketch merged;
+            for (const auto & pane : window->panes) {
+                if (pane.count == 0) {
+                    continue;
+                }
+                topic_stats.min = topic_stats.count == 0 ? pane.min : std::min(topic_stats.min, pane.min);
+                topic_stats.max = topic_stats.count == 0 ? pane.max : std::max(topic_stats.max, pane.max);
+                topic_stats.mean += pane.sum;
+                topic_stats.count += pane.count;
+                merged.merge(pane.sketch);
+            }
+
+            window->panes.emplace_back();
+            if (window->panes.size() > num_panes_) {
+                window->panes.pop_front();
+            }
+            if (topic_stats.count == 0) {
+                idle_topics.push_back(topic);
+                continue;
+            }
+            topic_stats.topic = topic;
+            topic_stats.window = window_;
+            topic_stats.mean /= static_cast<double>(topic_stats.count);
+            /* The sketch returns bucket midpoints, which may lie just outside the exact range */
+            auto quantile = [&](double q) { return std::clamp(merged.quantile(q), topic_stats.min, topic_stats.max); };
+            topic_stats.p50 = quantile(0.5);
+            topic_stats.p90 = quantile(0.9);
+            topic_stats.p99 = quantile(0.99);
+            stats.push_back(std::move(topic_stats));
+        }
+    }
+
+    if (!idle_topics.empty()) {
+        auto has_samples = [](const TopicWindow & window) {
+            return !window.pending.empty() ||
+                   std::any_of(window.panes.begin(), window.panes.end(), [](const Pane & p) { return p.count > 0; });
+        };
+        std::unique_lock lk(topics_mutex_);
+        for (const auto & topic : idle_topics) {
+            auto it = topics_.find(topic);
+            /* A value may have arrived since */
+            if (it != topics_.end() && !has_samples(*it->second)) {
+                topics_.erase(it);
+            }
+        }
+    }
+    return stats;
+}
+
+void WindowAggregator::publish(const std::vector<WindowStats> & stats)
+{
+    for (const auto & topic_stats : stats) {
+        publisher_(topic_prefix_ + "/" + topic_stats.topic, topic_stats.toJson());
+    }
+}
+
+void WindowAggregator::start()
+{
+    std::lock_guard lk(timer_mutex_);
+    if (timer_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    timer_ = std::thread([this] { run(); });
+}
+
+void WindowAggregator::stop()
+{
+    {
+        std::lock_guard lk(timer_mutex_);
+        if (!timer_.joinable()) {
+            return;
+        }
+        stopping_ = true;
+    }
+    timer_cond_var_.notify_all();
+    timer_.join();
+    publish(advance());
+}
+
+void WindowAggregator::run()
+{
+    auto next_tp = std::chrono::steady_clock::now() + slide_;
+    std::unique_lock lk(timer_mutex_);
+    while (!timer_cond_var_.wait_until(lk, next_tp, [this] { return stopping_; })) {
+        lk.unlock();
+        publish(advance());
+        lk.lock();
+        next_tp += slide_;
+    }
+}
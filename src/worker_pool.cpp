@@ -0,0 +1,237 @@
+#include "worker_pool.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace {
+/* How long an idle worker sleeps between steal attempts while unordered work is pending elsewhere */
+constexpr auto STEAL_POLL_INTERVAL = std::chrono::microseconds(200);
+} // namespace
+
+std::optional<OrderingPolicy> OrderingPolicy::parse(std::string_view spec)
+{
+    OrderingPolicy policy;
+    if (spec == "topic") {
+        policy.mode = Mode::TOPIC;
+    } else if (spec == "none") {
+        policy.mode = Mode::NONE;
+    } else if (spec.starts_with("levels:")) {
+        spec.remove_prefix(std::string_view("levels:").size());
+        auto [ptr, ec] = std::from_chars(spec.data(), spec.data() + spec.size(), policy.levels);
+        if (ec != std::errc() || ptr != spec.data() + spec.size() || policy.levels <= 0) {
+            return std::nullopt;
+        }
+        policy.mode = Mode::TOPIC_LEVELS;
+    } else {
+        return std::nullopt;
+    }
+    return policy;
+}
+
+std::optional<size_t> OrderingPolicy::keyHash(std::string_view topic) const
+{
+    switch (mode) {
+        case Mode::NONE:
+            return std::nullopt;
+        case Mode::TOPIC_LEVELS: {
+            size_t end = 0;
+            for (int level = 0; level < levels && end != std::string_view::npos; ++level) {
+                end = topic.find('/', level == 0 ? 0 : end + 1);
+            }
+            return std::hash<std::string_view>{}(topic.substr(0, end));
+        }
+        case Mode::TOPIC:
+        default:
+            return std::hash<std::string_view>{}(topic);
+    }
+}
+
+WorkerPool::WorkerPool(size_t num_workers, OrderingPolicy policy, Handler handler)
+: policy_(policy)
+, handler_(std::move(handler))
+{
+    workers_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < num_workers; ++i) {
+        workers_[i]->thread = std::thread([this, i] { run(i); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::submit(ReceivedMessage msg)
+{
+    if (auto key = policy_.keyHash(msg.topic())) {
+        submitOrdered(std::move(msg), *key);
+    } else {
+        submitUnordered(std::move(msg));
+    }
+}
+
+void WorkerPool::submitOrdered(ReceivedMessage msg, size_t key_hash)
+{
+    auto & worker = *workers_[key_hash % workers_.size()];
+    bool wake = false;
+    {
+        std::lock_guard lk(worker.mutex);
+        worker.ordered.push_back(std::move(msg));
+        worker.max_depth = std::max(worker.max_depth, worker.ordered.size() + worker.unordered.size());
+        wake = worker.idle;
+    }
+    if (wake) {
+        worker.cond_var.notify_one();
+    }
+}
+
+void WorkerPool::submitUnordered(ReceivedMessage msg)
+{
+    const size_t index = next_unordered_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    auto & worker = *workers_[index];
+    bool backlogged = false;
+    bool wake = false;
+    {
+        std::lock_guard lk(worker.mutex);
+        worker.unordered.push_back(std::move(msg));
+        backlogged = worker.unordered.size() > 1;
+        worker.max_depth = std::max(worker.max_depth, worker.ordered.size() + worker.unordered.size());
+        wake = worker.idle;
+    }
+    pending_unordered_.fetch_add(1, std::memory_order_release);
+    if (wake) {
+        worker.cond_var.notify_one();
+    }
+    if (backlogged) {
+        /* The owner is behind, wake its neighbour so it comes stealing */
+        workers_[(index + 1) % workers_.size()]->cond_var.notify_one();
+    }
+}
+
+void WorkerPool::stop()
+{
+    if (stopping_.exchange(true)) {
+        return;
+    }
+    for (auto & worker : workers_) {
+        {
+            /* Taking the lock orders the flag store with a worker about to wait */
+            std::lock_guard lk(worker->mutex);
+        }
+        worker->cond_var.notify_all();
+    }
+    for (auto & worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+void WorkerPool::run(size_t index)
+{
+    auto & self = *workers_[index];
+    /* Shows up in top, debuggers and the flight recorder */
+    pthread_setname_np(pthread_self(), ("worker-" + std::to_string(index)).c_str());
+    std::deque<ReceivedMessage> batch;
+    while (true) {
+        std::optional<ReceivedMessage> msg;
+        {
+            std::unique_lock lk(self.mutex);
+            if (!self.ordered.empty()) {
+                /* Ordered messages can only run here, take them all in one go to keep lock traffic low */
+                batch.swap(self.ordered);
+            } else if (!self.unordered.empty()) {
+                msg.emplace(std::move(self.unordered.front()));
+                self.unordered.pop_front();
+                pending_unordered_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if (!batch.empty()) {
+            for (const auto & ordered_msg : batch) {
+                process(self, ordered_msg);
+            }
+            batch.clear();
+            continue;
+        }
+        if (!msg) {
+            msg = steal(index);
+        }
+        if (msg) {
+            process(self, *msg);
+            continue;
+        }
+
+        std::unique_lock lk(self.mutex);
+        auto has_work = [&] { return !self.ordered.empty() || !self.unordered.empty(); };
+        if (has_work()) {
+            continue;
+        }
+        if (stopping_) {
+            break;
+        }
+        self.idle = true;
+        if (pending_unordered_.load(std::memory_order_acquire) > 0) {
+            self.cond_var.wait_for(lk, STEAL_POLL_INTERVAL, [&] { return has_work() || stopping_; });
+        } else {
+            self.cond_var.wait(lk, [&] {
+                return has_work() || stopping_ || pending_unordered_.load(std::memory_order_acquire) > 0;
+            });
+        }
+        self.idle = false;
+    }
+}
+
+std::optional<ReceivedMessage> WorkerPool::steal(size_t thief)
+{
+    if (pending_unordered_.load(std::memory_order_acquire) <= 0) {
+        return std::nullopt;
+    }
+    for (size_t offset = 1; offset < workers_.size(); ++offset) {
+        auto & victim = *workers_[(thief + offset) % workers_.size()];
+        std::unique_lock lk(victim.mutex, std::try_to_lock);
+        if (!lk.owns_lock() || victim.unordered.empty()) {
+            continue;
+        }
+        /* Take from the back, the owner consumes from the front */
+        std::optional<ReceivedMessage> msg(std::move(victim.unordered.back()));
+        victim.unordered.pop_back();
+        pending_unordered_.fetch_sub(1, std::memory_order_relaxed);
+        workers_[thief]->stolen.fetch_add(1, std::memory_order_relaxed);
+        return msg;
+    }
+    return std::nullopt;
+}
+
+void WorkerPool::process(Worker & worker, const ReceivedMessage & msg)
+{
+    try {
+        handler_(msg);
+    } catch (const std::exception & e) {
+        std::cerr << "Error handling message on topic " << msg.topic() << ": " << e.what() << std::endl;
+    }
+    worker.processed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WorkerPool::printStats(std::ostream & os) const
+{
+    os << "Worker pool: " << workers_.size() << " workers" << std::endl;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        auto & worker = *workers_[i];
+        size_t max_depth = 0;
+        {
+            std::lock_guard lk(worker.mutex);
+            max_depth = worker.max_depth;
+        }
+        os << "  worker " << i << ": processed=" << worker.processed.load() << " stolen=" << worker.stolen.load()
+           << " max_queue_depth=" << max_depth << std::endl;
+    }
+}
@@ -1,15 +1,19 @@
 import re
 import os
+import json
 import time
 import shlex
 import signal
+import tempfile
 import unittest
+from collections import Counter
 from subprocess import PIPE, Popen
 
 THIS_DIR = os.path.dirname(os.path.realpath(__file__))
 REPO_ROOT = os.path.dirname(THIS_DIR)
 MQTT_CLIENT_APP = os.path.join(REPO_ROOT, "build_release/mqtt-client-app")
 MQTT_CLIENT_APP = os.getenv("MQTT_CLIENT_APP", MQTT_CLIENT_APP)
+SHM_RING_READER = os.path.join(os.path.dirname(MQTT_CLIENT_APP), "shm-ring-reader")
 
 MQTT_PORT = "8883"
 MQTT_CAFILE = os.path.join(REPO_ROOT, "certs/ca.crt")
@@ -171,6 +175,506 @@ class Testing(unittest.TestCase):
         # Check the message was received
         self.assertIn(sample_message, out.decode())
 
+    def test_consumer_group_receives_each_message_once(self):
+        publish_topic_name = "publish_feed"
+        consume_topic_name = "group_feed"
+        num_messages_to_send = -1
+        num_messages_to_receive = 6
+
+        env = make_app_env(publish_topic_name, consume_topic_name, num_messages_to_send)
+        env.update({"IO_CONSUMER_GROUP": "sample_group", "IO_CONSUMER_COUNT": "2"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        for _ in range(2):
+            app_process.wait_for_output("Subscribed successfully to topic \\$share/sample_group/")
+
+        for i in range(num_messages_to_receive):
+            mosquitto_pub = Process(make_mosquitto_app_args("mosquitto_pub", consume_topic_name) + f" -m 'msg {i}'")
+            mosquitto_pub.wait_for_completion()
+        time.sleep(0.1)
+
+        rc, out, _ = app_process.interrupt()
+        self.assertEqual(0, rc)
+
+        # The broker should deliver each message to exactly one member of the group
+        total = re.search(r"total: messages=(\d+)", out.decode())
+        self.assertIsNotNone(total)
+        self.assertEqual(num_messages_to_receive, int(total.group(1)))
+
+    def test_loopback_transport_delivers_published_messages(self):
+        num_messages_to_send = 1000
+
+        env = make_app_env("loopback/feed", "loopback/+", num_messages_to_send)
+        env.update({"IO_TRANSPORT": "loopback", "IO_BENCHMARK": "1", "IO_MESSAGE_PERIOD_SECONDS": "0"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        benchmark = re.search(r"Benchmark: sent=(\d+) received=(\d+)", out.decode())
+        self.assertIsNotNone(benchmark)
+        self.assertEqual(num_messages_to_send, int(benchmark.group(1)))
+        self.assertEqual(num_messages_to_send, int(benchmark.group(2)))
+
+    def test_async_flows_publish_and_receive_through_awaitables(self):
+        num_flows = 4
+        num_messages_to_send = 25
+
+        env = make_app_env("async/feed", "unused/topic", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_ASYNC_FLOWS": str(num_flows),
+                "IO_ASYNC_FLOWS_VERIFY": "1",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        report = re.search(r"Async flows: flows=(\d+) acked=(\d+) failed=(\d+) .* received=(\d+)", out.decode())
+        self.assertIsNotNone(report)
+        total = num_flows * num_messages_to_send
+        self.assertEqual((str(num_flows), str(total), "0", str(total)), report.groups())
+
+    def test_outgoing_queue_passes_messages_through(self):
+        num_messages_to_send = 1000
+
+        env = make_app_env("loopback/feed", "loopback/+", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_BENCHMARK": "1",
+                "IO_MESSAGE_PERIOD_SECONDS": "0",
+                "IO_OUTGOING_QUEUE_BYTES": "65536",
+                "IO_OUTGOING_POLICY": "loopback/#=conflate,drop-newest",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        benchmark = re.search(r"Benchmark: sent=(\d+) received=(\d+)", out.decode())
+        self.assertIsNotNone(benchmark)
+        self.assertEqual(num_messages_to_send, int(benchmark.group(2)))
+        queue = re.search(r"Outgoing queue: sent=(\d+) dropped_oldest=0 dropped_newest=0", out.decode())
+        self.assertIsNotNone(queue)
+        self.assertEqual(num_messages_to_send, int(queue.group(1)))
+
+    def test_outgoing_queue_overflow_policies(self):
+        num_messages_to_send = 50
+        # One message in flight whose completion takes a minute, and room for one more in the queue, which every
+        # later one overflows
+        cases = [
+            ("conflate", "60000", r"sent=1 dropped_oldest=0 dropped_newest=0 conflated=48 blocked=0 .*queued=1 "),
+            ("drop-newest", "60000", r"sent=1 dropped_oldest=0 dropped_newest=48 conflated=0 blocked=0 .*queued=1 "),
+            ("drop-oldest", "60000", r"sent=1 dropped_oldest=48 dropped_newest=0 conflated=0 blocked=0 .*queued=1 "),
+            # Completions come back, so each publisher waits for the one before it to leave the queue
+            ("block", "5", r"sent=\d+ dropped_oldest=0 dropped_newest=0 conflated=0 blocked=48 "),
+        ]
+        for policy, ack_delay_ms, expected in cases:
+            with self.subTest(policy=policy):
+                env = make_app_env("loopback/feed", "loopback/+", num_messages_to_send)
+                env.update(
+                    {
+                        "IO_TRANSPORT": "loopback",
+                        "IO_BENCHMARK": "1",
+                        "IO_MESSAGE_PERIOD_SECONDS": "0",
+                        "IO_LOOPBACK_ACK_DELAY_MS": ack_delay_ms,
+                        "IO_OUTGOING_QUEUE_BYTES": "15",
+                        "IO_OUTGOING_IN_FLIGHT": "1",
+                        "IO_OUTGOING_POLICY": policy,
+                    }
+                )
+                app_process = Process(MQTT_CLIENT_APP, env=env)
+                rc, out, _ = app_process.wait_for_completion()
+                self.assertEqual(0, rc)
+                self.assertRegex(out.decode(), r"Outgoing queue: " + expected)
+
+    def test_priority_lanes_send_every_message(self):
+        num_messages_to_send = 1000
+
+        env = make_app_env("loopback/feed", "loopback/+", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_BENCHMARK": "1",
+                "IO_MESSAGE_PERIOD_SECONDS": "0",
+                "IO_WORKER_THREADS": "2",
+                "IO_PRIORITY_LANES": "control:loopback/control:8:own;telemetry:#:1",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        benchmark = re.search(r"Benchmark: sent=(\d+) received=(\d+)", out.decode())
+        self.assertIsNotNone(benchmark)
+        self.assertEqual(num_messages_to_send, int(benchmark.group(2)))
+        self.assertIn("Lane control: weight=8 connection=own sent=0", out.decode())
+        telemetry = re.search(r"Lane telemetry: weight=1 connection=shared sent=(\d+) dropped=0", out.decode())
+        self.assertIsNotNone(telemetry)
+        self.assertEqual(num_messages_to_send, int(telemetry.group(1)))
+
+    def test_priority_lanes_let_control_traffic_overtake_a_telemetry_backlog(self):
+        # Readings go out faster than their slow completions let them through, so they pile up in the telemetry lane,
+        # while the pipeline republishes every reading that gets through on a control topic
+        env = make_app_env("loopback/feed", "loopback/+", 100)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_BENCHMARK": "1",
+                "IO_MESSAGE_PERIOD_SECONDS": "0.002",
+                "IO_LOOPBACK_ACK_DELAY_MS": "10",
+                "IO_OUTGOING_IN_FLIGHT": "1",
+                "IO_PRIORITY_LANES": "control:control/#:8;telemetry:#:1",
+                "IO_PIPELINE": "publish:control/{topic}",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        lane_pattern = r"Lane {}: .* sent=(\d+) .* max_queued=(\d+) wait_us p50=([\d.e+]+) p99=[\d.e+]+ max=([\d.e+]+)"
+        control = re.search(lane_pattern.format("control"), out.decode())
+        telemetry = re.search(lane_pattern.format("telemetry"), out.decode())
+        self.assertIsNotNone(control)
+        self.assertIsNotNone(telemetry)
+        self.assertGreater(int(control.group(1)), 0)
+        self.assertGreater(int(telemetry.group(2)), 20)
+        # A control message waits for at most the message in flight, not for the readings queued before it
+        self.assertLess(float(control.group(4)), float(telemetry.group(3)))
+
+    def test_bulk_subscription_spreads_filters_over_connections(self):
+        num_messages_to_send = 100
+
+        with tempfile.NamedTemporaryFile("w", suffix=".txt") as filters:
+            filters.write("loopback/feed\n")
+            filters.writelines(f"devices/{i}/+/status\n" for i in range(2999))
+            filters.flush()
+
+            env = make_app_env("loopback/feed", "unused", num_messages_to_send)
+            env.update(
+                {
+                    "IO_TRANSPORT": "loopback",
+                    "IO_BENCHMARK": "1",
+                    "IO_MESSAGE_PERIOD_SECONDS": "0",
+                    "IO_SUBSCRIBE_FILE": filters.name,
+                    "IO_SUBSCRIBE_BATCH_FILTERS": "100",
+                    "IO_CONSUMER_COUNT": "3",
+                }
+            )
+            app_process = Process(MQTT_CLIENT_APP, env=env)
+            rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        self.assertRegex(
+            out.decode(),
+            r"Bulk subscription: connections=3 filters=3000 batches=30 granted=3000 refused=0 all SUBACKs",
+        )
+        benchmark = re.search(r"Benchmark: sent=(\d+) received=(\d+)", out.decode())
+        self.assertIsNotNone(benchmark)
+        self.assertEqual(num_messages_to_send, int(benchmark.group(2)))
+
+    def test_shared_memory_ring_fans_messages_out_to_readers(self):
+        num_messages_to_send = 100
+        ring_name = f"mqtt-test-{os.getpid()}"
+
+        readers = [Process([SHM_RING_READER, "-q", "-w", "5", ring_name]) for _ in range(2)]
+        env = make_app_env("loopback/feed", "loopback/feed", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_MESSAGE_PERIOD_SECONDS": "0.02",
+                "IO_SHM_RING": ring_name,
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+        self.assertRegex(
+            out.decode(), rf"Shared-memory ring {ring_name}: written={num_messages_to_send} dropped=0 "
+        )
+
+        # The readers attach while the app runs, so they may miss the first messages
+        for reader in readers:
+            rc, out, _ = reader.wait_for_completion(5)
+            self.assertEqual(0, rc)
+            read = re.search(r"Read (\d+) messages", out.decode())
+            self.assertIsNotNone(read)
+            self.assertGreater(int(read.group(1)), 0)
+            self.assertLessEqual(int(read.group(1)), num_messages_to_send)
+
+    def test_message_filter_drops_rejected_messages(self):
+        num_messages_to_send = 100
+
+        env = make_app_env("sensors/temp", "sensors/#", num_messages_to_send)
+        env.update({"IO_TRANSPORT": "loopback", "IO_MESSAGE_FILTER": "sensors/+: payload >= 50"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        stats = re.search(r"Message filter 0: .* passed=(\d+) dropped=(\d+)", out.decode())
+        self.assertIsNotNone(stats)
+        passed, dropped = int(stats.group(1)), int(stats.group(2))
+        self.assertEqual(num_messages_to_send, passed + dropped)
+        values = re.findall(r"^sensors/temp \d (\S+)$", out.decode(), re.MULTILINE)
+        self.assertEqual(passed, len(values))
+        for value in values:
+            self.assertGreaterEqual(float(value), 50)
+
+    def test_reconnect_manager_reports_time_to_ready(self):
+        env = make_app_env("sensors/temp", "sensors/#", 10)
+        env.update({"IO_TRANSPORT": "loopback", "IO_RECONNECT": "1"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        self.assertIn("Reconnect manager: connections=1 drops=0 failed_attempts=0", out.decode())
+        startup = re.search(r"Reconnect startup: connected=(\d+) .* subscribed=(\d+) ", out.decode())
+        self.assertIsNotNone(startup)
+        self.assertEqual(("1", "1"), startup.groups())
+
+    def test_reconnect_manager_backs_off_between_refused_connects(self):
+        # A connect failing outright, and one the broker refuses in its CONNACK, which libmosquitto follows with a
+        # disconnect: each refusal is one failed attempt and one backoff step
+        for refusal in ("IO_LOOPBACK_REFUSED_CONNECTS", "IO_LOOPBACK_REFUSED_CONNACKS"):
+            with self.subTest(refusal=refusal):
+                env = make_app_env("sensors/temp", "sensors/#", 10)
+                env.update(
+                    {
+                        "IO_TRANSPORT": "loopback",
+                        "IO_RECONNECT": "1",
+                        "IO_RECONNECT_INITIAL_MS": "100",
+                        "IO_RECONNECT_JITTER": "0",
+                        refusal: "3",
+                    }
+                )
+                app_process = Process(MQTT_CLIENT_APP, env=env)
+                rc, out, _ = app_process.wait_for_completion()
+                self.assertEqual(0, rc)
+
+                self.assertIn("Reconnect manager: connections=1 drops=0 failed_attempts=3", out.decode())
+                startup = re.search(r"Reconnect startup: connected=1 time_to_connected_ms p50=(\S+) ", out.decode())
+                self.assertIsNotNone(startup)
+                # Waits 100, 200 and 400 ms after the refused attempts, the sketch is within 1%
+                self.assertGreaterEqual(float(startup.group(1)), 700 * 0.99)
+                self.assertLess(float(startup.group(1)), 1400)
+                self.assertEqual(10, len(re.findall(r"^sensors/temp \d \S+$", out.decode(), re.MULTILINE)))
+
+    def test_reconnect_manager_recovers_a_dropped_connection(self):
+        num_messages_to_send = 40
+
+        env = make_app_env("sensors/temp", "sensors/#", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_MESSAGE_PERIOD_SECONDS": "0.02",
+                "IO_RECONNECT": "1",
+                "IO_RECONNECT_INITIAL_MS": "100",
+                "IO_RECONNECT_JITTER": "0",
+                "IO_LOOPBACK_DROP_AFTER": "10",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, err = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        self.assertIn("Reconnect manager: connections=1 drops=1 failed_attempts=0", out.decode())
+        recovery = re.search(r"Reconnect recovery: connected=(\d+) .* subscribed=(\d+) ", out.decode())
+        self.assertIsNotNone(recovery)
+        self.assertEqual(("1", "1"), recovery.groups())
+        # Publishes fail while the connection is down and reach the subscription again once it is back
+        failed = err.decode().count("Error publishing")
+        received = len(re.findall(r"^sensors/temp \d \S+$", out.decode(), re.MULTILINE))
+        self.assertGreaterEqual(failed, 1)
+        self.assertGreater(received, 9)
+        self.assertEqual(num_messages_to_send, received + failed)
+
+    def test_reconnect_manager_fails_when_never_connected(self):
+        env = make_app_env("sensors/temp", "sensors/#", 1)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_RECONNECT": "1",
+                "IO_RECONNECT_INITIAL_MS": "50",
+                "IO_SUBSCRIBE_TIMEOUT_SECONDS": "0.5",
+                "IO_LOOPBACK_REFUSED_CONNECTS": "1000",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, err = app_process.wait_for_completion()
+        self.assertNotEqual(0, rc)
+
+        self.assertIn("Not subscribed after", err.decode())
+        self.assertIn("No connection was ever accepted by the broker", err.decode())
+        self.assertRegex(out.decode(), r"Reconnect manager: connections=1 drops=0 failed_attempts=[1-9]")
+
+    def test_window_statistics_are_published_to_derived_topic(self):
+        num_messages_to_send = 100
+
+        env = make_app_env("sensors/temp", "#", num_messages_to_send)
+        env.update({"IO_TRANSPORT": "loopback", "IO_ANALYTICS_WINDOW_SECONDS": "0.25"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        windows = re.findall(r"^analytics/sensors/temp \d (\{.*\})$", out.decode(), re.MULTILINE)
+        self.assertGreaterEqual(len(windows), 3)
+        stats = [json.loads(window) for window in windows]
+        # The last window is published at exit, after the app stopped consuming, so it never comes back to us. At one
+        # message every 10 ms a window holds about 25.
+        received = sum(s["count"] for s in stats)
+        self.assertLessEqual(received, num_messages_to_send)
+        self.assertGreaterEqual(received, num_messages_to_send - 30)
+        for s in stats:
+            self.assertLessEqual(s["min"], s["p50"])
+            self.assertLessEqual(s["p50"], s["max"])
+
+    def test_pipeline_republishes_transformed_messages(self):
+        num_messages_to_send = 50
+
+        env = make_app_env("sensors/temp", "#", num_messages_to_send)
+        env.update({"IO_TRANSPORT": "loopback", "IO_PIPELINE": "filter:sensors/#|scale:2:1|publish:doubled/{topic}"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        out_str = out.decode()
+        readings = [int(v) for v in re.findall(r"^sensors/temp \d (\d+)$", out_str, re.MULTILINE)]
+        doubled = [float(v) for v in re.findall(r"^doubled/sensors/temp \d (\S+)$", out_str, re.MULTILINE)]
+        self.assertEqual(num_messages_to_send, len(readings))
+        # Every reading is republished; the app stops consuming before the last batch goes out, so it may not see
+        # the tail of its own output
+        self.assertRegex(out_str, rf"Publish batcher: .* published={num_messages_to_send} failed=0")
+        self.assertFalse(Counter(doubled) - Counter(2 * r + 1 for r in readings))
+
+    def test_pipeline_skips_its_own_output(self):
+        num_messages_to_send = 50
+
+        env = make_app_env("sensors/temp", "#", num_messages_to_send)
+        env.update({"IO_TRANSPORT": "loopback", "IO_PIPELINE": "scale:2:1|publish:doubled/{topic}"})
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        out_str = out.decode()
+        doubled = re.findall(r"^doubled/sensors/temp \d \S+$", out_str, re.MULTILINE)
+        self.assertNotIn("doubled/doubled/", out_str)
+        stats = re.search(r"Pipeline: in=(\d+) out=(\d+) dropped=0 own=(\d+)", out_str)
+        self.assertIsNotNone(stats)
+        self.assertEqual((num_messages_to_send, num_messages_to_send, len(doubled)), tuple(map(int, stats.groups())))
+
+    def test_fan_out_publishes_every_message_to_all_brokers(self):
+        num_messages_to_send = 100
+        brokers = ["broker-a:1883", "broker-b:1883", "broker-c:1883"]
+
+        env = make_app_env("fanout/feed", "fanout/+", num_messages_to_send)
+        env.update(
+            {
+                "IO_TRANSPORT": "loopback",
+                "IO_BENCHMARK": "1",
+                "IO_MESSAGE_PERIOD_SECONDS": "0",
+                "IO_BROKERS": ",".join(brokers),
+                "IO_BROKER_MODE": "fanout",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        # The subscription covers every broker, so each message comes back once per broker
+        out_str = out.decode()
+        benchmark = re.search(r"Benchmark: sent=(\d+) received=(\d+)", out_str)
+        self.assertIsNotNone(benchmark)
+        self.assertEqual(len(brokers) * num_messages_to_send, int(benchmark.group(2)))
+        n = num_messages_to_send
+        for broker in brokers:
+            self.assertRegex(out_str, rf"Broker {broker}: published={n} acked={n}")
+
+    def test_transport_benchmark_reports_each_transport(self):
+        num_messages_to_send = 500
+
+        env = make_app_env("bench/feed", "bench/+", num_messages_to_send)
+        env.update(
+            {
+                "IO_BENCHMARK_TRANSPORTS": "loopback,loopback",
+                "IO_BENCHMARK_MESSAGES": str(num_messages_to_send),
+                "IO_PAYLOAD_SIZE": "32",
+                "IO_QOS": "1",
+            }
+        )
+        app_process = Process(MQTT_CLIENT_APP, env=env)
+        rc, out, _ = app_process.wait_for_completion()
+        self.assertEqual(0, rc)
+
+        reports = re.findall(
+            r"Benchmark \(loopback\): sent=(\d+) failed=0 received=(\d+).*\n  latency p50=.*\n  cpu user=",
+            out.decode(),
+        )
+        self.assertEqual([(str(num_messages_to_send), str(num_messages_to_send))] * 2, reports)
+
+    def test_chunked_file_transfer_reassembles_the_file(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            send_path = os.path.join(tmp_dir, "firmware.bin")
+            receive_dir = os.path.join(tmp_dir, "received")
+            os.mkdir(receive_dir)
+            content = os.urandom(300_000)
+            with open(send_path, "wb") as f:
+                f.write(content)
+
+            env = make_app_env("files/firmware", "files/+", 1)
+            env.update(
+                {
+                    "IO_TRANSPORT": "loopback",
+                    "IO_BENCHMARK": "1",
+                    "IO_SEND_FILE": send_path,
+                    "IO_RECEIVE_DIR": receive_dir,
+                    "IO_CHUNK_SIZE": "4096",
+                    "IO_CHUNKS_IN_FLIGHT": "4",
+                    "IO_QOS": "1",
+                }
+            )
+            app_process = Process(MQTT_CLIENT_APP, env=env)
+            rc, out, _ = app_process.wait_for_completion()
+            self.assertEqual(0, rc)
+
+            out_str = out.decode()
+            self.assertRegex(out_str, r"File transfer [0-9a-f]{8}: acked=74/74 chunks")
+            self.assertRegex(out_str, r"Chunked transfers: completed=1 failed=0 incomplete=0")
+            received = os.listdir(receive_dir)
+            self.assertEqual(1, len(received))
+            with open(os.path.join(receive_dir, received[0]), "rb") as f:
+                self.assertEqual(content, f.read())
+
+
+    def test_chunked_file_transfer_refuses_files_over_the_limit(self):
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            send_path = os.path.join(tmp_dir, "firmware.bin")
+            receive_dir = os.path.join(tmp_dir, "received")
+            os.mkdir(receive_dir)
+            with open(send_path, "wb") as f:
+                f.write(os.urandom(100_000))
+
+            env = make_app_env("files/firmware", "files/+", 1)
+            env.update(
+                {
+                    "IO_TRANSPORT": "loopback",
+                    "IO_BENCHMARK": "1",
+                    "IO_SEND_FILE": send_path,
+                    "IO_RECEIVE_DIR": receive_dir,
+                    "IO_RECEIVE_MAX_BYTES": "65536",
+                    "IO_CHUNK_SIZE": "4096",
+                    "IO_QOS": "1",
+                }
+            )
+            app_process = Process(MQTT_CLIENT_APP, env=env)
+            rc, out, err = app_process.wait_for_completion()
+            self.assertEqual(0, rc)
+
+            self.assertRegex(
+                err.decode(), r"Transfer [0-9a-f]{8}: refused, 100000 bytes is more than the 65536 allowed"
+            )
+            self.assertRegex(out.decode(), r"Chunked transfers: completed=0 failed=1 incomplete=0")
+            self.assertEqual([], os.listdir(receive_dir))
 
 if __name__ == "__main__":
     unittest.main()